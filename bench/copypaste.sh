@@ -0,0 +1,37 @@
+#! /bin/sh
+
+# Memory benchmark for COPY and PASTE. It generates a test file, copies the
+# whole of it into the cut buffer, and pastes it back twice in line-by-line
+# mode. NE's peak resident set size is then read from /proc by a shell command
+# obeyed from within NE, so this works only on systems that have /proc. The
+# first argument is the NE binary to test (default src/ne), and the second is
+# the number of lines in the test file (default 100000).
+
+ne=${1:-src/ne}
+lines=${2:-100000}
+dir=${TMPDIR:-/tmp}/nebench.$$
+
+mkdir -p $dir || exit 1
+trap 'rm -rf $dir' 0 1 2 15
+
+awk -v n=$lines 'BEGIN {
+  for (i = 0; i < n; i++)
+    printf("line %d of the copy and paste test, with some padding\n", i);
+  }' >$dir/input
+
+cat >$dir/script <<'END'
+mark text; m*; copy; m1; paste; paste
+* grep VmHWM /proc/$PPID/status >peak
+END
+
+case $ne in /*) ;; *) ne=`pwd`/$ne;; esac
+cd $dir
+start=`date +%s.%N`
+$ne -line -with script -from input -to output >err 2>&1
+end=`date +%s.%N`
+sum=`cksum <output | awk '{print $1}'`
+peak=`awk '{print $2}' peak 2>/dev/null`
+awk -v s=$start -v e=$end -v p=${peak:-0} -v c=$sum \
+  'BEGIN { printf("copypaste  %8.3f s  %8d kB  %s\n", e - s, p, c) }'
+
+# End
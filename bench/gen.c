@@ -0,0 +1,244 @@
+/*************************************************
+*       The E text editor - 3rd incarnation      *
+*************************************************/
+
+/* Copyright (c) University of Cambridge, 1991 - 2021 */
+
+/* Written by Philip Hazel, starting November 1991 */
+/* This file last modified: October 2026 */
+
+
+/* This is the input generator for the benchmarks in this directory. It writes
+a synthetic file of a given kind and size to the standard output. The output
+depends only on the arguments: the pseudo-random numbers come from a private
+generator, so the files are the same on every system. Each number is taken in
+a separate statement, because the order in which function arguments are
+evaluated is not defined.
+
+  gen <kind> <lines> [<seed>]
+
+The kinds are:
+
+  log      timestamped log lines of varying length
+  csv      comma-separated records
+  source   C-like source code with indentation, comments, and tabs
+  long     lines of several thousand characters
+  utf8     text in which about a third of the words are multibyte UTF-8
+  binary   arbitrary bytes, with runs of zeros and some text; the size is
+             <lines> * 16 bytes, so that it is <lines> lines in binary mode
+
+It is built by "make bench" or by "cc -o gen gen.c". */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned long int seed;
+
+static const char *words[] = {
+  "the", "editor", "buffer", "line", "search", "replace", "store", "block",
+  "file", "screen", "command", "margin", "cursor", "mark", "paste", "cut",
+  "format", "paragraph", "window", "key", "string", "match", "error", "value",
+  "count", "return", "system", "memory", "queue", "list", "table", "index" };
+
+static const char *uwords[] = {
+  "caf\xc3\xa9", "na\xc3\xafve", "Stra\xc3\x9f" "e", "\xc3\xa5ngstr\xc3\xb6m",
+  "\xce\xb1\xce\xbb\xcf\x86\xce\xb1", "\xd0\xbc\xd0\xb8\xd1\x80",
+  "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e", "\xe2\x82\xac" "100",
+  "\xf0\x9f\x98\x80", "\xe2\x86\x92" };
+
+static const char *levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN",
+  "ERROR" };
+
+static const char *hosts[] = { "alpha", "bravo", "charlie", "delta" };
+
+#define NWORDS   (sizeof(words)/sizeof(char *))
+#define NUWORDS  (sizeof(uwords)/sizeof(char *))
+
+
+
+/*************************************************
+*            Pseudo-random numbers               *
+*************************************************/
+
+/* This is the "minimal standard" generator of Park and Miller.
+
+Argument:   the range
+Returns:    a number from 0 to range-1
+*/
+
+static int
+rnd(int range)
+{
+seed = (unsigned long int)(((unsigned long long int)seed * 16807) %
+  2147483647);
+return (int)(seed % (unsigned long int)range);
+}
+
+
+
+/*************************************************
+*            Output some words                   *
+*************************************************/
+
+static void
+putwords(int n, int utf8)
+{
+int i;
+for (i = 0; i < n; i++)
+  {
+  if (i > 0) putchar(' ');
+  if (utf8 && rnd(3) == 0) fputs(uwords[rnd(NUWORDS)], stdout);
+    else fputs(words[rnd(NWORDS)], stdout);
+  }
+}
+
+
+
+/*************************************************
+*           Generators for each kind             *
+*************************************************/
+
+static void
+gen_log(long int i)
+{
+long int t = i * 7 + rnd(7);
+int ms = rnd(1000);
+int host = rnd(4);
+int pid = 1000 + rnd(9000);
+int level = rnd(6);
+printf("2026-10-%02ld %02ld:%02ld:%02ld.%03d %s ne[%d]: %-5s ",
+  1 + (t / 86400) % 28, (t / 3600) % 24, (t / 60) % 60, t % 60, ms,
+  hosts[host], pid, levels[level]);
+putwords(3 + rnd(12), 0);
+printf(" id=%d\n", rnd(100000));
+}
+
+
+static void
+gen_csv(long int i)
+{
+int word = rnd(NWORDS);
+int host = rnd(4);
+int units = rnd(100000);
+int cents = rnd(100);
+int month = 1 + rnd(12);
+int day = 1 + rnd(28);
+int flag = rnd(2);
+printf("%ld,%s,%s,%d.%02d,2026-%02d-%02d,%s\n", i, words[word], hosts[host],
+  units, cents, month, day, flag? "yes" : "no");
+}
+
+
+static void
+gen_source(long int i)
+{
+static int depth = 0;
+int r = rnd(20);
+int j;
+
+if (r == 0) { if (depth > 0) depth--; else r = 4; }
+for (j = 0; j < depth; j++) fputs((j & 1)? "\t" : "  ", stdout);
+
+switch (r)
+  {
+  case 0: printf("}\n"); break;
+  case 1: printf("/* "); putwords(4 + rnd(8), 0); printf(" */\n"); break;
+  case 2:
+  if (depth < 6)
+    {
+    int word = rnd(NWORDS);
+    int limit = rnd(100);
+    printf("if (%s_%ld > %d)\n", words[word], i, limit);
+    for (j = 0; j < depth; j++) fputs((j & 1)? "\t" : "  ", stdout);
+    printf("{\n");
+    depth++;
+    }
+  else printf("break;\n");
+  break;
+  case 3: printf("\n"); break;
+  default:
+  printf("%s = ", words[rnd(NWORDS)]);
+  printf("%s(", words[rnd(NWORDS)]);
+  printf("%s, ", words[rnd(NWORDS)]);
+  printf("%d);\n", rnd(1000));
+  break;
+  }
+}
+
+
+static void
+gen_long(long int i)
+{
+int n = 300 + rnd(1500);
+printf("%ld: ", i);
+putwords(n, 0);
+putchar('\n');
+}
+
+
+static void
+gen_utf8(long int i)
+{
+(void)i;
+putwords(4 + rnd(12), 1);
+putchar('\n');
+}
+
+
+static void
+gen_binary(long int i)
+{
+int j;
+int r = rnd(8);
+(void)i;
+for (j = 0; j < 16; j++)
+  {
+  if (r == 0) putchar(0);
+    else if (r == 1) putchar(words[r][j % 3]);
+      else putchar(rnd(256));
+  }
+}
+
+
+
+/*************************************************
+*                 Main program                   *
+*************************************************/
+
+int
+main(int argc, char **argv)
+{
+static struct { const char *name; void (*fn)(long int); } kinds[] = {
+  { "log", gen_log }, { "csv", gen_csv }, { "source", gen_source },
+  { "long", gen_long }, { "utf8", gen_utf8 }, { "binary", gen_binary } };
+void (*fn)(long int) = NULL;
+long int lines, i;
+size_t k;
+
+if (argc < 3)
+  {
+  fprintf(stderr, "Usage: gen log|csv|source|long|utf8|binary <lines> "
+    "[<seed>]\n");
+  return 1;
+  }
+
+for (k = 0; k < sizeof(kinds)/sizeof(kinds[0]); k++)
+  if (strcmp(argv[1], kinds[k].name) == 0) fn = kinds[k].fn;
+if (fn == NULL)
+  {
+  fprintf(stderr, "gen: unknown kind \"%s\"\n", argv[1]);
+  return 1;
+  }
+
+lines = atol(argv[2]);
+seed = (argc > 3)? strtoul(argv[3], NULL, 10) : 1;
+seed = seed % 2147483647UL;
+if (seed == 0) seed = 1;
+
+for (i = 0; i < lines; i++) fn(i);
+return (fflush(stdout) == 0 && !ferror(stdout))? 0 : 1;
+}
+
+/* End of gen.c */
@@ -0,0 +1,50 @@
+#! /bin/sh
+
+# Benchmark for line storage. It generates a file of short lines, loads it,
+# and searches the whole of it for a string that is not there, a number of
+# times, in line-by-line mode. NE's peak resident set size is read from /proc
+# by a shell command obeyed from within NE, so this works only on systems that
+# have /proc. The output gives the load time, the peak memory per line, and the
+# number of lines searched per second. The first argument is the NE binary to
+# test (default src/ne), the second is the number of lines in the test file
+# (default 1000000), and the third is the number of searches (default 10).
+
+ne=${1:-src/ne}
+lines=${2:-1000000}
+searches=${3:-10}
+dir=${TMPDIR:-/tmp}/nebench.$$
+
+mkdir -p $dir || exit 1
+trap 'rm -rf $dir' 0 1 2 15
+
+awk -v n=$lines 'BEGIN {
+  for (i = 0; i < n; i++) printf("line %d\n", i);
+  }' >$dir/input
+
+echo "* grep VmHWM /proc/\$PPID/status >peak" >$dir/load
+cp $dir/load $dir/search
+i=0
+while [ $i -lt $searches ]; do
+  echo "m1; f/no such text/" >>$dir/search
+  i=`expr $i + 1`
+done
+
+case $ne in /*) ;; *) ne=`pwd`/$ne;; esac
+cd $dir
+
+start=`date +%s.%N`
+$ne -line -with load -from input -to output >err 2>&1
+mid=`date +%s.%N`
+peak=`awk '{print $2}' peak 2>/dev/null`
+$ne -line -with search -from input -to output >err 2>&1
+end=`date +%s.%N`
+
+awk -v s=$start -v m=$mid -v e=$end -v p=${peak:-0} -v n=$lines \
+  -v k=$searches 'BEGIN {
+  t = (e - m) - (m - s);
+  if (t <= 0) t = 0.000001;
+  printf("load %8.3f s  %6.1f bytes/line  search %6.1f M lines/s\n",
+    m - s, p * 1024 / n, n * k / t / 1000000);
+  }'
+
+# End
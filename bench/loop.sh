@@ -0,0 +1,41 @@
+#! /bin/sh
+
+# Benchmark for NE command loops. It generates a test file and times a number
+# of REPEAT and UNTIL loops over it in line-by-line mode. The first argument is
+# the NE binary to test (default src/ne), and the second is the number of lines
+# in the test file (default 100000). Two binaries can be compared by running
+# the script once for each; the outputs are kept so that they can be compared
+# too.
+
+ne=${1:-src/ne}
+lines=${2:-100000}
+dir=${TMPDIR:-/tmp}/nebench.$$
+
+mkdir -p $dir || exit 1
+trap 'rm -rf $dir' 0 1 2 15
+
+awk -v n=$lines 'BEGIN {
+  for (i = 0; i < n; i++)
+    if (i % 3 == 0) printf("line %d has an x here\n", i);
+      else printf("line %d plain text here\n", i);
+  }' >$dir/input
+
+# Each loop is a name followed by the command line that is obeyed.
+
+while read name cmd; do
+  echo "$cmd" >$dir/script
+  start=`date +%s.%N`
+  $ne -line -with $dir/script -from $dir/input -to $dir/out.$name \
+    >$dir/err.$name 2>&1
+  end=`date +%s.%N`
+  sum=`cksum <$dir/out.$name | awk '{print $1}'`
+  awk -v s=$start -v e=$end -v n="$name" -v c=$sum \
+    'BEGIN { printf("%-10s %8.3f s  %s\n", n, e - s, c) }'
+done <<'END'
+findedit   repeat (f/x/; e///Z/)
+findback   repeat (f/x/; bf/x/; e/x//y/)
+ifnext     until eof do (if /x/ then e/x//y/; n)
+scan       until eof do (if /x/ then (f/x/; bf/x/); n)
+END
+
+# End
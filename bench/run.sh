@@ -0,0 +1,174 @@
+#! /bin/sh
+
+# Runner for the NE benchmark suite. For each kind of input and each size, it
+# generates a file with gen.c, and then runs each of the command files in the
+# scripts directory on it in line-by-line mode. The binary kind is run only
+# with scripts/binary.ne and the load and save scripts, in binary mode. For
+# each run it reports the best elapsed time of the repeats, the throughput in
+# megabytes of input per second, NE's peak resident set size, and the store
+# statistics from NE's -stats output: the number of blocks got, and the number
+# of blocks got from the system. Peak memory is read from /proc by a shell
+# command obeyed from within NE, so it is reported as zero on systems that do
+# not have /proc. The rc column is NE's return code and the sum column is a
+# checksum of the output file, so that a change in behaviour shows up.
+#
+# Options:
+#
+#   -n <ne>        the NE binary (default src/ne)
+#   -k <kinds>     the kinds of input (default "log csv source long utf8
+#                    binary")
+#   -s <sizes>     the sizes, in lines (default "10000 100000"); the long kind
+#                    has a sixteenth of the number of lines
+#   -t <tests>     the scripts (default all of them)
+#   -r <n>         the number of times each test is run (default 3)
+#   -o <file>      write the results to <file> as well as to the output
+#   -b <file>      compare with results previously written by -o
+#
+# "make bench" runs this script from the top of the NE tree, writing the
+# results to bench.out, and comparing with bench.base if it exists. To make a
+# baseline, copy bench.out to bench.base.
+
+bench=`dirname $0`
+case $bench in /*) ;; *) bench=`pwd`/$bench;; esac
+
+ne=src/ne
+kinds="log csv source long utf8 binary"
+sizes="10000 100000"
+tests=
+repeats=3
+results=
+base=
+
+while [ $# -gt 0 ]; do
+  case $1 in
+    -n) ne=$2;;
+    -k) kinds=$2;;
+    -s) sizes=$2;;
+    -t) tests=$2;;
+    -r) repeats=$2;;
+    -o) results=$2;;
+    -b) base=$2;;
+    *)  echo "Usage: run.sh [-n ne] [-k kinds] [-s sizes] [-t tests] [-r n]" \
+          "[-o results] [-b baseline]" >&2; exit 1;;
+  esac
+  shift 2
+done
+
+if [ -z "$tests" ]; then
+  tests=`cd $bench/scripts; ls *.ne | sed 's/\.ne$//'`
+fi
+
+case $ne in /*) ;; *) ne=`pwd`/$ne;; esac
+case "$results" in ""|/*) ;; *) results=`pwd`/$results;; esac
+case "$base" in ""|/*) ;; *) base=`pwd`/$base;; esac
+
+if [ ! -x $ne ]; then
+  echo "run.sh: $ne is not an executable" >&2
+  exit 1
+fi
+if [ -n "$base" -a ! -r "$base" ]; then
+  echo "run.sh: cannot read $base" >&2
+  exit 1
+fi
+
+dir=${TMPDIR:-/tmp}/nebench.$$
+mkdir -p $dir || exit 1
+trap 'rm -rf $dir' 0 1 2 15
+
+${CC:-cc} -O -o $dir/gen $bench/gen.c || exit 1
+
+cd $dir
+echo "# test kind lines bytes rc seconds MB/s peakKB gets sysblocks sum" \
+  >results
+
+for kind in $kinds; do
+  for size in $sizes; do
+    lines=$size
+    if [ $kind = long ]; then lines=`expr $size / 16`; fi
+    ./gen $kind $lines >input || exit 1
+    bytes=`wc -c <input | tr -d ' '`
+
+    for test in $tests; do
+      opt=-line
+      if [ $kind = binary ]; then
+        case $test in
+          load|save|binary) opt="-line -binary";;
+          *) continue;;
+        esac
+      elif [ $test = binary ]; then
+        continue
+      fi
+
+      cp $bench/scripts/$test.ne script
+      echo "* grep VmHWM /proc/\$PPID/status >peak" >>script
+
+      best=
+      i=0
+      while [ $i -lt $repeats ]; do
+        rm -f output saved peak stats
+        start=`date +%s.%N`
+        $ne $opt -with script -from input -to output -stats stats >log 2>&1
+        rc=$?
+        end=`date +%s.%N`
+        best=`awk -v s=$start -v e=$end -v b="$best" 'BEGIN {
+          t = e - s;
+          if (b != "" && b < t) t = b;
+          printf("%.4f", t);
+          }'`
+        i=`expr $i + 1`
+      done
+
+      peak=`awk '{print $2}' peak 2>/dev/null`
+      store=`sed -n \
+        's/.*"store": {"gets": \([0-9]*\),.*"system_blocks": \([0-9]*\),.*/\1 \2/p' \
+        stats 2>/dev/null`
+      if [ -f saved ]; then out=saved; else out=output; fi
+      sum=`cksum <$out 2>/dev/null | awk '{print $1}'`
+
+      echo "$test $kind $lines $bytes $rc $best ${peak:-0} ${store:-0 0} ${sum:-0}" |
+        awk '{ mbs = ($6 > 0)? $4 / $6 / 1000000 : 0;
+          printf("%s %s %s %s %s %s %.1f %s %s %s %s\n",
+            $1, $2, $3, $4, $5, $6, mbs, $7, $8, $9, $10) }' >>results
+    done
+  done
+done
+
+if [ -n "$results" ]; then cp results $results; fi
+
+# Output the table, with comparisons if there is a baseline. Changes in time
+# or peak memory are shown as percentages; a change of return code or output
+# checksum is flagged.
+
+awk -v base="$base" '
+  BEGIN {
+    if (base != "")
+      while ((getline line <base) > 0) {
+        if (line ~ /^#/) continue;
+        split(line, f, " ");
+        k = f[1] " " f[2] " " f[3];
+        btime[k] = f[6]; bpeak[k] = f[8]; brc[k] = f[5]; bsum[k] = f[11];
+      }
+    printf("%-9s %-7s %7s %8s %8s %8s %9s %7s", "test", "kind", "lines",
+      "seconds", "MB/s", "peakKB", "gets", "sysblk");
+    if (base != "") printf(" %7s %7s", "time", "peak");
+    printf("\n");
+  }
+  /^#/ { next }
+  {
+    printf("%-9s %-7s %7s %8s %8s %8s %9s %7s", $1, $2, $3, $6, $7, $8, $9,
+      $10);
+    k = $1 " " $2 " " $3;
+    if (base != "") {
+      if (!(k in btime)) printf("   (no baseline)");
+      else {
+        printf(" %+6.1f%%", (btime[k] > 0)? ($6 - btime[k]) * 100 / btime[k] : 0);
+        printf(" %+6.1f%%", (bpeak[k] > 0)? ($8 - bpeak[k]) * 100 / bpeak[k] : 0);
+        if (brc[k] != $5) printf("  rc %s -> %s", brc[k], $5);
+        if (bsum[k] != $11) printf("  output differs");
+      }
+    }
+    else if ($5 != 0) printf("  rc %s", $5);
+    printf("\n");
+  }' results
+
+# End
@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2018 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: August 2018 */
+/* This file last modified: October 2026 */
 
 /* This header file contains a list of procedures for obeying E commands. They
 have to be global so that they can be inserted into a vector. */
@@ -48,6 +48,7 @@ extern int e_eightbit(cmdstr *);
 extern int e_endpar(cmdstr *);
 extern int e_f(cmdstr *);
 extern int e_fks(cmdstr *);
+extern int e_follow(cmdstr *);
 extern int e_format(cmdstr *);
 extern int e_front(cmdstr *);
 extern int e_g(cmdstr *);
@@ -76,6 +77,7 @@ extern int e_plllr(cmdstr *);
 extern int e_proc(cmdstr *);
 extern int e_prompt(cmdstr *);
 extern int e_readonly(cmdstr *);
+extern int e_redo(cmdstr *);
 extern int e_refresh(cmdstr *);
 extern int e_renumber(cmdstr *);
 extern int e_repeat(cmdstr *);
@@ -91,6 +93,7 @@ extern int e_title(cmdstr *);
 extern int e_topline(cmdstr *);
 extern int e_ucl(cmdstr *);
 extern int e_undelete(cmdstr *);
+extern int e_undo(cmdstr *);
 extern int e_unformat(cmdstr *);
 extern int e_verify(cmdstr *);
 extern int e_w(cmdstr *);
@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2016 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: January 2016 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains debugging code. */
@@ -60,6 +60,9 @@ debug_printf("cursor_row         = %2d cursor_col         = %2d\n",
   cursor_row, cursor_col);
 debug_printf("window_width       = %2d window_depth       = %2d\n",
   window_width, window_depth);
+debug_printf("screen_frames      = %d screen_writes      = %d\n",
+  screen_frames, screen_writes);
+debug_printf("screen_maxwrites   = %d\n", screen_maxwrites);
 debug_printf("-------------------------------------------------\n");
 }
 
@@ -86,8 +89,10 @@ if (crash_logfile == NULL)
     }
   }
 
+/* The file is not flushed here, because that would slow down whatever is
+being logged. It is closed by crash_handler() and tidy_up(). */
+
 vfprintf(crash_logfile, format, ap);
-fflush(crash_logfile);
 va_end(ap);
 }
 
@@ -0,0 +1,335 @@
+/*************************************************
+*       The E text editor - 3rd incarnation      *
+*************************************************/
+
+/* Copyright (c) University of Cambridge, 1991 - 2021 */
+
+/* Written by Philip Hazel, starting November 1991 */
+/* This file last modified: October 2026 */
+
+
+/* This file contains code for the -batch option, which applies one command
+file to each of a list of files. The list and the command file are read once,
+and then a child process is forked for each file in the list, up to -jobs of
+them at a time. Each child carries on exactly as if NE had been run with -with
+on that file alone, except that it reads its commands from the copy in store.
+The output of each child goes to a temporary file, which is copied to the
+standard output in the order of the list, so that the output for different
+files is not mixed up. When all the files have been done, a summary is output,
+and NE exits with the highest of the children's return codes. */
+
+
+#include "ehdr.h"
+#include <sys/wait.h>
+
+/* The number of files whose output may be waiting to be copied, as a multiple
+of the number of jobs; this limits the number of open temporary files. */
+
+#define batch_window  8
+
+typedef struct {
+  uschar *name;         /* The file name */
+  FILE   *out;          /* Its output; NULL when copied */
+  pid_t   pid;          /* The child process */
+  int     rc;           /* Its return code; -1 while running */
+  int     sig;          /* The signal that killed it, or 0 */
+} batchjob;
+
+static batchjob *jobs;
+static int       jobcount;
+
+
+
+/*************************************************
+*           Double the size of a block           *
+*************************************************/
+
+/*
+Arguments:
+  p            the block
+  size         its current size
+
+Returns:       a new block of twice the size, with the data copied
+*/
+
+static void *
+batch_extend(void *p, size_t size)
+{
+void *newp = store_Xget(2 * size);
+memcpy(newp, p, size);
+store_free(p);
+return newp;
+}
+
+
+
+/*************************************************
+*            Read a file into store              *
+*************************************************/
+
+/* This is used for the command file and for the list of files. The data is
+terminated by a binary zero.
+
+Arguments:
+  name         the file name, or "-" for the standard input
+  lenptr       where to put the length
+
+Returns:       the data
+*/
+
+static uschar *
+batch_readfile(uschar *name, size_t *lenptr)
+{
+FILE *f = (Ustrcmp(name, "-") == 0)? stdin : sys_fopen(name, US"r");
+size_t size = 4096;
+size_t len = 0;
+uschar *data;
+
+if (f == NULL) error_moan(5, name, "reading", strerror(errno));  /* Hard */
+
+data = store_Xget(size);
+for (;;)
+  {
+  size_t n = fread(data + len, 1, size - len - 1, f);
+  len += n;
+  if (len < size - 1) break;
+  if (n == 0) break;
+  data = batch_extend(data, size);
+  size *= 2;
+  }
+
+if (ferror(f)) error_moan(5, name, "reading", strerror(errno));  /* Hard */
+if (f != stdin) fclose(f);
+data[len] = 0;
+*lenptr = len;
+return data;
+}
+
+
+
+/*************************************************
+*          Read the list of file names           *
+*************************************************/
+
+/* There is one name per line. Blank lines are ignored.
+
+Argument:   the name of the list
+Returns:    nothing
+*/
+
+static void
+batch_readlist(uschar *listname)
+{
+size_t len;
+uschar *list = batch_readfile(listname, &len);
+uschar *p = list;
+int size = 64;
+
+jobs = store_Xget(size * sizeof(batchjob));
+jobcount = 0;
+
+while (*p != 0)
+  {
+  uschar *nl = Ustrchr(p, '\n');
+  uschar *e = (nl == NULL)? p + Ustrlen(p) : nl;
+  uschar *next = (nl == NULL)? e : nl + 1;
+
+  if (e > p && e[-1] == '\r') e--;
+  if (e > p)
+    {
+    if (jobcount >= size)
+      {
+      jobs = batch_extend(jobs, size * sizeof(batchjob));
+      size *= 2;
+      }
+    *e = 0;
+    if (e - p >= FNAME_BUFFER_SIZE) error_moan(12, p, "too long");  /* Hard */
+    jobs[jobcount].name = p;
+    jobs[jobcount].out = NULL;
+    jobs[jobcount].pid = 0;
+    jobs[jobcount].rc = -1;
+    jobs[jobcount].sig = 0;
+    jobcount++;
+    }
+  p = next;
+  }
+}
+
+
+
+/*************************************************
+*       Copy the output of a finished job        *
+*************************************************/
+
+/* A line containing the file name is output first, unless there is no
+output.
+
+Argument:   the job
+Returns:    nothing
+*/
+
+static void
+batch_copyout(batchjob *job)
+{
+uschar buffer[8192];
+size_t n;
+BOOL first = TRUE;
+
+rewind(job->out);
+while ((n = fread(buffer, 1, sizeof(buffer), job->out)) > 0)
+  {
+  if (first) sys_mprintf(msgs_fid, "--- %s ---\n", job->name);
+  first = FALSE;
+  sys_mwrite(msgs_fid, buffer, n);
+  }
+fclose(job->out);
+job->out = NULL;
+}
+
+
+
+/*************************************************
+*           Output the summary and exit          *
+*************************************************/
+
+static void
+batch_finish(void)
+{
+int i;
+int failed = 0;
+int yield = 0;
+
+for (i = 0; i < jobcount; i++) if (jobs[i].rc != 0) failed++;
+
+sys_mprintf(msgs_fid, "NE batch: %d file%s, %d succeeded, %d failed\n",
+  jobcount, (jobcount == 1)? "" : "s", jobcount - failed, failed);
+
+for (i = 0; i < jobcount; i++)
+  {
+  batchjob *job = jobs + i;
+  if (job->rc == 0) continue;
+  if (job->sig != 0)
+    sys_mprintf(msgs_fid, "  %s: killed by signal %d\n", job->name, job->sig);
+  else
+    sys_mprintf(msgs_fid, "  %s: return code %d\n", job->name, job->rc);
+  if (job->rc > yield) yield = job->rc;
+  }
+
+exit(yield);
+}
+
+
+
+/*************************************************
+*             Run the batch                      *
+*************************************************/
+
+/* This is called from main() after the command line has been decoded. It
+returns only in a child process, having set it up to process one file.
+
+Arguments:
+  listname     the name of the list of files
+  withname     the name of the command file
+  njobs        the maximum number of children at once; 0 means the number
+                 of processors
+  nameptr      where to return the name of the child's file
+
+Returns:       the child's command input, or NULL if the command file is
+                 empty
+*/
+
+FILE *
+batch_run(uschar *listname, uschar *withname, int njobs, uschar **nameptr)
+{
+size_t scriptlen;
+uschar *script = batch_readfile(withname, &scriptlen);
+int next = 0;       /* Next job to start */
+int shown = 0;      /* Next job whose output is to be copied */
+int running = 0;
+
+batch_readlist(listname);
+
+if (njobs <= 0)
+  {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  njobs = (n > 0)? (int)n : 1;
+  }
+
+fflush(stdout);
+fflush(stderr);
+
+while (shown < jobcount)
+  {
+  /* Start as many jobs as are allowed. */
+
+  while (running < njobs && next < jobcount &&
+         next < shown + batch_window * njobs)
+    {
+    batchjob *job = jobs + next++;
+    pid_t pid;
+
+    if ((job->out = tmpfile()) == NULL ||
+        (pid = fork()) < 0)
+      {
+      if (job->out != NULL) fclose(job->out);
+      job->out = NULL;
+      job->rc = 12;
+      error_printf("** NE batch: cannot start a process for %s: %s\n",
+        job->name, strerror(errno));
+      continue;
+      }
+
+    /* The child's output goes to the temporary file. */
+
+    if (pid == 0)
+      {
+      int fd = fileno(job->out);
+      if (dup2(fd, 1) < 0 || dup2(fd, 2) < 0) exit(12);
+      fclose(job->out);
+      *nameptr = job->name;
+      return (scriptlen == 0)? NULL : fmemopen(script, scriptlen, "r");
+      }
+
+    job->pid = pid;
+    running++;
+    }
+
+  /* Wait for a job to finish. */
+
+  if (running > 0)
+    {
+    int i, status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0)
+      {
+      if (errno == EINTR) continue;
+      break;
+      }
+    for (i = 0; i < jobcount; i++)
+      {
+      batchjob *job = jobs + i;
+      if (job->pid != pid || job->rc >= 0) continue;
+      if (WIFEXITED(status)) job->rc = WEXITSTATUS(status); else
+        {
+        job->sig = WIFSIGNALED(status)? WTERMSIG(status) : 0;
+        job->rc = 128 + job->sig;
+        }
+      running--;
+      break;
+      }
+    }
+
+  /* Copy the output of finished jobs, in order. */
+
+  while (shown < jobcount && jobs[shown].rc >= 0)
+    {
+    if (jobs[shown].out != NULL) batch_copyout(jobs + shown);
+    shown++;
+    }
+  }
+
+batch_finish();
+return NULL;    /* Never reached */
+}
+
+/* End of ebatch.c */
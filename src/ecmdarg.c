@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2021 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: May 2021 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains code for reading the arguments of commands */
@@ -230,7 +230,11 @@ else cmd->flags |= cmdf_arg1;
 *            The CL command                      *
 *************************************************/
 
-static void c_cl(cmdstr *cmd) { if (!cmd_atend()) c_iline(cmd); }
+static void c_cl(cmdstr *cmd)
+{
+cmd->flags |= cmdf_count;
+if (!cmd_atend()) c_iline(cmd);
+}
 
 
 
@@ -796,9 +800,63 @@ else if (Ustrcmp(cmd_word, "newcommentstyle") == 0)
   cmd->misc = set_oldcommentstyle;
   }
 
+else if (Ustrcmp(cmd_word, "latency") == 0)
+  {
+  cmd->misc = set_latency;
+  c_autoalign(cmd);
+  }
+
+else if (Ustrcmp(cmd_word, "stats") == 0)
+  {
+  cmd->misc = set_stats;
+  c_autoalign(cmd);
+  }
+
+else if (Ustrcmp(cmd_word, "storerelease") == 0)
+  {
+  cmd->misc = set_storerelease;
+  c_autoalign(cmd);
+  }
+
+else if (Ustrcmp(cmd_word, "trace") == 0)
+  {
+  cmd->misc = set_trace;
+  c_autoalign(cmd);
+  }
+
+else if (Ustrcmp(cmd_word, "undo") == 0)
+  {
+  cmd->misc = set_undo;
+  c_autoalign(cmd);
+  }
+
+else if (Ustrcmp(cmd_word, "autosave") == 0)
+  {
+  cmd->misc = set_autosave;
+  c_autoalign(cmd);
+  }
+
+else if (Ustrcmp(cmd_word, "undolimit") == 0)
+  {
+  int n = cmd_readnumber();
+  if (n > 0)
+    {
+    cmd->misc = set_undolimit;
+    cmd->arg1.value = n;
+    cmd->flags |= cmdf_arg1;
+    }
+  else
+    {
+    error_moan(13, "Positive number");
+    cmd_faildecode = TRUE;
+    }
+  }
+
 else   /* unknown SET option */
   {
-  error_moan(13, "\"autovscroll\" or \"splitscrollrow\"");
+  error_moan(13, "\"autosave\", \"autovscroll\", \"splitscrollrow\", "
+    "\"latency\", \"stats\", \"storerelease\", \"trace\", \"undo\", "
+    "or \"undolimit\"");
   cmd_faildecode = TRUE;
   }
 }
@@ -824,10 +882,15 @@ else if (Ustrcmp(cmd_word, "keyactions") == 0) cmd->misc = show_actions;
 else if (Ustrcmp(cmd_word, "commands") == 0)   cmd->misc = show_commands;
 else if (Ustrcmp(cmd_word, "wordchars") == 0)  cmd->misc = show_wordchars;
 else if (Ustrcmp(cmd_word, "settings") == 0)   cmd->misc = show_settings;
+else if (Ustrcmp(cmd_word, "latency") == 0)    cmd->misc = show_latency;
+else if (Ustrcmp(cmd_word, "stats") == 0)      cmd->misc = show_stats;
+else if (Ustrcmp(cmd_word, "store") == 0)      cmd->misc = show_store;
+else if (Ustrcmp(cmd_word, "undo") == 0)       cmd->misc = show_undo;
 else
   {
   error_moan(13, "keys, ckeys, fkeys, xkeys, keystrings, buffers, keyactions, "
-    "commands,\n   wordchars, wordcount, settings, or version");
+    "commands,\n   wordchars, wordcount, settings, latency, stats, store, undo, or "
+    "version");
   cmd_faildecode = TRUE;
   }
 }
@@ -1052,6 +1115,7 @@ cmd_Cproc cmd_Cproclist[] = {
   c_f,          /* f */
   c_fks,        /* fkeystring */
   c_fks,        /* fks */
+  c_autoalign,  /* follow */
   noargs,       /* format */
   noargs,       /* front */
   c_ga,         /* ga */
@@ -1086,6 +1150,7 @@ cmd_Cproc cmd_Cproclist[] = {
   c_proc,       /* proc */
   c_autoalign,  /* prompt */
   c_autoalign,  /* readonly */
+  noargs,       /* redo */
   noargs,       /* refresh */
   noargs,       /* renumber */
   c_repeat,     /* repeat */
@@ -1103,6 +1168,7 @@ cmd_Cproc cmd_Cproclist[] = {
   noargs,       /* topline */
   noargs,       /* ucl */
   noargs,       /* undelete */
+  noargs,       /* undo */
   noargs,       /* unformat */
   c_unless,     /* unless */
   c_until,      /* until */
@@ -1178,6 +1244,7 @@ cmd_Eproc cmd_Eproclist[] = {
   e_f,          /* f */
   e_fks,        /* fkeystring */
   e_fks,        /* fks */
+  e_follow,     /* follow */
   e_format,     /* format */
   e_front,      /* front */ 
   e_g,          /* ga */
@@ -1212,6 +1279,7 @@ cmd_Eproc cmd_Eproclist[] = {
   e_proc,       /* proc */
   e_prompt,     /* prompt */
   e_readonly,   /* readonly */
+  e_redo,       /* redo */
   e_refresh,    /* refresh */
   e_renumber,   /* renumber */
   e_repeat,     /* repeat */
@@ -1229,6 +1297,7 @@ cmd_Eproc cmd_Eproclist[] = {
   e_topline,    /* topline */
   e_ucl,        /* ucl */
   e_undelete,   /* undelete */
+  e_undo,       /* undo */
   e_unformat,   /* unformat */ 
   e_if,         /* unless */
   e_while,      /* until */
@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2018 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: August 2018 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains code for the top-level handling of a command
@@ -18,6 +18,28 @@ line, and for compiling the line into an internal form. */
 
 static BOOL SpecialCmd;
 
+/* Cache of compiled command lines. Lines obeyed via cmd_obey() that compile
+without error, and without needing continuation lines, are kept in compiled
+form, keyed by their text and the settings that can affect compilation, so that
+obeying the same line again (from a keystring, a command file, or the command
+stack) does not re-compile it. The list is kept in most-recently-used order. An
+entry that is being obeyed when it is discarded is marked as an orphan, and is
+freed when it is finished with. */
+
+#define cache_size   32
+
+typedef struct cachestr {
+  struct cachestr *next;
+  uschar *text;
+  cmdstr *compiled;
+  int     modes;
+  int     busy;
+  BOOL    orphan;
+} cachestr;
+
+static cachestr *cmd_cache = NULL;
+static int cmd_cachecount = 0;
+
 /* This list must be in alphabetical order, and must be kept in step
 with the two tables at the end of ecmdarg, and also with the following
 table of read-only permissions. This table is global so that it can be
@@ -74,6 +96,7 @@ uschar *cmd_list[] = {
   US"f",
   US"fkeystring",
   US"fks",
+  US"follow",
   US"format",
   US"front",
   US"ga",
@@ -108,6 +131,7 @@ uschar *cmd_list[] = {
   US"proc",
   US"prompt",
   US"readonly",
+  US"redo",
   US"refresh",
   US"renumber",
   US"repeat",
@@ -125,6 +149,7 @@ uschar *cmd_list[] = {
   US"topline",
   US"ucl",
   US"undelete",
+  US"undo",
   US"unformat", 
   US"unless",
   US"until",
@@ -199,6 +224,7 @@ uschar cmd_readonly[] = {
   1, /* f */
   1, /* fkeystring */
   1, /* fks */
+  1, /* follow */
   0, /* format */
   0, /* front */
   0, /* ga */
@@ -233,6 +259,7 @@ uschar cmd_readonly[] = {
   1, /* proc */
   1, /* prompt */
   1, /* readonly */
+  0, /* redo */
   1, /* refresh */
   0, /* renumber */
   1, /* repeat */
@@ -250,6 +277,7 @@ uschar cmd_readonly[] = {
   1, /* topline */
   0, /* ucl */
   0, /* undelete */
+  0, /* undo */
   0, /* unformat */
   1, /* unless */
   1, /* until */
@@ -571,6 +599,48 @@ return yield;
 
 
 
+/*************************************************
+*            Find the name of a command          *
+*************************************************/
+
+/* This is used for error messages and statistics. Bracketed sequences and
+procedure calls have descriptive names.
+
+Arguments:
+  id           the command id
+  temp         a buffer of at least 2 bytes for a single-character name
+
+Returns:       the name
+*/
+
+uschar *cmd_idname(int id, uschar *temp)
+{
+if (id < cmd_specialbase) return cmd_list[id];
+if (id < cmd_sequence)
+  {
+  temp[0] = xcmdlist[id - cmd_specialbase];
+  temp[1] = 0;
+  return temp;
+  }
+
+/* We can't use a switch because cmd_sequence and cmd_obeyproc are not
+constants. */
+
+if (id == cmd_sequence) return US"bracketed sequence";
+if (id == cmd_obeyproc) return US"command procedure";
+return US"unknown command";
+}
+
+
+/* The number of command ids, for sizing tables. */
+
+int cmd_idcount(void)
+{
+return cmd_obeyproc + 1;
+}
+
+
+
 /*************************************************
 *                Obey command line               *
 *************************************************/
@@ -589,9 +659,14 @@ if (++cmd_bracount > 300)
   return done_error;
   }
 
+/* Each complete command line is a separate group for UNDO. */
+
+if (cmd_bracount == 1) undo_group(FALSE);
+
 /* For each command, obey it <count> times, provided there are no errors.
 Single-char commands take care of the count themselves, so are called only
-once. They are identified by high-valued ids. */
+once. They are identified by high-valued ids. Other commands that do so have
+the cmdf_count flag set. */
 
 while (cmd != NULL && yield == done_continue)
   {
@@ -601,29 +676,8 @@ while (cmd != NULL && yield == done_continue)
 
   if (main_readonly && !cmd_readonly[(usint)(cmd->id)])
     {
-    uschar *cmdname;
     uschar temp[4];
-
-    if (cmd->id < cmd_specialbase)
-      cmdname = cmd_list[(usint)(cmd->id)];
-    else if (cmd->id < cmd_sequence)
-      {
-      temp[0] = xcmdlist[cmd->id - cmd_specialbase];
-      temp[1] = 0;
-      cmdname = temp;
-      }
-
-    /* These ones should never occur, but don't skimp on the code. We
-    can't use a switch because cmd_sequence and cmd_obeyproc are not
-    constants. */
-
-    else if (cmd->id == cmd_sequence)
-      cmdname = US"bracketed sequence";
-    else if (cmd->id == cmd_obeyproc)
-      cmdname = US"command procedure";
-    else cmdname = US"unknown command";
-
-    error_moan(52, cmdname);
+    error_moan(52, cmd_idname(cmd->id, temp));
     yield = done_error;
     break;
     }
@@ -631,19 +685,23 @@ while (cmd != NULL && yield == done_continue)
   /* OK the command is permitted. */
 
   count =
-    ((int)(cmd->id) >= cmd_specialbase && (int)(cmd->id) < cmd_specialend)?
-      1 : cmd->count;
+    (((int)(cmd->id) >= cmd_specialbase && (int)(cmd->id) < cmd_specialend) ||
+      (cmd->flags & cmdf_count) != 0)? 1 : cmd->count;
 
   while (count-- > 0)
     {
-    if (main_interrupted(ci_cmd)) return done_error;
+    if (main_interrupted((cmd_loopdepth > 0)? ci_loop : ci_cmd))
+      return done_error;
 
     /* Now obey the command, maintaining the BACK flag (?). The
     main_leave_message flag is set if the command leaves a message in the
     message window in screen mode running. */
 
     main_leave_message = FALSE;
-    yield = (cmd_Eproclist[(usint)(cmd->id)])(cmd);
+    TRACE(tr_cmd, cmd->id, 0);
+    yield = main_stats? stats_obey(cmd) :
+      (cmd_Eproclist[(usint)(cmd->id)])(cmd);
+    TRACE(tr_cmdend, cmd->id, yield);
 
     /* Commands that generate output (e_g. SHOW) return
     done_wait; in fullscreen mode, if there are more commands
@@ -702,20 +760,172 @@ return cmd_obeyline(cmd->arg1.cmds);
 
 
 
+/*************************************************
+*      Compute modes for compiled line cache     *
+*************************************************/
+
+/* These are the settings that affect the result of compiling a command line.
+Case matching does not actually affect compilation, but it is included so that
+a cached line is never obeyed in a different casematch state from the one in
+which it was compiled. The interactive and file state affect whether IF
+commands look for ELSE on a following line. */
+
+static int
+cache_modes(void)
+{
+return (cmd_casematch? 1 : 0) |
+       (main_unixregexp? 2 : 0) |
+       (main_oldcomment? 4 : 0) |
+       (main_interactive? 8 : 0) |
+       ((cmdin_fid == NULL)? 16 : 0) |
+       (main_screenOK? 32 : 0) |
+       (window_depth << 6);
+}
+
+
+
+/*************************************************
+*       Free an entry in compiled line cache     *
+*************************************************/
+
+static void
+cache_free(cachestr *p)
+{
+if (p->busy > 0) p->orphan = TRUE; else
+  {
+  cmd_freeblock((cmdblock *)(p->compiled));
+  store_free(p->text);
+  store_free(p);
+  }
+}
+
+
+
+/*************************************************
+*          Empty the compiled line cache         *
+*************************************************/
+
+/* This is called when something that might affect the compilation of
+command lines changes, for example, the set of word characters. */
+
+void
+cmd_cacheflush(void)
+{
+while (cmd_cache != NULL)
+  {
+  cachestr *next = cmd_cache->next;
+  cache_free(cmd_cache);
+  cmd_cache = next;
+  }
+cmd_cachecount = 0;
+}
+
+
+
+/*************************************************
+*      Look up a line in the compiled cache      *
+*************************************************/
+
+/* If found, the entry is moved to the front of the list. */
+
+static cachestr *
+cache_find(uschar *cmdline)
+{
+cachestr *p;
+cachestr *prev = NULL;
+int modes = cache_modes();
+
+for (p = cmd_cache; p != NULL; prev = p, p = p->next)
+  {
+  if (p->modes == modes && p->text[0] == cmdline[0] &&
+      Ustrcmp(p->text, cmdline) == 0)
+    {
+    if (prev != NULL)
+      {
+      prev->next = p->next;
+      p->next = cmd_cache;
+      cmd_cache = p;
+      }
+    return p;
+    }
+  }
+return NULL;
+}
+
+
+
+/*************************************************
+*        Add a line to the compiled cache        *
+*************************************************/
+
+/* The least recently used entry is discarded if the cache is full. The text
+has already been copied. */
+
+static cachestr *
+cache_add(uschar *text, cmdstr *compiled)
+{
+cachestr *p;
+
+if (cmd_cachecount >= cache_size)
+  {
+  cachestr **pp = &cmd_cache;
+  while ((*pp)->next != NULL) pp = &((*pp)->next);
+  cache_free(*pp);
+  *pp = NULL;
+  cmd_cachecount--;
+  }
+
+p = store_Xget(sizeof(cachestr));
+p->text = text;
+p->compiled = compiled;
+p->modes = cache_modes();
+p->busy = 0;
+p->orphan = FALSE;
+p->next = cmd_cache;
+cmd_cache = p;
+cmd_cachecount++;
+return p;
+}
+
+
+
 /*************************************************
 *               Handle command line              *
 *************************************************/
 
-/* The command line may be in fixed store, and so is not freed. */
+/* The command line may be in fixed store, and so is not freed. A compiled
+version is taken from the cache if possible. Otherwise the line is compiled,
+and added to the cache if there was no error and no continuation lines were
+read (these overwrite the line, and in any case are not part of the key). */
 
 int cmd_obey(uschar *cmdline)
 {
 int yield = done_error;
+int oldtag = main_storetag;
 BOOL endscolon;
 cmdstr *compiled;
+cachestr *entry;
 
 main_cicount = 0;
-compiled = CompileCmdLine(cmdline, &endscolon);
+main_storetag = st_commands;
+entry = cache_find(cmdline);
+
+if (entry != NULL)
+  {
+  compiled = entry->compiled;
+  cmd_faildecode = FALSE;
+  cmd_cmdline = cmdline;
+  cmd_ptr = cmdline + Ustrlen(cmdline);
+  }
+else
+  {
+  int joins = cmd_joincount;
+  uschar *text = store_copystring(cmdline);
+  compiled = CompileCmdLine(cmdline, &endscolon);
+  if (!cmd_faildecode && compiled != NULL && cmd_joincount == joins)
+    entry = cache_add(text, compiled);
+  else store_free(text);
+  }
 
 /* Save the command line, whether or not it compiled correctly, unless
 it is null or identical to the previous line. */
@@ -732,7 +942,8 @@ if (cmdline[0] != 0 && (cmd_stackptr == 0 || Ustrcmp(cmd_stack[cmd_stackptr-1],
     }
   }
 
-/* If successfully decoded, obey the commands and then free the store */
+/* If successfully decoded, obey the commands and then free the store unless
+the compiled line is in the cache. */
 
 if (!cmd_faildecode)
   {
@@ -741,10 +952,15 @@ if (!cmd_faildecode)
   cmd_bracount = 0;
   cmd_eoftrap = FALSE;
   cmd_refresh = FALSE;
+  if (entry != NULL) entry->busy++;
+  main_storetag = st_edit;
   if ((yield = cmd_obeyline(compiled)) == done_finish) main_done = TRUE;
-  cmd_freeblock((cmdblock *)compiled);
+  if (entry == NULL) cmd_freeblock((cmdblock *)compiled);
+    else if (--entry->busy == 0 && entry->orphan) cache_free(entry);
   }
 
+main_storetag = oldtag;
+if (main_storerelease) (void)store_release();
 return yield;
 }
 
@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2021 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: May 2021 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains code for command-processing functions */
@@ -225,12 +225,18 @@ return yield;
 *            Free a control block                *
 *************************************************/
 
-/* Any attached blocks are also freed */
+/* Any attached blocks are also freed. If the block is one from which a
+remembered search expression was copied, the remembered source is forgotten,
+so that a new block at the same address is not mistaken for it. */
 
 void cmd_freeblock(cmdblock *cb)
 {
 if (cb == NULL) return;
 
+if (cb == (cmdblock *)last_se_source) last_se_source = NULL;
+if (cb == (cmdblock *)last_abese_source) last_abese_source = NULL;
+if (cb == (cmdblock *)last_gse_source) last_gse_source = NULL;
+
 #ifdef showfree
 printf("Freeing %d - ", cb);
 #endif
@@ -305,6 +311,8 @@ int cmd_joinline(BOOL eofflag)
 {
 BOOL eof = FALSE;
 
+cmd_joincount++;     /* Prevents caching the compiled line */
+
 /* Deal with command lines from buffer */
 
 if (cmd_cbufferline != NULL)
@@ -503,16 +511,98 @@ return yield;
 
 
 
+/*************************************************
+*       Remove a line from the back list         *
+*************************************************/
+
+/* A line that is on the back list has the lf_back flag set, so that for all
+other lines this returns at once. There is only ever one instance of a line on
+the list.
+
+Argument:  the line
+Returns:   nothing
+*/
+
+void cmd_forgetback(linestr *line)
+{
+usint i;
+
+if ((line->flags & lf_back) == 0) return;
+line->flags &= ~lf_back;
+
+for (i = 0; i <= main_backtop; i++)
+  {
+  if (main_backlist[i].line == line)
+    {
+    if (main_backtop == 0)
+      {
+      main_backlist[0].line = NULL;
+      }
+    else
+      {
+      memmove(main_backlist + i, main_backlist + i + 1,
+        (main_backtop - i) * sizeof(backstr));
+      if (main_backnext == main_backtop) main_backnext--;
+      main_backtop--;
+      }
+    break;
+    }
+  }
+}
+
+
+
+/*************************************************
+*          Defer updates to the back list        *
+*************************************************/
+
+/* While a global change is being applied to all matching lines, there is no
+point in updating the back list for each one. Instead, only the latest change
+is remembered, and it is entered when deferment ends.
+
+Argument:  TRUE to start deferring, FALSE to stop
+Returns:   nothing
+*/
+
+static BOOL backdefer = FALSE;
+static linestr *backdeferline = NULL;
+static int backdefercol;
+
+void cmd_deferback(BOOL defer)
+{
+if (defer)
+  {
+  backdefer = TRUE;
+  backdeferline = NULL;
+  }
+else if (backdefer)
+  {
+  backdefer = FALSE;
+  if (backdeferline != NULL) cmd_recordchanged(backdeferline, backdefercol);
+  }
+}
+
+
+
 /*************************************************
 *             Mark file changed                  *
 *************************************************/
 
 /* We remember that the file has changed, and update the backup list
-appropriately. */
+appropriately. Entries for lines near the changed line are removed first; only
+lines that have the lf_back flag set need to be looked for in the list. */
 
 void cmd_recordchanged(linestr *line, int col)
 {
 main_filechanged = TRUE;
+if (main_stats) main_statdata.changes++;
+
+if (backdefer)
+  {
+  backdeferline = line;
+  backdefercol = col;
+  return;
+  }
 
 /* If the top back setting is NULL, this is the first change, so we can just
 set it. Otherwise, if the top setting is for this line, just update it.
@@ -547,34 +637,24 @@ if (main_backlist[main_backtop].line != NULL &&
     tline = tline->prev;
     }
 
-  /* Scan the existing list and remove any appropriate lines. We scan down from
-  the top of this list - this means that when the upper entries are slid down,
-  we do not need to rescan the current entry as it is guaranteed to be OK. */
+  /* Remove any entries for lines in the region. */
 
-  for (i = (int)main_backtop; i >= 0; i--)
+  for (;;)
     {
-    linestr *sline = tline;
-    for(;;)
-      {
-      if (main_backlist[i].line == sline)
-        {
-        memmove(main_backlist + i, main_backlist + i + 1,
-          (main_backtop - i) * sizeof(backstr));
-        if (main_backtop > 0) main_backtop--;
-          else main_backlist[0].line = NULL;
-        break;
-        }
-      if (sline == bline) break;
-      sline = sline->next;
-      }
+    cmd_forgetback(tline);
+    if (tline == bline) break;
+    tline = tline->next;
     }
 
   /* Check for a full list; if it's full, discard the bottom element. Otherwise
   advance to a new slot unless we are at the NULL empty-list slot. */
 
   if (main_backtop == back_size - 1)
+    {
+    main_backlist[0].line->flags &= ~lf_back;
     memmove(main_backlist, main_backlist + 1,
       (back_size - 1) * sizeof(backstr));
+    }
   else
     if (main_backlist[main_backtop].line != NULL) main_backtop++;
   }
@@ -582,6 +662,67 @@ if (main_backlist[main_backtop].line != NULL &&
 main_backlist[main_backtop].line = line;
 main_backlist[main_backtop].col = col;
 main_backnext = main_backtop;
+line->flags |= lf_back;
+}
+
+
+
+/*************************************************
+*               Hash a name                      *
+*************************************************/
+
+/* This is used for the procedure and written file indexes.
+
+Arguments:
+  s           the name
+  caseless    TRUE if case is to be ignored
+
+Returns:      the hash value
+*/
+
+usint cmd_hash(uschar *s, BOOL caseless)
+{
+usint h = 2166136261u;
+while (*s != 0)
+  {
+  int c = *s++;
+  if (caseless) c = tolower(c);
+  h = (h ^ c) * 16777619u;
+  }
+return h;
+}
+
+
+
+/*************************************************
+*          Index and unindex a buffer            *
+*************************************************/
+
+/* Buffers are also chained from main_bufferhash by number, so that they can
+be found quickly when there are many of them. These functions must be called
+whenever a buffer is created or deleted, or its number is changed. */
+
+#define bufferhash(n)  ((usint)(n) % buffer_hashsize)
+
+void cmd_indexbuffer(bufferstr *buffer)
+{
+bufferstr **b = main_bufferhash + bufferhash(buffer->bufferno);
+buffer->hashnext = *b;
+*b = buffer;
+}
+
+void cmd_unindexbuffer(bufferstr *buffer)
+{
+bufferstr **b = main_bufferhash + bufferhash(buffer->bufferno);
+while (*b != NULL)
+  {
+  if (*b == buffer)
+    {
+    *b = buffer->hashnext;
+    return;
+    }
+  b = &((*b)->hashnext);
+  }
 }
 
 
@@ -592,11 +733,11 @@ main_backnext = main_backtop;
 
 bufferstr *cmd_findbuffer(int n)
 {
-bufferstr *yield = main_bufferchain;
+bufferstr *yield = main_bufferhash[bufferhash(n)];
 while (yield != NULL)
   {
   if (yield->bufferno == n) return yield;
-  yield = yield->next;
+  yield = yield->hashnext;
   }
 return NULL;
 }
@@ -623,10 +764,12 @@ int linecount = buffer->linecount;
 uschar *filealias = buffer->filealias;
 uschar *filename = buffer->filename;
 
-/* Ensure relevant cached values are filed back */
+/* Ensure relevant cached values are filed back, after finishing any
+background write. */
 
 if (buffer == currentbuffer)
   {
+  save_wait();
   buffer->from_fid = from_fid;
   buffer->changed = main_filechanged;
   buffer->top = main_top;
@@ -641,6 +784,24 @@ if (buffer->changed && !buffer->noprompt && main_warnings)
   if (!cmd_yesno("Continue with %s (Y/N)? ", cmdname)) return FALSE;
   }
 
+/* The undo journal may refer to any of the lines, so it goes first. The
+autosave log is no longer needed. */
+
+if (buffer == currentbuffer)
+  {
+  undo_free(main_journal);
+  main_journal = NULL;
+  recover_free(main_recovery, FALSE);
+  }
+else
+  {
+  undo_free(buffer->journal);
+  recover_free(buffer->recovery, FALSE);
+  }
+buffer->journal = NULL;
+buffer->recovery = NULL;
+follow_stop(buffer);
+
 line = buffer->top;
 while (line != NULL)
   {
@@ -665,7 +826,7 @@ while (line != NULL)
     }
 
   if (line->text != NULL) store_free(line->text);
-  store_free(line);
+  store_freelbuff(line);
   linecount--;
   line = next;
   }
@@ -677,6 +838,12 @@ store_free(buffer->backlist);
 if (ffid != NULL) fclose(ffid);
 if (tfid != NULL) fclose(tfid);
 
+if (buffer->unloaded)
+  {
+  buffer->unloaded = FALSE;
+  main_unloaded--;
+  }
+
 return TRUE;
 }
 
@@ -777,12 +944,22 @@ return TRUE;
 *              Find procedure                    *
 *************************************************/
 
-/* If found, move to top of list. The pointer is returned
+/* Procedures are kept in main_proclist, which is a vector of chains indexed
+by a hash of the name. This returns the chain for a given name. */
+
+procstr **cmd_proclist(uschar *name)
+{
+return main_proclist + cmd_hash(name, FALSE) % proc_hashsize;
+}
+
+
+/* If found, move to top of its chain. The pointer is returned
 via ap, unless it is NULL. */
 
 BOOL cmd_findproc(uschar *name, procstr **ap)
 {
-procstr *p = main_proclist;
+procstr **list = cmd_proclist(name);
+procstr *p = *list;
 procstr *pp = NULL;
 while (p != NULL)
   {
@@ -792,8 +969,8 @@ while (p != NULL)
     if (pp != NULL)
       {
       pp->next = p->next;
-      p->next = main_proclist;
-      main_proclist = p;
+      p->next = *list;
+      *list = p;
       }
     return TRUE;
     }
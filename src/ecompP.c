@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2018 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: May 2018 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains code for interfacing to the PCRE library for handling
@@ -213,6 +213,8 @@ usint wright = qs->windowright;
 BOOL backwards = (flags & qsef_L) != 0 || ((match_L || (flags & qsef_E) != 0) &&
   (flags & qsef_B) == 0);
 
+if (main_stats) main_statdata.rematches++;
+
 /* If there's no compiled expression, or if it is compiled in the wrong
 direction (which can happen if the argument of an F command is reused
 with a BF command or vice versa), or if the casing requirements are wrong,
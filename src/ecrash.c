@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2016 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: January 2016 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains code for handling an E crash. */
@@ -105,7 +105,7 @@ do
       file_writeline(line, fid);
       count++;
       store_free(line->text);
-      store_free(line);
+      store_freelbuff(line);
       if (from_fid == NULL) break;
       line = file_nextline(&from_fid, &currentbuffer->binoffset);
       }
@@ -135,6 +135,13 @@ do
   if (crash_handler_chatty) error_printf("\n");
   if (from_fid != NULL) fclose(from_fid);
   if (currentbuffer->to_fid != NULL) fclose(currentbuffer->to_fid);
+  from_fid = currentbuffer->to_fid = NULL;
+
+  /* Buffers that have not been loaded have not been changed. Selecting one
+  would read its file. */
+
+  while (nextbuffer->unloaded) nextbuffer = (nextbuffer->next == NULL)?
+    main_bufferchain : nextbuffer->next;
 
   init_selectbuffer(nextbuffer, FALSE);
   }
@@ -159,6 +166,10 @@ for SIGHUP handling. */
 
 void crash_handler(int sig)
 {
+/* Dump the event trace first, before anything else can go wrong. */
+
+(void)trace_dump(sig);
+
 if (crash_handler_chatty)
   {
   int i;
@@ -184,6 +195,12 @@ if (crash_handler_chatty)
     }
   }
 
+/* Finish any background write, and make sure that the autosave logs are
+complete, and keep them. */
+
+save_crash();
+recover_tidy(TRUE);
+
 /* If there are any modified buffers, try to dump them out. Note that if
 there is an error while writing the file, this function will be called
 again. */
@@ -205,8 +222,11 @@ if (main_initialized && AllowDump)
 
 /* That's all folks! */
 
+/* These files must not be closed again by tidy_up(), which exit() calls. */
+
 if (crash_logfile != NULL) fclose(crash_logfile);
 if (debug_file != NULL) fclose(debug_file);
+crash_logfile = debug_file = NULL;
 
 exit(sys_rc(24));
 }
@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2016 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: September 2016 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains code for making cutting, pasting, and copying
@@ -89,31 +89,18 @@ while (nextline != endline && (nextline->flags & lf_eof) == 0)
     }
   else
     {
-    usint i;
     startline->next = nnextline;
     nnextline->prev = startline;
     main_linecount--;
+    cmd_forgetback(nextline);
 
-    /* Remove line from the back list. There is only ever one instance of a
-    line on this list. */
+    /* The journal keeps the line itself; the cut buffer gets a copy. */
 
-    for (i = 0; i <= main_backtop; i++)
+    if (undo_recording)
       {
-      if (main_backlist[i].line == nnextline)
-        {
-        if (main_backtop == 0)
-          {
-          main_backlist[0].line = NULL;
-          }
-        else
-          {
-          memmove(main_backlist + i, main_backlist + i + 1,
-            (main_backtop - i) * sizeof(backstr));
-          if (main_backnext == main_backtop) main_backnext--;
-          main_backtop--;
-          }
-        break;
-        }
+      linestr *line = nextline;
+      if (undo_keeping) nextline = line_copy(line);
+      undo_delete(line, line, 1);
       }
     }
 
@@ -205,9 +192,15 @@ if (startline == endline) return;    /* it all happens on one line */
 /* The action spreads over more than one line */
 
 nextline = startline->next;
-while (nextline != endline && (nextline->flags & lf_eof) == 0)
+if (nextline != endline && (nextline->flags & lf_eof) == 0)
   {
-  nextline = line_delete(nextline, TRUE);
+  linestr *last = nextline;
+  while (last->next != endline && (last->next->flags & lf_eof) == 0)
+    {
+    last = last->next;
+    deletecount++;
+    }
+  nextline = line_deleterange(nextline, last, TRUE);
   deletecount++;
   }
 
@@ -291,6 +284,7 @@ while (pline->next != NULL)
   nline->next = main_current;
   nline->prev = line;
   nline->flags |= lf_shn;
+  if (undo_recording) undo_insert(nline, nline, 1);
   line = nline;
   pline = pline->next;
   main_linecount++;
@@ -532,7 +526,7 @@ else
       {
       linestr *next = cut_buffer->next;
       store_free(cut_buffer->text);
-      store_free(cut_buffer);
+      store_freelbuff(cut_buffer);
       cut_buffer = next;
       }
     cut_last = NULL;
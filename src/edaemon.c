@@ -0,0 +1,560 @@
+/*************************************************
+*       The E text editor - 3rd incarnation      *
+*************************************************/
+
+/* Copyright (c) University of Cambridge, 1991 - 2021 */
+
+/* Written by Philip Hazel, starting November 1991 */
+/* This file last modified: October 2026 */
+
+
+/* This file contains code for running NE as a daemon that listens on a Unix
+domain socket, and for the client that sends it requests. The daemon is
+started by
+
+  ne -daemon <socket>
+
+and does the part of NE's initialization that does not depend on the command
+line once only. A request is made by
+
+  ne -client <socket> <ne arguments>
+
+The client passes its standard input, output, and error, its current
+directory, and its arguments to the daemon, which forks a process that carries
+on as if NE had been run with those arguments, but in line-by-line mode. When
+it finishes, the daemon sends its return code to the client, which exits with
+the same code. Requests are handled concurrently, each in its own process.
+
+The socket is created with mode 0600, and a connection from any other user is
+refused, because a request can obey any NE command, including * to run a shell
+command. The daemon does not read from a connection itself; the process that
+is forked for it reads the request, so a client that connects but sends
+nothing holds up only its own process, which gives up after request_timeout
+seconds. */
+
+
+#define _GNU_SOURCE                  /* for struct ucred */
+
+#include "ehdr.h"
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+/* A request starts with a header that carries the file descriptors; the data
+that follows it is the directory and the arguments, each terminated by a
+binary zero. */
+
+typedef struct {
+  uint32_t magic;
+  uint32_t length;
+} reqheader;
+
+#define request_magic   0x4e450001u
+#define request_maxdata (1024*1024)
+#define request_timeout 30
+
+/* The return code for a request that fails before NE gets going; it is the
+same as NE's own code for a failed run. */
+
+#define failed_rc       12
+
+typedef struct {
+  pid_t pid;
+  int   fd;
+} daemonjob;
+
+static daemonjob *jobs = NULL;
+static int jobcount = 0;
+static int jobsize = 0;
+
+
+
+/*************************************************
+*        Handler for finished children           *
+*************************************************/
+
+/* The handler does nothing; the signal just interrupts the wait for a
+connection, so that the child's return code can be sent. */
+
+static void
+sigchld_handler(int sig)
+{
+(void)sig;
+}
+
+
+
+/*************************************************
+*           Set up a socket address              *
+*************************************************/
+
+static BOOL
+daemon_address(uschar *path, struct sockaddr_un *addr)
+{
+if (Ustrlen(path) >= sizeof(addr->sun_path)) return FALSE;
+memset(addr, 0, sizeof(struct sockaddr_un));
+addr->sun_family = AF_UNIX;
+Ustrcpy(addr->sun_path, path);
+return TRUE;
+}
+
+
+
+/*************************************************
+*        Check that a client is the owner        *
+*************************************************/
+
+static BOOL
+daemon_peerok(int fd)
+{
+#ifdef SO_PEERCRED
+struct ucred cred;
+socklen_t len = sizeof(cred);
+return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+  cred.uid == getuid();
+#else
+uid_t uid;
+gid_t gid;
+return getpeereid(fd, &uid, &gid) == 0 && uid == getuid();
+#endif
+}
+
+
+
+/*************************************************
+*        Read or write a given amount of data    *
+*************************************************/
+
+static BOOL
+daemon_read(int fd, void *buffer, size_t len)
+{
+uschar *p = buffer;
+while (len > 0)
+  {
+  ssize_t n = read(fd, p, len);
+  if (n < 0 && errno == EINTR) continue;
+  if (n <= 0) return FALSE;
+  p += n;
+  len -= n;
+  }
+return TRUE;
+}
+
+static BOOL
+daemon_write(int fd, void *buffer, size_t len)
+{
+uschar *p = buffer;
+while (len > 0)
+  {
+  ssize_t n = write(fd, p, len);
+  if (n < 0 && errno == EINTR) continue;
+  if (n <= 0) return FALSE;
+  p += n;
+  len -= n;
+  }
+return TRUE;
+}
+
+
+
+/*************************************************
+*               Run the client                   *
+*************************************************/
+
+/* This is called at the start of main(), before any initialization, so it
+uses only system functions.
+
+Arguments:
+  path         the socket name
+  argc         the number of arguments to pass
+  argv         the arguments
+
+Returns:       the return code from the request
+*/
+
+int
+daemon_client(uschar *path, int argc, char **argv)
+{
+struct sockaddr_un addr;
+reqheader header;
+struct msghdr msg;
+struct iovec iov;
+struct cmsghdr *cmsg;
+union {
+  char buffer[CMSG_SPACE(3 * sizeof(int))];
+  struct cmsghdr align;
+} control;
+uschar cwd[FNAME_BUFFER_SIZE];
+uschar *data, *p;
+size_t len;
+int32_t rc;
+int fd, i;
+
+if (getcwd(CS cwd, sizeof(cwd)) == NULL)
+  {
+  fprintf(stderr, "** NE client: cannot find current directory: %s\n",
+    strerror(errno));
+  return failed_rc;
+  }
+
+len = Ustrlen(cwd) + 1;
+for (i = 0; i < argc; i++) len += strlen(argv[i]) + 1;
+if (len > request_maxdata)
+  {
+  fprintf(stderr, "** NE client: arguments are too long\n");
+  return failed_rc;
+  }
+
+p = data = malloc(len);
+if (data == NULL)
+  {
+  fprintf(stderr, "** NE client: out of memory\n");
+  return failed_rc;
+  }
+Ustrcpy(p, cwd);
+p += Ustrlen(p) + 1;
+for (i = 0; i < argc; i++)
+  {
+  Ustrcpy(p, argv[i]);
+  p += Ustrlen(p) + 1;
+  }
+
+if (!daemon_address(path, &addr) ||
+    (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+    connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+  fprintf(stderr, "** NE client: cannot connect to %s: %s\n", path,
+    strerror(errno));
+  return failed_rc;
+  }
+
+/* Send the header with the file descriptors, then the data. A daemon that
+refuses the request closes the connection, which must not kill the client. */
+
+signal(SIGPIPE, SIG_IGN);
+
+header.magic = request_magic;
+header.length = (uint32_t)len;
+iov.iov_base = &header;
+iov.iov_len = sizeof(header);
+memset(&msg, 0, sizeof(msg));
+msg.msg_iov = &iov;
+msg.msg_iovlen = 1;
+msg.msg_control = control.buffer;
+msg.msg_controllen = sizeof(control.buffer);
+cmsg = CMSG_FIRSTHDR(&msg);
+cmsg->cmsg_level = SOL_SOCKET;
+cmsg->cmsg_type = SCM_RIGHTS;
+cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+for (i = 0; i < 3; i++) ((int *)CMSG_DATA(cmsg))[i] = i;
+
+if (sendmsg(fd, &msg, 0) != (ssize_t)sizeof(header) ||
+    !daemon_write(fd, data, len))
+  {
+  fprintf(stderr, "** NE client: cannot send request to %s: %s\n", path,
+    strerror(errno));
+  return failed_rc;
+  }
+free(data);
+
+/* Wait for the return code. */
+
+if (!daemon_read(fd, &rc, sizeof(rc)))
+  {
+  fprintf(stderr, "** NE client: no reply from %s\n", path);
+  return failed_rc;
+  }
+close(fd);
+return (int)rc;
+}
+
+
+
+/*************************************************
+*      Send return codes for finished requests   *
+*************************************************/
+
+static void
+daemon_reap(void)
+{
+int status;
+pid_t pid;
+
+while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+  {
+  int i;
+  for (i = 0; i < jobcount; i++)
+    {
+    int32_t rc;
+    if (jobs[i].pid != pid) continue;
+    rc = WIFEXITED(status)? WEXITSTATUS(status) :
+      WIFSIGNALED(status)? 128 + WTERMSIG(status) : failed_rc;
+    (void)daemon_write(jobs[i].fd, &rc, sizeof(rc));
+    close(jobs[i].fd);
+    jobs[i] = jobs[--jobcount];
+    break;
+    }
+  }
+}
+
+
+
+/*************************************************
+*           Receive a request                    *
+*************************************************/
+
+/*
+Arguments:
+  fd           the connection
+  fds          where to put the client's standard input, output, and error
+  lenptr       where to put the length of the data
+
+Returns:       the data, or NULL if the request is bad
+*/
+
+static uschar *
+daemon_receive(int fd, int *fds, size_t *lenptr)
+{
+reqheader header;
+struct msghdr msg;
+struct iovec iov;
+struct cmsghdr *cmsg;
+union {
+  char buffer[CMSG_SPACE(3 * sizeof(int))];
+  struct cmsghdr align;
+} control;
+uschar *data;
+ssize_t n;
+
+iov.iov_base = &header;
+iov.iov_len = sizeof(header);
+memset(&msg, 0, sizeof(msg));
+msg.msg_iov = &iov;
+msg.msg_iovlen = 1;
+msg.msg_control = control.buffer;
+msg.msg_controllen = sizeof(control.buffer);
+
+do n = recvmsg(fd, &msg, 0); while (n < 0 && errno == EINTR);
+if (n != (ssize_t)sizeof(header)) return NULL;
+
+cmsg = CMSG_FIRSTHDR(&msg);
+if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+    cmsg->cmsg_type != SCM_RIGHTS ||
+    cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+  return NULL;
+memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+
+if (header.magic != request_magic || header.length == 0 ||
+    header.length > request_maxdata)
+  {
+  close(fds[0]);
+  close(fds[1]);
+  close(fds[2]);
+  return NULL;
+  }
+
+data = store_Xget(header.length + 1);
+if (!daemon_read(fd, data, header.length))
+  {
+  store_free(data);
+  close(fds[0]);
+  close(fds[1]);
+  close(fds[2]);
+  return NULL;
+  }
+data[header.length] = 0;
+*lenptr = header.length;
+return data;
+}
+
+
+
+/*************************************************
+*       Set up a child to handle a request       *
+*************************************************/
+
+/* The client's files become the standard ones, its directory becomes the
+current one, and an argument vector is built from its arguments.
+
+Arguments:
+  data         the request data
+  len          its length
+  fds          the client's files
+  argcptr      where to put the argument count
+  argvptr      where to put the argument vector; argv[0] is unchanged
+
+Returns:       nothing
+*/
+
+static void
+daemon_child(uschar *data, size_t len, int *fds, int *argcptr,
+  char ***argvptr)
+{
+uschar *p = data + Ustrlen(data) + 1;
+uschar *pe = data + len;
+char **argv;
+int argc = 1;
+int i;
+
+for (i = 0; i < 3; i++)
+  {
+  if (dup2(fds[i], i) < 0) exit(failed_rc);
+  if (fds[i] > 2) close(fds[i]);
+  }
+
+if (chdir(CS data) != 0)
+  {
+  fprintf(stderr, "** NE daemon: cannot change directory to %s: %s\n", data,
+    strerror(errno));
+  exit(failed_rc);
+  }
+
+argv = store_Xget((len + 2) * sizeof(char *));
+argv[0] = (*argvptr)[0];
+while (p < pe)
+  {
+  argv[argc++] = CS p;
+  p += Ustrlen(p) + 1;
+  }
+argv[argc] = NULL;
+
+*argcptr = argc;
+*argvptr = argv;
+}
+
+
+
+/*************************************************
+*               Run the daemon                   *
+*************************************************/
+
+/* This is called from main() after the initialization that does not depend
+on the command line. It returns only in a child process that is to handle a
+request, with the request's arguments in place of its own.
+
+Arguments:
+  path         the socket name
+  argcptr      pointer to main()'s argc
+  argvptr      pointer to main()'s argv
+
+Returns:       nothing
+*/
+
+void
+daemon_run(uschar *path, int *argcptr, char ***argvptr)
+{
+struct sockaddr_un addr;
+struct sigaction act;
+struct stat statbuf;
+sigset_t blocked, unblocked;
+mode_t oldmask;
+int lfd;
+
+if (!daemon_address(path, &addr))
+  error_moan(76, path, "name too long");    /* Hard */
+
+/* A socket left by an earlier daemon is removed, but nothing else is. */
+
+if (lstat(CS path, &statbuf) == 0)
+  {
+  if (!S_ISSOCK(statbuf.st_mode))
+    error_moan(76, path, "it exists and is not a socket");    /* Hard */
+  (void)unlink(CS path);
+  }
+
+oldmask = umask(077);
+if ((lfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+    bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+    listen(lfd, 64) < 0)
+  error_moan(76, path, strerror(errno));    /* Hard */
+(void)umask(oldmask);
+
+/* SIGCHLD is blocked except while waiting for a connection, so that a child
+that finishes at any other time is not missed. */
+
+memset(&act, 0, sizeof(act));
+act.sa_handler = sigchld_handler;
+sigemptyset(&act.sa_mask);
+(void)sigaction(SIGCHLD, &act, NULL);
+signal(SIGPIPE, SIG_IGN);
+
+sigemptyset(&blocked);
+sigaddset(&blocked, SIGCHLD);
+sigprocmask(SIG_BLOCK, &blocked, &unblocked);
+sigdelset(&unblocked, SIGCHLD);
+
+for (;;)
+  {
+  pid_t pid;
+  int fd;
+  fd_set fdset;
+
+  daemon_reap();
+  FD_ZERO(&fdset);
+  FD_SET(lfd, &fdset);
+  if (pselect(lfd + 1, &fdset, NULL, NULL, NULL, &unblocked) < 0)
+    {
+    if (errno == EINTR) continue;
+    error_moan(76, path, strerror(errno));    /* Hard */
+    }
+
+  if ((fd = accept(lfd, NULL, NULL)) < 0)
+    {
+    if (errno == EINTR || errno == ECONNABORTED) continue;
+    error_moan(76, path, strerror(errno));    /* Hard */
+    }
+
+  if (!daemon_peerok(fd))
+    {
+    close(fd);
+    continue;
+    }
+
+  /* The request is read by the child, so that a slow or idle client cannot
+  hold up other requests. The connection is kept open here, so that the return
+  code can be sent when the child finishes. */
+
+  if ((pid = fork()) == 0)
+    {
+    int fds[3];
+    size_t len;
+    uschar *data;
+
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    sigprocmask(SIG_UNBLOCK, &blocked, NULL);
+    close(lfd);
+    alarm(request_timeout);
+    if ((data = daemon_receive(fd, fds, &len)) == NULL) exit(failed_rc);
+    alarm(0);
+    close(fd);
+    daemon_child(data, len, fds, argcptr, argvptr);
+    return;
+    }
+
+  if (pid < 0)
+    {
+    int32_t rc = failed_rc;
+    (void)daemon_write(fd, &rc, sizeof(rc));
+    close(fd);
+    continue;
+    }
+
+  if (jobcount >= jobsize)
+    {
+    daemonjob *newjobs;
+    jobsize = (jobsize == 0)? 64 : 2 * jobsize;
+    newjobs = store_Xget(jobsize * sizeof(daemonjob));
+    if (jobcount > 0) memcpy(newjobs, jobs, jobcount * sizeof(daemonjob));
+    if (jobs != NULL) store_free(jobs);
+    jobs = newjobs;
+    }
+  jobs[jobcount].pid = pid;
+  jobs[jobcount].fd = fd;
+  jobcount++;
+  }
+}
+
+/* End of edaemon.c */
@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2016 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: January 2016 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains code for displaying a screenful of lines */
@@ -15,8 +15,6 @@
 #include "shdr.h"
 #include "scomhdr.h"
 
-/* #define logging          Set to cause logging info to file */
-
 
 
 
@@ -462,12 +460,8 @@ if (!screen_forcecls && screen_use_scroll)
           usint topscroll = (row < p)? row : p;
           usint botscroll = wptr - 1;
 
-#ifdef logging
-          debug_writelog("Scroll: row=%d w=%d wptr=%d count=%d\n",
-            row,w,wptr,count);
-#endif
-
           if (row+count-1 > botscroll) botscroll = row+count-1;
+          TRACE(tr_scroll, topscroll, (int64_t)(int)scrollamount);
           s_vscroll(botscroll, topscroll, scrollamount);
           if (scrollamount > 0)
             {
@@ -510,16 +504,12 @@ while (row <= window_depth)
 
   if (line != window_vector[row] || (line != NULL && (line->flags & lf_shn) != 0))
     {
-#ifdef logging
-    debug_writelog("displaying line %d\n", row);
-#endif
+    TRACE(tr_displayline, row, 0);
     scrn_displayline(line, row, cursor_offset);
     }
   else if (line != NULL && (line->flags & lf_clend) != 0)
     {
-#ifdef logging
-    debug_writelog("clearendline %d\n", row);
-#endif
+    TRACE(tr_clearline, row, 0);
     clearendline(line, row);
     }
   else if (line != NULL && (line->flags & lf_shm) != 0)
@@ -555,9 +545,7 @@ void scrn_display(void)
 int above = -1;
 usint newoffset = 0;
 
-#ifdef logging
-debug_writelog(">>>>Start of scrn_display()\n");
-#endif
+TRACE(tr_display, 0, 0);
 
 /* Set up the offset so that the current position is visible. There's a fudge
 variable that can be set to cause scrolling when the cursor is near the right-
@@ -663,10 +651,8 @@ screen_autoabove = TRUE;
 makescreen(above);          /* Adjusts cursor_row */
 s_move(cursor_col - cursor_offset, cursor_row);
 screen_forcecls = FALSE;
-
-#ifdef logging
-debug_writelog("End of scrn_display()\n");
-#endif
+if (main_latency) latency_mark(lat_displayed);
+TRACE(tr_displayend, 0, 0);
 }
 
 /* End of edisplay.c */
@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2021 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: May 2021 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains code for obeying commands: Part I */
@@ -66,13 +66,29 @@ main_current->flags |= lf_shn;
 return done_continue;
 }
 
+/* Record the bytes of the current line, starting at p, that are about to be
+changed by casing count characters. Nothing is changed if the cursor is at or
+past the end of the line. */
+
+static void record_casing(uschar *p, uschar *pe, usint count)
+{
+uschar *q = p;
+usint i;
+if (p >= pe) return;
+for (i = 0; i < count && q < pe; i++) SKIPCHAR(q, pe);
+undo_text(main_current, p - main_current->text, q - p, q - p);
+}
+
 /* Upper/lower casing works only for ASCII characters */
 
 static int e_dolcent(cmdstr *cmd, int (*func)(int), uschar *name)
 {
 usint i;
-uschar *p = main_current->text + line_offset(main_current, cursor_col);
-uschar *pe = main_current->text + main_current->len;
+uschar *p, *pe;
+
+main_current->text = store_unshare(main_current->text);
+p = main_current->text + line_offset(main_current, cursor_col);
+pe = main_current->text + main_current->len;
 
 if ((main_current->flags & lf_eof) != 0)
   {
@@ -81,6 +97,8 @@ if ((main_current->flags & lf_eof) != 0)
   return done_error;
   }
 
+if (undo_recording) record_casing(p, pe, cmd->count);
+
 for (i = 0; i < cmd->count; i++)
   {
   if (p < pe)
@@ -91,6 +109,8 @@ for (i = 0; i < cmd->count; i++)
   cursor_col++;
   }
 
+if (undo_recording) undo_textdone(main_current);
+
 main_current->flags |= lf_shn;
 cmd_recordchanged(main_current, cursor_col);
 return done_continue;
@@ -111,8 +131,11 @@ return e_dolcent(cmd, toupper, US"%");
 int e_tilde(cmdstr *cmd)
 {
 usint i;
-uschar *p = main_current->text + line_offset(main_current, cursor_col);
-uschar *pe = main_current->text + main_current->len;
+uschar *p, *pe;
+
+main_current->text = store_unshare(main_current->text);
+p = main_current->text + line_offset(main_current, cursor_col);
+pe = main_current->text + main_current->len;
 
 if ((main_current->flags & lf_eof) != 0)
   {
@@ -121,6 +144,8 @@ if ((main_current->flags & lf_eof) != 0)
   return done_error;
   }
 
+if (undo_recording) record_casing(p, pe, cmd->count);
+
 for (i = 0; i < cmd->count; i++)
   {
   if (p < pe)
@@ -131,6 +156,8 @@ for (i = 0; i < cmd->count; i++)
   cursor_col++;
   }
 
+if (undo_recording) undo_textdone(main_current);
+
 main_current->flags |= lf_shn;
 cmd_recordchanged(main_current, cursor_col);
 return done_continue;
@@ -203,15 +230,10 @@ if ((line->flags & lf_eof) != 0)
 
 if (misc == lb_delete)
   {
-  for (;;)
-    {
-    if ((line->flags & lf_eof) != 0) break; else
-      {
-      int done = (line == endline);
-      line = line_delete(line, TRUE);
-      if (done) break;
-      }
-    }
+  linestr *last = line;
+  while (last != endline && (last->next->flags & lf_eof) == 0)
+    last = last->next;
+  line = line_deleterange(line, last, TRUE);
   cmd_refresh = TRUE;
   }
 
@@ -318,10 +340,14 @@ if ((main_current->flags & lf_eof))
 
 if ((cmd->flags & cmdf_arg1) != 0)
   {
-  if (last_abese != NULL) cmd_freeblock((cmdblock *)last_abese);
-  if (last_abent != NULL) cmd_freeblock((cmdblock *)last_abent);
-  last_abese = cmd_copyblock((cmdblock *)se);
-  last_abent = cmd_copyblock((cmdblock *)nt);
+  if (se != last_abese_source || last_abese == NULL)
+    {
+    if (last_abese != NULL) cmd_freeblock((cmdblock *)last_abese);
+    if (last_abent != NULL) cmd_freeblock((cmdblock *)last_abent);
+    last_abese = cmd_copyblock((cmdblock *)se);
+    last_abent = cmd_copyblock((cmdblock *)nt);
+    last_abese_source = se;
+    }
   }
 else if (last_abese == NULL)
   {
@@ -719,6 +745,7 @@ cmdin_fid = NULL;
 buffer->commanding++;
 cmd_onecommand = main_interactive = FALSE;
 cmd_clineno = 0;
+if (buffer->unloaded) (void)init_readbuffer(buffer, SIZE_MAX);
 line = buffer->top;
 
 while (yield == done_continue)
@@ -826,15 +853,7 @@ int e_cl(cmdstr *cmd)
 qsstr *qs = cmd->arg1.qs;
 uschar *s = US"";
 int slen = 0;
-usint len;
-
-if ((main_current->flags & lf_eof) != 0 ||
-    (main_current->next->flags & lf_eof) != 0)
-  {
-  if (cmd_eoftrap) return done_eof;
-  error_moan(30, "End of file", "cl");
-  return done_error;
-  }
+usint n, chars, schars;
 
 /* Set up a glue string if (optionally) provided by the command. */
 
@@ -852,26 +871,54 @@ if ((cmd->flags & cmdf_arg1) != 0)
     }
   }
 
-/* Inserting zero bytes at the cursor column, when it is past the actual
-length of the line, causes the line to be filled up with spaces. */
+/* This command obeys its own repeat count, so that the length of the growing
+line in characters can be kept as lines are joined on, instead of counting it
+each time. */
 
-len = main_current->len;
-if (line_offset(main_current, cursor_col) > len)
+schars = line_charcount(s, slen);
+chars = line_charcount(main_current->text, main_current->len);
+
+for (n = 0; n < cmd->count; n++)
   {
-  line_insertbytes(main_current, cursor_col, -1, NULL, 0, 0);
+  usint len, nextchars;
+
+  if (n > 0 && main_interrupted((cmd_loopdepth > 0)? ci_loop : ci_cmd))
+    return done_error;
+
+  if ((main_current->flags & lf_eof) != 0 ||
+      (main_current->next->flags & lf_eof) != 0)
+    {
+    if (cmd_eoftrap) return done_eof;
+    error_moan(30, "End of file", "cl");
+    return done_error;
+    }
+
+  /* Inserting zero bytes at the cursor column, when it is past the actual
+  length of the line, causes the line to be filled up with spaces. */
+
+  if ((usint)cursor_col > chars)
+    {
+    line_insertbytes(main_current, cursor_col, -1, NULL, 0, 0);
+    chars = cursor_col;
+    }
   len = main_current->len;
-  }
 
-/* Join the lines, inserting slen spaces between them; that is room into which
-we can copy the joining string. Then set the cursor column to the end of the
-first line plus the joining string */
+  /* Join the lines, inserting slen spaces between them; that is room into
+  which we can copy the joining string. Then set the cursor column to the end
+  of the first line plus the joining string */
 
-main_current = line_concat(main_current->next, slen);
-memcpy(main_current->text + len, s, slen);
-cursor_col = line_charcount(main_current->text, len + slen);
+  nextchars = line_charcount(main_current->next->text, main_current->next->len);
+  main_current = line_join(main_current->next, slen, chars);
+  if (undo_recording) undo_text(main_current, len, slen, slen);
+  memcpy(main_current->text + len, s, slen);
+  if (undo_recording) undo_textdone(main_current);
+  cursor_col = chars + schars;
+  chars += schars + nextchars;
+
+  main_current->flags |= lf_shn;
+  cmd_refresh = TRUE;
+  }
 
-main_current->flags |= lf_shn;
-cmd_refresh = TRUE;
 return done_continue;
 }
 
@@ -903,9 +950,9 @@ if (cmd_findproc(cmd->arg1.string->text, &p))
     error_moan(47, cmd->arg1.string->text);
     return done_error;
     }
-  else  /* A found procedure is always moved to the top of the list */
+  else  /* A found procedure is always moved to the top of its chain */
     {
-    main_proclist = p->next;
+    *cmd_proclist(p->name) = p->next;
     cmd_freeblock((cmdblock *)p);
     return done_continue;
     }
@@ -1065,10 +1112,12 @@ if (!cmd_emptybuffer(buffer, US"DBUFFER")) return done_error;
 /* If buffer is the only buffer, set it up as empty; otherwise,
 select another buffer if it is current, and then wipe it out. */
 
+cmd_unindexbuffer(buffer);
 if (buffer == main_bufferchain && buffer->next == NULL)
   {
   init_buffer(buffer, 0, store_copystring(US""), store_copystring(US""), NULL,
-    default_rmargin);
+    default_rmargin, FALSE);
+  cmd_indexbuffer(buffer);
   currentbuffer = NULL;
   init_selectbuffer(buffer, FALSE);
   }
@@ -1098,7 +1147,7 @@ while (cut_buffer != NULL)
   {
   linestr *next = cut_buffer->next;
   store_free(cut_buffer->text);
-  store_free(cut_buffer);
+  store_freelbuff(cut_buffer);
   cut_buffer = next;
   }
 cut_last = NULL;
@@ -1156,6 +1205,7 @@ if (cmd->misc == detrail_buffer)
     while (t > s && t[-1] == ' ') t--;
     if (t - s < line->len)
       {
+      if (undo_recording) undo_text(line, t - s, line->len - (t - s), 0);
       line->len = t - s;
       main_filechanged = TRUE;
       }
@@ -1177,7 +1227,8 @@ int e_df(cmdstr *cmd)
 linestr *start = main_current;
 int yield = e_f(cmd);
 if (yield != done_continue) return yield;
-while (start != main_current) start = line_delete(start, TRUE);
+if (start != main_current)
+  (void)line_deleterange(start, main_current->prev, TRUE);
 cmd_recordchanged(main_current, cursor_col);
 cmd_refresh = TRUE;
 return done_continue;
@@ -1194,6 +1245,11 @@ int e_drest(cmdstr *cmd)
 (void)cmd;
 if ((main_bottom->flags & lf_eof) == 0)
   {
+  if (undo_recording)
+    {
+    undo_text(main_bottom, 0, main_bottom->len, 0);
+    undo_attr(main_bottom);
+    }
   store_free(main_bottom->text);
   main_bottom->text = NULL;
   main_bottom->len = 0;
@@ -1203,8 +1259,8 @@ main_bottom->flags |= lf_shn;
 
 scrn_hint(sh_topline, 0, NULL);
 
-while ((main_current->flags & lf_eof) == 0)
-  main_current = line_delete(main_current, FALSE);
+if ((main_current->flags & lf_eof) == 0)
+  main_current = line_deleterange(main_current, main_bottom->prev, FALSE);
 
 if (from_fid != NULL)
   {
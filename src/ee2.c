@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2021 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: May 2021 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains code for obeying commands: Part II */
@@ -16,6 +16,85 @@
 #include "shdr.h"
 
 
+/* Times for showing the progress of a long search */
+
+static uint64_t search_started;
+static uint64_t search_shown;
+
+
+
+/*************************************************
+*       Show the progress of a long search       *
+*************************************************/
+
+/* This is called by the F, BF, and global commands every 64K lines when they
+are searching in screen mode. Once a search has taken more than a fifth of a
+second, the number of lines searched so far is shown in the message window, and
+is updated five times a second.
+
+Argument:   the number of lines searched
+Returns:    nothing
+*/
+
+static void search_progress(usint count)
+{
+int w, x, y;
+uint64_t now = sys_usecs();
+
+if (count == 0x10000) search_started = now;
+if (now - search_started < 200000 || now - search_shown < 200000) return;
+search_shown = now;
+
+w = s_window();
+x = s_x();
+y = s_y();
+s_selwindow(message_window, 0, 0);
+s_cls();
+s_printf("Searching: %u of %u lines (press any key to cancel)", count,
+  main_linecount);
+s_selwindow(w, x, y);
+s_flush();
+}
+
+
+
+/*************************************************
+*            Tidy up after a search              *
+*************************************************/
+
+/* Any progress message is removed. In screen mode, any keystroke cancels a
+search (see sys_checkinterrupt()), leaving the cursor where it was. This is not
+treated as an error, because the keystroke is then obeyed in the normal way; a
+message is left in the message window instead.
+
+Arguments:   none
+Returns:     nothing
+*/
+
+static void search_end(void)
+{
+int w, x, y;
+
+if (search_shown == 0 && !main_keypressed) return;
+search_shown = 0;
+
+w = s_window();
+x = s_x();
+y = s_y();
+s_selwindow(message_window, 0, 0);
+s_cls();
+if (main_keypressed)
+  {
+  s_printf("Search cancelled");
+  main_leave_message = TRUE;
+  main_keypressed = FALSE;
+  }
+s_selwindow(w, x, y);
+s_flush();
+}
+
+
+
 /*************************************************
 *          The F & BF commands                   *
 *************************************************/
@@ -27,17 +106,23 @@ sestr *se = cmd->arg1.se;
 BOOL stringsearch;
 int matched = MATCH_FAILED;
 usint cursor_byte = line_offset(line, cursor_col);
+usint count = 0;
 int USW = 0;
 
 match_L = leftflag;                   /* Global indicating lefwards matching */
 if (!cmd_casematch) USW |= qsef_U;
 
-/* Deal with saving and repeated search */
+/* Deal with saving and repeated search. When the same command is obeyed
+repeatedly (typically in a loop) the copy made last time is still valid. */
 
 if ((cmd->flags & cmdf_arg1) != 0)
   {
-  if (last_se != NULL) cmd_freeblock((cmdblock *)last_se);
-  last_se = cmd_copyblock((cmdblock *)se);
+  if (se != last_se_source || last_se == NULL)
+    {
+    if (last_se != NULL) cmd_freeblock((cmdblock *)last_se);
+    last_se = cmd_copyblock((cmdblock *)se);
+    last_se_source = se;
+    }
   }
 else if (last_se == NULL)
   {
@@ -79,13 +164,19 @@ if ((line->flags & lf_eof) == 0 || match_L)
   match_leftpos = 0;
   while (matched == MATCH_FAILED)
     {
-    if (main_interrupted(ci_move)) return done_error;
+    if (main_interrupted(ci_search))
+      {
+      search_end();
+      return done_error;
+      }
+    if ((++count & 0xffff) == 0 && main_screenOK) search_progress(count);
     line = match_L? line->prev : line->next;
     if (line == NULL) break;
     if ((line->flags & lf_eof) != 0)break;
     match_rightpos = line->len;
     matched = cmd_matchse(se, line, USW);
     }
+  search_end();
   }
 
 /* NOT matched => reached end (start) of file */
@@ -123,6 +214,23 @@ return done_continue;
 
 
 
+/*************************************************
+*            The FOLLOW command                  *
+*************************************************/
+
+/* FOLLOW starts following the buffer's file, or brings the buffer up to date
+if it is already being followed; see efollow.c. */
+
+int e_follow(cmdstr *cmd)
+{
+if ((cmd->flags & cmdf_arg1) == 0 || cmd->arg1.value)
+  return follow_start()? done_continue : done_error;
+follow_stop(currentbuffer);
+return done_continue;
+}
+
+
+
 /*************************************************
 *            The FORMAT command                  *
 *************************************************/
@@ -189,6 +297,7 @@ int matchcount = 0;
 int changecount = 0;
 int rcount = 0;
 int matched = MATCH_FAILED;
+usint scancount = 0;
 usint oldrmargin = main_rmargin;
 usint oldcursor = cursor_col;
 uschar *wordptr = US"";
@@ -210,10 +319,14 @@ qsstr *nt = cmd->arg2.qs;
 
 if ((cmd->flags & cmdf_arg1) != 0)
   {
-  if (last_gse != NULL) cmd_freeblock((cmdblock *)last_gse);
-  if (last_gnt != NULL) cmd_freeblock((cmdblock *)last_gnt);
-  last_gse = cmd_copyblock((cmdblock *)se);
-  last_gnt = cmd_copyblock((cmdblock *)nt);
+  if (se != last_gse_source || last_gse == NULL)
+    {
+    if (last_gse != NULL) cmd_freeblock((cmdblock *)last_gse);
+    if (last_gnt != NULL) cmd_freeblock((cmdblock *)last_gnt);
+    last_gse = cmd_copyblock((cmdblock *)se);
+    last_gnt = cmd_copyblock((cmdblock *)nt);
+    last_gse_source = se;
+    }
   }
 else if (last_gse == NULL)
   {
@@ -255,6 +368,11 @@ match_L = FALSE;
 if (!cmd_casematch) USW |= qsef_U;
 if (main_rmargin < MAX_RMARGIN) main_rmargin += MAX_RMARGIN;
 
+/* When changing all matches, updating the back list is deferred until the
+end. */
+
+if (all) cmd_deferback(TRUE);
+
 /* Main loop starts here */
 
 while (Gcontinue)
@@ -285,12 +403,14 @@ while (Gcontinue)
   match_leftpos = 0;
   if ((line->flags & lf_eof) == 0) while (matched == MATCH_FAILED)
     {
-    if (main_interrupted(ci_move))
+    if (main_interrupted(ci_search))
       {
       yield = done_error;
       quit = interrupted = TRUE;
       break;
       }
+    if ((++scancount & 0xffff) == 0 && main_screenOK)
+      search_progress(scancount);
     if (line == limitline) break;
     line = line->next;
     if (line == NULL || (line->flags & lf_eof) != 0) break;
@@ -299,6 +419,8 @@ while (Gcontinue)
     if (line == limitline) match_rightpos = line_offset(line, mark_col_global);
     matched = cmd_matchse(se, line, USW);
     }
+  search_end();
+  scancount = 0;
 
   /* Take action according as matched or not */
 
@@ -406,7 +528,11 @@ while (Gcontinue)
       else if (lastr == 'o') { change = TRUE; Gcontinue = FALSE; }
       else if (lastr == 'l')
         { change = TRUE; Gcontinue = FALSE; quit = TRUE; }
-      else if (lastr == 'a') { change = TRUE; all = TRUE; }
+      else if (lastr == 'a')
+        {
+        change = all = TRUE;
+        cmd_deferback(TRUE);
+        }
       else if (lastr == 'f') Gcontinue = FALSE;
       else if (lastr == 'q') { Gcontinue = FALSE; quit = TRUE; }
       else if (lastr == 'e') { Gcontinue = FALSE; yield = done_error; }
@@ -491,7 +617,8 @@ while (Gcontinue)
   else
     {
     Gcontinue = FALSE;
-    if (main_interactive && cmdin_fid == NULL && matchcount <= 0)
+    if (main_interactive && cmdin_fid == NULL && matchcount <= 0 &&
+        !interrupted)
       {
       if (matched == MATCH_FAILED) error_moanqse(17, se);  /* not found */
       yield = done_error;
@@ -532,6 +659,7 @@ if (!interrupted && main_interactive && matchcount > 0)
 
 /* Restore rmargin and original position unless "quit" */
 
+if (all) cmd_deferback(FALSE);
 main_rmargin = oldrmargin;
 if (!quit)
   {
@@ -621,6 +749,7 @@ if ((botline->flags & lf_eof) == 0)
     else prev->next = topline;
   main_current->prev = line;
   main_linecount += count;
+  if (undo_recording) undo_insert(topline, line, count);
   
   cmd_recordchanged(main_current, cursor_col);
   cmd_recordchanged(topline, 0);
@@ -629,7 +758,7 @@ if ((botline->flags & lf_eof) == 0)
   }
 
 store_free(botline->text);
-store_free(botline);
+store_freelbuff(botline);
 return done_continue;
 }
 
@@ -695,7 +824,7 @@ for (;;)
     (line->len == 1 && tolower(line->text[0]) == 'z'))
       {
       store_free(line->text);
-      store_free(line);
+      store_freelbuff(line);
       break;
       }
 
@@ -704,6 +833,7 @@ for (;;)
   line->next = main_current;
   line->prev = prev;
   main_current->prev = prev = line;
+  if (undo_recording) undo_insert(line, line, 1);
   count++;
   }
 
@@ -751,6 +881,7 @@ newline->prev = prev;
 newline->next = main_current;
 main_current->prev = newline;
 main_linecount++;
+if (undo_recording) undo_insert(newline, newline, 1);
 cmd_recordchanged(main_current, cursor_col);
 if (main_screenOK) scrn_hint(sh_insert, 1, NULL);
 cmd_refresh = TRUE;
@@ -840,6 +971,7 @@ line->next = main_current;
 line->prev = prev;
 main_current->prev = line;
 if (prev == NULL) main_top = line; else prev->next = line;
+if (undo_recording) undo_insert(line, line, 1);
 
 main_linecount++;
 cmd_recordchanged(main_current, cursor_col);
@@ -916,14 +1048,23 @@ return key_set(cmd->arg1.string->text, TRUE)? done_continue : done_error;
 
 static int lettercase(int (*func)(int))
 {
-uschar *p = main_current->text + line_offset(main_current, cursor_col);
-uschar *pe = main_current->text + main_current->len;
-while (p < pe)
+uschar *p, *pe;
+
+main_current->text = store_unshare(main_current->text);
+p = main_current->text + line_offset(main_current, cursor_col);
+pe = main_current->text + main_current->len;
+if (p < pe)
   {
-  if (*p < 128) *p = func(*p);
-  SKIPCHAR(p, pe);
-  cursor_col++; 
-  } 
+  if (undo_recording)
+    undo_text(main_current, p - main_current->text, pe - p, pe - p);
+  while (p < pe)
+    {
+    if (*p < 128) *p = func(*p);
+    SKIPCHAR(p, pe);
+    cursor_col++; 
+    } 
+  if (undo_recording) undo_textdone(main_current);
+  }
 main_current->flags |= lf_shn;
 main_filechanged = TRUE;
 return done_continue;
@@ -958,17 +1099,20 @@ if ((fid = sys_fopen(s, US"r")) == NULL)
   s = US"";
   }
 
-/* Re-initialize buffer (destroys the next and noprompt fields; also the
-windowtitle and windowhandle fields; gets a new back list). */
+/* Re-initialize buffer (destroys the next, hashnext and noprompt fields;
+also the windowtitle and windowhandle fields; gets a new back list). */
 
+cmd_unindexbuffer(currentbuffer);
 init_buffer(currentbuffer, n, store_copystring(s), store_copystring(s),
- fid, default_rmargin);
+ fid, default_rmargin, FALSE);
 
 currentbuffer->next = next;             /* restore */
 currentbuffer->noprompt = noprompt;
+cmd_indexbuffer(currentbuffer);
 
 currentbuffer = NULL;                   /* de-select to inhibit save */
 init_selectbuffer(buffer, FALSE);
+if (yield == done_continue) recover_open(main_filename, TRUE);
 
 return yield;
 }
@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2018 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: February 2018 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains code for obeying commands: Part III */
@@ -116,7 +116,9 @@ to the one required. The old number will have been main_nextbufferno-1, so
 reset that. */
 
 e_newbuffer(cmd);
+cmd_unindexbuffer(currentbuffer);
 currentbuffer->bufferno = cmd->arg2.value;
+cmd_indexbuffer(currentbuffer);
 main_nextbufferno--;
 
 /* The new buffer will have been made current; revert to the
@@ -298,13 +300,14 @@ int e_newbuffer(cmdstr *cmd)
 {
 uschar *name = NULL;
 if ((cmd->flags & cmdf_arg1) != 0) name = (cmd->arg1.string)->text;
-return setup_newbuffer(name);
+return setup_newbuffer(name, FALSE);
 }
 
 
-/* Set up new buffer, given the name */
+/* Set up new buffer, given the name. If unloaded is TRUE, the buffer is not
+selected, and its file is not read until it is (see init_buffer()). */
 
-int setup_newbuffer(uschar *name)
+int setup_newbuffer(uschar *name, BOOL unloaded)
 {
 bufferstr *new;
 FILE *fid = NULL;
@@ -330,10 +333,13 @@ while (cmd_findbuffer(main_nextbufferno++) != NULL);
 /* Initialise the new buffer, chain it, and select it */
 
 init_buffer(new, main_nextbufferno - 1, store_copystring(name),
-  store_copystring(name), fid, main_rmargin);
+  store_copystring(name), fid, main_rmargin, unloaded);
 new->next = main_bufferchain;
 main_bufferchain = new;
+cmd_indexbuffer(new);
+if (new->unloaded) return done_continue;
 init_selectbuffer(new, FALSE);
+recover_open(name, TRUE);
 return done_continue;
 }
 
@@ -467,13 +473,14 @@ if (cmd_findproc(name, NULL))
   }
 else
   {
+  procstr **list = cmd_proclist(name);
   procstr *p = store_Xget(sizeof(procstr));
   p->type = cb_prtype;
   p->flags = 0;
   p->name = store_copystring(name);
   p->body = cmd_copyblock((cmdblock *)(cmd->arg2.cmds));
-  p->next = main_proclist;
-  main_proclist = p;
+  p->next = *list;
+  *list = p;
   return done_continue;
   }
 }
@@ -505,6 +512,19 @@ return done_continue;
 }
 
 
+/*************************************************
+*               The REDO command                 *
+*************************************************/
+
+/* Re-applies the group of changes that was most recently undone. */
+
+int e_redo(cmdstr *cmd)
+{
+(void)cmd;
+return undo_apply(FALSE);
+}
+
+
 /*************************************************
 *             The REFRESH command                *
 *************************************************/
@@ -557,16 +577,60 @@ return done_continue;
 *             The REPEAT command                 *
 *************************************************/
 
+/* The commonest loop is a search followed by an edit, for example
+"repeat (f/x/; a///y/)". When the body consists of exactly an F command and an
+A, B, or E command, they are obeyed directly, without going through
+cmd_obeyline() for each iteration. Each search starts where the previous edit
+left off, so the loop as a whole is a single scan through the buffer. This
+function returns the F command if the body has this form, or NULL otherwise.
+The shortcut is not taken while statistics are being recorded or events traced,
+because those are done by cmd_obeyline(). */
+
+static cmdstr *findedit(cmdstr *body)
+{
+cmdstr *edit;
+if (main_readonly || body == NULL || body->next != NULL || body->count != 1 ||
+    cmd_Eproclist[(usint)(body->id)] != e_sequence)
+  return NULL;
+body = body->arg1.cmds;
+if (body == NULL || (edit = body->next) == NULL || edit->next != NULL ||
+    body->count != 1 || edit->count != 1 ||
+    cmd_Eproclist[(usint)(body->id)] != e_f ||
+    (body->flags & cmdf_arg1) == 0 ||
+    cmd_Eproclist[(usint)(edit->id)] != e_abe)
+  return NULL;
+return body;
+}
+
+
 int e_repeat(cmdstr *cmd)
 {
 int yield = done_loop;
+cmdstr *find = findedit(cmd->arg1.cmds);
+
+cmd_loopdepth++;
 while (yield == done_loop)
   {
   yield = done_continue;
   while (yield == done_continue)
     {
-    if (main_interrupted(ci_loop)) return done_error;
-    yield = cmd_obeyline(cmd->arg1.cmds);
+    if (main_interrupted(ci_loop))
+      {
+      yield = done_error;
+      break;
+      }
+    if (find == NULL || main_stats || main_tracing)
+      yield = cmd_obeyline(cmd->arg1.cmds);
+    else
+      {
+      main_leave_message = FALSE;
+      yield = e_f(find);
+      if (yield == done_continue)
+        {
+        main_leave_message = FALSE;
+        yield = e_abe(find->next);
+        }
+      }
     }
   if (yield == done_loop || yield == done_break)
     {
@@ -574,6 +638,7 @@ while (yield == done_loop)
     if (yield == done_break) yield = done_continue;
     }
   }
+cmd_loopdepth--;
 return yield;
 }
 
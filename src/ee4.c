@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2018 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: May 2018 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains code for obeying commands: Part IV */
@@ -25,7 +25,9 @@
 /* The main procedure is also used by the WRITE command. For SAVE, if
 successful, the buffer's name is changed if a new name was given and the output
 file is not completely released. For WRITE, the file is unrelated to the
-buffer; the name is not changed, and the file is closed. */
+buffer; the name is not changed, and the file is closed. In an interactive
+screen session, a newly opened file is written in the background (see
+esave.c). */
 
 static int savew(cmdstr *cmd, BOOL saveflag, linestr *line, linestr *last)
 {
@@ -33,8 +35,11 @@ int type = -1;
 int yield = done_continue;
 FILE *fid = currentbuffer->to_fid;
 BOOL changename = saveflag && (cmd->misc != save_keepname);
+BOOL background = FALSE;
 uschar *alias, *name, *savealias;
 
+save_wait();
+
 /* Now do the writing */
 
 if ((cmd->flags & cmdf_arg1) == 0)        /* no string */
@@ -62,9 +67,10 @@ if (fid == NULL)
     return done_error;
     }
   fid = sys_fopen(name, US"w");
+  background = main_screenmode && main_interactive && !main_binary;
   }
 
-if (main_screenmode) error_printf("Writing %s\n", alias);
+if (main_screenmode && !background) error_printf("Writing %s\n", alias);
 
 if (fid == NULL)
   {
@@ -95,7 +101,14 @@ if (changename)
   main_drawgraticules |= dg_bottom;
   }
 
-/* Now write the file */
+/* Now write the file, or start writing it */
+
+if (background)
+  {
+  save_start(fid, name, alias, saveflag, line, last);
+  main_nowait = TRUE;
+  return done_continue;
+  }
 
 savealias = main_filealias;
 main_filealias = alias;       /* for messages from sys_outputline */
@@ -123,6 +136,7 @@ if (saveflag)
     main_filechanged = FALSE;
     currentbuffer->changed = FALSE;
     currentbuffer->saved = TRUE;
+    if (Ustrcmp(name, main_filename) == 0) recover_open(name, FALSE);
     }
   }
 
@@ -160,6 +174,38 @@ switch (cmd->misc)
   case set_newcommentstyle:
   main_oldcomment = FALSE;
   break;
+
+  case set_latency:
+  latency_enable(((cmd->flags & cmdf_arg1) != 0)? cmd->arg1.value :
+    !main_latency);
+  break;
+
+  case set_stats:
+  stats_enable(((cmd->flags & cmdf_arg1) != 0)? cmd->arg1.value : !main_stats);
+  break;
+
+  case set_storerelease:
+  main_storerelease = ((cmd->flags & cmdf_arg1) != 0)? cmd->arg1.value :
+    !main_storerelease;
+  break;
+
+  case set_trace:
+  trace_enable(((cmd->flags & cmdf_arg1) != 0)? cmd->arg1.value :
+    !main_tracing);
+  break;
+
+  case set_undo:
+  undo_enable(((cmd->flags & cmdf_arg1) != 0)? cmd->arg1.value : !main_undo);
+  break;
+
+  case set_undolimit:
+  undo_setlimit(cmd->arg1.value);
+  break;
+
+  case set_autosave:
+  recover_enable(((cmd->flags & cmdf_arg1) != 0)? cmd->arg1.value :
+    !main_autosave);
+  break;
   }
 return done_continue;
 }
@@ -464,6 +510,7 @@ switch (cmd->misc)
     {
     error_printf("append:           %s\n", main_appendswitch? " on" : "off");
     error_printf("attn:             %s\n", main_attn? " on" : "off");
+    error_printf("autosave:         %s\n", main_autosave? " on" : "off");
     if (main_screenmode)
       {
       error_printf("autoalign:        %s\n", main_AutoAlign? " on" : "off");
@@ -489,6 +536,22 @@ switch (cmd->misc)
     error_printf("widechars:        %s\n", allow_wide? " on" : "off");
     }
   break;
+
+  case show_latency:
+  latency_show(error_printf);
+  break;
+
+  case show_stats:
+  stats_show(error_printf);
+  break;
+
+  case show_store:
+  stats_showstore(error_printf);
+  break;
+
+  case show_undo:
+  undo_show();
+  break;
   }
 
 return done_wait;    /* indicate output produced */
@@ -561,6 +624,11 @@ return done_continue;
 *              The T and TL commands             *
 *************************************************/
 
+/* The text of each line is written in runs of printing characters, with a
+hex digit for each non-printing character, followed if necessary by a second
+row containing the second hex digits. Long runs of output are gathered up by
+error_write(). */
+
 int e_ttl(cmdstr *cmd)
 {
 int i;
@@ -573,47 +641,50 @@ if (n < 0) n = BIGNUMBER;    /* -ve comes from *, meaning "to eof" */
 
 for (i = 0; i < n; i++)
   {
-  int j;
   int len = line->len;
   uschar *p = line->text;
+  uschar *pe = p + len;
+  uschar *q;
   BOOL nonprinters = FALSE;
 
-  if (main_interrupted(ci_type)) return done_error;
+  if (main_interrupted(ci_type))
+    {
+    error_printflush();
+    return done_error;
+    }
   if ((line->flags & lf_eof) != 0) break;
 
   if (flag)
     {
-    if (line->key > 0) error_printf("%4d  ", line->key);
-      else error_printf("****  ");
+    uschar buff[24];
+    if (line->key > 0) sprintf(CS buff, "%4d  ", line->key);
+      else Ustrcpy(buff, "****  ");
+    error_write(buff, Ustrlen(buff));
     }
 
-  for (j = 0; j < len; j++)
+  for (q = p; q < pe; q++)
     {
-    int c = p[j];
-    if (!isprint(c))
-      {
-      error_printf("%c", hexlist[(c & 0xf0) >> 4]);
-      nonprinters = TRUE;
-      }
-    else error_printf("%c", c);
+    uschar *r = q;
+    while (q < pe && isprint(*q)) q++;
+    if (q > r) error_write(r, q - r);
+    if (q >= pe) break;
+    error_write(hexlist + ((*q & 0xf0) >> 4), 1);
+    nonprinters = TRUE;
     }
-  error_printf("\n");
+  error_write(US"\n", 1);
 
   if (nonprinters)
     {
-    if (flag) error_printf("      ");
-    for (j = 0; j < len; j++)
-      {
-      int c = p[j];
-      if (!isprint(c)) error_printf("%c", hexlist[c & 0x0f]);
-        else error_printf(" ");
-      }
-    error_printf("\n");
+    if (flag) error_write(US"      ", 6);
+    for (q = p; q < pe; q++)
+      error_write(isprint(*q)? US" " : hexlist + (*q & 0x0f), 1);
+    error_write(US"\n", 1);
     }
 
   line = line->next;
   }
 
+error_printflush();
 return done_wait;
 }
 
@@ -674,7 +745,7 @@ if (main_undelete != NULL)
       {
       linestr *next = main_undelete->next;
       store_free(main_undelete->text);
-      store_free(main_undelete);
+      store_freelbuff(main_undelete);
       main_undeletecount--;
       main_undelete = next;
       if (next != NULL) next->prev = NULL;
@@ -697,6 +768,7 @@ if (main_undelete != NULL)
     new->prev = prev;
     new->next = main_current;
     main_current->prev = new;
+    if (undo_recording) undo_insert(new, new, 1);
     main_current = new;          /* Put cursor back on inserted line */
     cursor_col = 0;
     main_linecount++;
@@ -712,6 +784,21 @@ return done_continue;
 
 
 
+/*************************************************
+*               The UNDO command                 *
+*************************************************/
+
+/* Reverses the most recent group of changes that is still in effect; see
+eundo.c for how changes are grouped. */
+
+int e_undo(cmdstr *cmd)
+{
+(void)cmd;
+return undo_apply(TRUE);
+}
+
+
+
 /*************************************************
 *            The UNFORMAT command                *
 *************************************************/
@@ -758,6 +845,8 @@ int e_w(cmdstr *cmd)
 int count = 0;
 bufferstr *thisbuffer = currentbuffer;
 
+save_wait();
+
 /* Warn if data in the cut buffer has not been pasted; prompt
 for permission to continue (if non-interactive, answer will
 always be 'yes'). */
@@ -845,6 +934,16 @@ while (count-- > 0)
     else if (main_interactive) return done_error;
     }
 
+  /* Buffers that have not been loaded have not been changed, so there is no
+  need to select them. */
+
+  while (nextbuffer->unloaded && count > 0)
+    {
+    nextbuffer = (nextbuffer->next == NULL)?
+      main_bufferchain : nextbuffer->next;
+    count--;
+    }
+
   init_selectbuffer(nextbuffer, FALSE);
   }
 
@@ -883,13 +982,18 @@ sestr *se = ((cmd->flags & cmdf_arg1) == 0)? NULL : cmd->arg1.se;
 cmd_eoftrap = (se == NULL) && 
               (misc & (if_mark | if_eol | if_sol | if_sof)) == 0;
 
+cmd_loopdepth++;
 while (yield == done_loop)
   {
   yield = done_continue;
   while (yield == done_continue)
     {
     int match;
-    if (main_interrupted(ci_loop)) return done_error;
+    if (main_interrupted(ci_loop))
+      {
+      yield = done_error;
+      break;
+      }
 
     if (prompt)
       match = cmd_yesno("%s", cmd->arg1.string->text)? MATCH_OK : MATCH_FAILED;
@@ -927,6 +1031,7 @@ while (yield == done_loop)
     if (yield == done_break) yield = done_continue;
     }
   }
+cmd_loopdepth--;
 
 if (yield == done_eof && !oldeoftrap) yield = done_continue;
 cmd_eoftrap = oldeoftrap;
@@ -970,6 +1075,7 @@ while (*p != 0)
     for (i = a+1; i <= b; i++) ch_tab[i] |= ch_word;
     }
   }
+cmd_cacheflush();     /* Compiled lines may depend on character types */
 return done_continue;
 }
 
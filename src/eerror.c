@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2021 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: May 2021 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains code for handling errors */
@@ -26,6 +26,15 @@
 static uschar printf_buff[256];
 static usint printf_buffptr = 0;
 
+/* Buffer for the use of error_write, which is used for large amounts of line
+text. At most one of these two buffers has anything in it at any time, so that
+output always appears in the right order. */
+
+#define write_buffsize (64*1024)
+
+static uschar write_buff[write_buffsize];
+static size_t write_buffptr = 0;
+
 
 
 
@@ -129,7 +138,17 @@ static error_struct error_data[] = {
 #endif
 { rc_serious,  FALSE, US"A line longer than %d bytes has been split\n" },
 { rc_serious,  FALSE, US"File contains a line longer than %d bytes\n" },
-{ rc_disaster, FALSE, US"Call to atexit() failed\n" }
+{ rc_disaster, FALSE, US"Call to atexit() failed\n" },
+{ rc_serious,  FALSE, US"Nothing to %s%s\n" },
+/* 70-74 */
+{ rc_serious,  FALSE, US"The last change was too large to undo (the limit is %dK)\n" },
+{ rc_serious,  FALSE, US"Internal failure - undo journal does not match buffer, so it has been discarded\n" },
+{ rc_serious,  FALSE, US"Cannot write recovery log %s (%s): autosave is off for buffer %d\n" },
+{ rc_serious,  FALSE, US"%s has been truncated or replaced: follow mode is off for buffer %d\n" },
+{ rc_serious,  FALSE, US"Buffer %d cannot be followed: it has no file name, or it is binary\n" },
+/* 75-79 */
+{ rc_serious,  FALSE, US"-batch must be used with -with naming a file, and not with -from, -to or -ver\n" },
+{ rc_serious,  FALSE, US"Cannot use socket %s for NE daemon: %s\n" }
 };
 
 #define error_maxerror (int)(sizeof(error_data)/sizeof(error_struct))
@@ -144,15 +163,16 @@ error_printflush, because that gave greater efficiency in windowing systems
 (well, on the Archimedes, anyway), but of course isn't really relevant any
 more. */
 
-void error_printflush(void)
-{
-uschar *CR, *p;
+/* This is called before anything is output, to make sure that it goes into
+the message window when the screen is in use, and to output any pending
+newline.
 
-if (printf_buffptr == 0) return;
-CR = (msgs_fid == stdout || msgs_fid == stderr)? US"\r": US"";
-if (main_logging) debug_writelog("%s", printf_buff);
+Argument:   the string to put before a newline
+Returns:    nothing
+*/
 
-p = printf_buff;
+static void error_outstart(uschar *CR)
+{
 if (main_screenOK)
   {
   screen_forcecls = TRUE;
@@ -169,6 +189,67 @@ if (main_pendnl)
   sys_mprintf(msgs_fid, "%s\n", CR);
   main_pendnl = main_nowait = FALSE;
   }
+}
+
+
+/* Text from error_write is written in one go, with the same conversions as
+error_printflush() below, except when characters have to be converted for a
+non-UTF-8 terminal, in which case it is passed through error_printf() a line,
+or a few hundred bytes, at a time. */
+
+static void error_writeflush(void)
+{
+uschar *CR, *p, *pe;
+
+if (write_buffptr == 0) return;
+p = write_buff;
+pe = p + write_buffptr;
+write_buffptr = 0;
+
+if (msgs_tty && !main_utf8terminal)
+  {
+  while (p < pe)
+    {
+    uschar *q = p;
+    while (q < pe && *q++ != '\n' &&
+      (q - p < 200 || (q < pe && (*q & 0xc0) == 0x80)));
+    error_printf("%.*s", (int)(q - p), p);
+    p = q;
+    }
+  error_printflush();
+  return;
+  }
+
+CR = (msgs_fid == stdout || msgs_fid == stderr)? US"\r": US"";
+if (main_logging) debug_writelog("%.*s", (int)(pe - p), p);
+error_outstart(CR);
+
+if (*CR == 0) sys_mwrite(msgs_fid, p, pe - p); else while (p < pe)
+  {
+  uschar *nl = memchr(p, '\n', pe - p);
+  if (nl == NULL)
+    {
+    sys_mwrite(msgs_fid, p, pe - p);
+    break;
+    }
+  sys_mwrite(msgs_fid, p, nl - p);
+  sys_mwrite(msgs_fid, US"\r\n", 2);
+  p = nl + 1;
+  }
+}
+
+
+void error_printflush(void)
+{
+uschar *CR, *p;
+
+if (write_buffptr > 0) error_writeflush();
+if (printf_buffptr == 0) return;
+CR = (msgs_fid == stdout || msgs_fid == stderr)? US"\r": US"";
+if (main_logging) debug_writelog("%s", printf_buff);
+
+p = printf_buff;
+error_outstart(CR);
 
 while (*p != 0)
   {
@@ -203,6 +284,7 @@ if (main_verified_ptr)
   error_printf("\n");
   }
 
+if (write_buffptr > 0) error_writeflush();
 vsprintf(CS printf_buff + printf_buffptr, format, ap);
 printf_buffptr = Ustrlen(printf_buff);
 if (printf_buffptr > 200 || printf_buff[printf_buffptr-1] == '\n') 
@@ -211,6 +293,45 @@ va_end(ap);
 }
 
 
+/* This is used for the text of lines, which may be long and which is already
+in the form in which it is to be output, so it need not go through vsprintf().
+It is buffered up into large blocks, which are written when the buffer is full
+or when error_printflush() or error_printf() is called.
+
+Arguments:
+  s           the text
+  len         its length
+
+Returns:      nothing
+*/
+
+void error_write(uschar *s, size_t len)
+{
+if (main_verified_ptr)
+  {
+  main_verified_ptr = FALSE;
+  error_printf("\n");
+  }
+
+if (printf_buffptr > 0) error_printflush();
+
+while (len > 0)
+  {
+  size_t n = write_buffsize - write_buffptr;
+  if (n == 0)
+    {
+    error_writeflush();
+    n = write_buffsize;
+    }
+  if (n > len) n = len;
+  memcpy(write_buff + write_buffptr, s, n);
+  write_buffptr += n;
+  s += n;
+  len -= n;
+  }
+}
+
+
 /*************************************************
 *            Generate error message              *
 *************************************************/
@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2018 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: February 2018 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains code for handling input and output */
@@ -19,9 +19,18 @@
 *          Support routines for backups          *
 *************************************************/
 
+/* The names of files that have been written are kept in files_written, which
+is a vector of chains indexed by a hash of the name. */
+
+#ifdef FILE_CASELESS
+#define filehash(s)  (cmd_hash(s, TRUE) % file_hashsize)
+#else
+#define filehash(s)  (cmd_hash(s, FALSE) % file_hashsize)
+#endif
+
 BOOL file_written(uschar *name)
 {
-filewritstr *p = files_written;
+filewritstr *p = files_written[filehash(name)];
 while (p != NULL)
   {
   #ifdef FILE_CASELESS
@@ -40,11 +49,12 @@ return FALSE;
 void file_setwritten(uschar *name)
 {
 filewritstr *p;
+filewritstr **list = files_written + filehash(name);
 if (file_written(name)) return;
 p = store_Xget(sizeof(filewritstr));
 p->name = store_copystring(name);
-p->next = files_written;
-files_written = p;
+p->next = *list;
+*list = p;
 }
 
 
@@ -129,8 +139,8 @@ else
   ff = *f;
   length = 0;
   maxlength = buffgetsize;
-  line = store_getlbuff(buffgetsize);
-  s = line->text;
+  line = store_getlbuff(0);
+  line->text = s = store_getpacked(buffgetsize);
 
   if (ff == NULL) eof = TRUE; else while (length < buffgetsize)
     {
@@ -216,13 +226,16 @@ else
     line->text = NULL;
     }
 
-  /* At end of file, close input */
+  /* At end of file, close input, remembering how much was read for the
+  benefit of follow mode. */
 
   if (eof)
     {
     line->flags |= lf_eof;
     if (ff != NULL)
       {
+      long int size = ftell(ff);
+      file_readsize = (size < 0)? 0 : (uint64_t)size;
       fclose(ff);
       *f = NULL;
       }
@@ -231,6 +244,12 @@ else
   if (tabbed) line->flags |= lf_tabs;
   }
 
+if (main_stats && (line->flags & lf_eof) == 0)
+  {
+  main_statdata.linesread++;
+  main_statdata.bytesread += line->len + 1;
+  }
+
 return line;
 }
 
@@ -245,6 +264,12 @@ int i;
 int len = line->len;
 uschar *p = line->text;
 
+if (main_stats)
+  {
+  main_statdata.lineswritten++;
+  main_statdata.byteswritten += len + 1;
+  }
+
 /* Handle binary output */
 
 if (main_binary)
@@ -346,7 +371,11 @@ BOOL file_save(uschar *name)
 FILE *f;
 linestr *line = main_top;
 int yield = TRUE;
+usint count = 0;
+uint64_t start = main_stats? sys_usecs() : 0;
 
+save_wait();
+TRACE(tr_save, currentbuffer->bufferno, 0);
 if (name == NULL || name[0] == 0)
   { error_moan(59, currentbuffer->bufferno); return FALSE; }
 else if (Ustrcmp(name, "-") == 0) f = stdout;
@@ -363,6 +392,7 @@ while ((line->flags & lf_eof) == 0)
     }
   else if (rc == 0) yield = FALSE;   /* Binary failure */
   line = line->next;
+  count++;
   }
 
 if (f != stdout) 
@@ -373,7 +403,9 @@ if (f != stdout)
     return FALSE;
     }
   } 
-   
+
+if (main_stats) main_statdata.writetime += sys_usecs() - start;
+TRACE(tr_saveend, count, yield);
 return yield;
 }
 
@@ -0,0 +1,378 @@
+/*************************************************
+*       The E text editor - 3rd incarnation      *
+*************************************************/
+
+/* Copyright (c) University of Cambridge, 1991 - 2021 */
+
+/* Written by Philip Hazel, starting November 1991 */
+/* This file last modified: October 2026 */
+
+
+/* This file contains code for following a file that is growing, such as a
+log file. When FOLLOW is obeyed, the buffer's file is opened and positioned at
+the point where it was read up to when it was loaded. Whenever NE is waiting
+for a keystroke in screen mode, the file is checked, and any new complete lines
+are read and added to the end of the buffer, a slice at a time so that a
+keystroke is never kept waiting. If the cursor is at the end of the buffer, it
+stays there. An incomplete last line is held back until the rest of it
+arrives.
+
+If the file becomes shorter, or a different file with the same name appears
+(as happens when a log is rotated), the buffer is loaded again from scratch,
+unless it has been changed, in which case following stops. Lines that are
+added are not recorded for undo, and do not count as changes. */
+
+
+#include "ehdr.h"
+#include "cmdhdr.h"
+#include "shdr.h"
+
+/* The amount of data that is read between checks for a keystroke, the size of
+the reading buffer, and the time to wait between checks of the file when it has
+not grown, in milliseconds. */
+
+#define slice_size     (1024*1024)
+#define read_size      (64*1024)
+#define poll_interval  250
+
+struct followstr {
+  FILE    *fid;                 /* The open file */
+  uint64_t offset;              /* Amount read */
+  uint64_t ident;               /* Identity of the open file */
+  uschar  *partial;             /* Incomplete last line */
+  usint    partlen;             /* Its length */
+  usint    partsize;            /* Size of its store */
+};
+
+static uschar follow_buffer[read_size];
+
+
+
+/*************************************************
+*        Add one line before the eof line        *
+*************************************************/
+
+/* Tabs are handled in the same way as when a file is read. The new line takes
+the key of the eof line, which is then given a new key, so that keys remain in
+order at the end of the buffer.
+
+Arguments:
+  p            the text of the line
+  len          its length
+
+Returns:       nothing
+*/
+
+static void
+follow_addline(uschar *p, usint len)
+{
+linestr *line = store_getlbuff(0);
+usint length = len;
+BOOL tabbed = main_tabin && memchr(p, '\t', len) != NULL;
+
+if (tabbed)
+  {
+  usint i;
+  for (i = 0, length = 0; i < len; i++)
+    length = (p[i] == '\t')? (length + 8) & ~7u : length + 1;
+  if (main_tabflag) line->flags |= lf_tabs;
+  }
+
+/* Over-long lines are chopped. */
+
+if (length > MAX_LINELENGTH) length = MAX_LINELENGTH;
+
+if (length > 0)
+  {
+  uschar *s = line->text = store_getpacked(length);
+  uschar *se = s + length;
+  if (!tabbed) memcpy(s, p, length); else
+    {
+    usint i;
+    for (i = 0; i < len && s < se; i++)
+      {
+      if (p[i] != '\t') *s++ = p[i]; else
+        {
+        do *s++ = ' '; while (((s - line->text) % 8) != 0 && s < se);
+        }
+      }
+    }
+  }
+line->len = length;
+
+line->key = main_bottom->key;
+main_bottom->key = (main_bottom->key >= main_imax)?
+  main_bottom->key + 1 : main_imax + 1;
+main_imax = main_bottom->key;
+
+line->next = main_bottom;
+line->prev = main_bottom->prev;
+if (line->prev == NULL) main_top = line; else line->prev->next = line;
+main_bottom->prev = line;
+main_linecount++;
+}
+
+
+
+/*************************************************
+*            Read new lines from the file        *
+*************************************************/
+
+/* Complete lines are added to the buffer; any incomplete line at the end of
+the data is kept until the rest of it arrives.
+
+Arguments:
+  f            the follow state
+  limit        the amount of data to read
+
+Returns:       the number of lines added
+*/
+
+static usint
+follow_read(followstr *f, size_t limit)
+{
+size_t total = 0;
+usint count = 0;
+
+clearerr(f->fid);
+while (total < limit)
+  {
+  uschar *p = follow_buffer;
+  uschar *pe;
+  size_t n = fread(follow_buffer, 1, read_size, f->fid);
+  if (n == 0) break;
+  total += n;
+  f->offset += n;
+  pe = p + n;
+
+  while (p < pe)
+    {
+    uschar *nl = memchr(p, '\n', pe - p);
+    usint len = ((nl == NULL)? pe : nl) - p;
+
+    /* No newline: save the start of a line; also add it if it has become
+    too long to be a line. */
+
+    if (nl == NULL || f->partlen > 0)
+      {
+      if (f->partlen + len > f->partsize)
+        {
+        usint newsize = (f->partlen + len) * 2;
+        uschar *newpart = store_Xget(newsize);
+        if (f->partlen > 0) memcpy(newpart, f->partial, f->partlen);
+        if (f->partial != NULL) store_free(f->partial);
+        f->partial = newpart;
+        f->partsize = newsize;
+        }
+      memcpy(f->partial + f->partlen, p, len);
+      f->partlen += len;
+      if (nl == NULL && f->partlen < MAX_LINELENGTH) break;
+      follow_addline(f->partial, f->partlen);
+      f->partlen = 0;
+      }
+    else follow_addline(p, len);
+
+    count++;
+    p += len + 1;
+    }
+  }
+
+return count;
+}
+
+
+
+/*************************************************
+*                 Stop following                 *
+*************************************************/
+
+/* This is called when following is turned off, and when the buffer is emptied
+or deleted.
+
+Argument:   the buffer
+Returns:    nothing
+*/
+
+void
+follow_stop(bufferstr *buffer)
+{
+followstr *f = buffer->follow;
+if (f == NULL) return;
+fclose(f->fid);
+if (f->partial != NULL) store_free(f->partial);
+store_free(f);
+buffer->follow = NULL;
+}
+
+
+
+/*************************************************
+*          Load a replaced file again            *
+*************************************************/
+
+/* If the buffer has been changed, following stops. Otherwise the file is
+loaded again and followed from its end. If the cursor was at the end of the
+buffer, it is put at the end of the new one.
+
+Arguments:   none
+Returns:     nothing
+*/
+
+static void
+follow_reload(void)
+{
+BOOL ateof = (main_current->flags & lf_eof) != 0;
+cmdstr cmd;
+stringstr str;
+
+if (main_filechanged)
+  {
+  follow_stop(currentbuffer);
+  error_moan(73, main_filealias, currentbuffer->bufferno);
+  return;
+  }
+
+str.text = store_copystring(main_filename);
+cmd.arg1.string = &str;
+cmd.flags = cmdf_arg1;
+if (e_load(&cmd) == done_continue && follow_start() && ateof)
+  {
+  main_current = main_bottom;
+  cursor_col = 0;
+  }
+store_free(str.text);
+if (main_screenOK) screen_forcecls = TRUE;
+}
+
+
+
+/*************************************************
+*          Bring the buffer up to date           *
+*************************************************/
+
+/* The file is checked for being replaced, and then up to the given amount of
+new data is read from it.
+
+Arguments:
+  f            the follow state
+  limit        the amount of data to read
+  count        where to put the number of lines added
+
+Returns:       -1 if following has stopped; 0 if there is more data to read;
+               otherwise 1
+*/
+
+static int
+follow_update(followstr *f, size_t limit, usint *count)
+{
+uint64_t size, ident;
+
+*count = 0;
+
+/* The file may be missing for a moment while a log is rotated. */
+
+if (!sys_fileident(main_filename, NULL, &size, &ident)) return 1;
+
+if (ident != f->ident || size < f->offset)
+  {
+  follow_reload();
+  return (currentbuffer->follow == NULL)? -1 : 1;
+  }
+
+if (size > f->offset) *count = follow_read(f, limit);
+return (f->offset < size)? 0 : 1;
+}
+
+
+
+/*************************************************
+*          Start following the current buffer    *
+*************************************************/
+
+/* The file is positioned where it was read up to when the buffer was loaded.
+Any new lines are added at once. If the buffer is already being followed, it is
+just brought up to date, so that in line mode, obeying FOLLOW again reads any
+new lines.
+
+Arguments:   none
+Returns:     FALSE on error
+*/
+
+BOOL
+follow_start(void)
+{
+followstr *f = currentbuffer->follow;
+FILE *fid;
+uint64_t size, ident;
+usint count;
+
+if (f == NULL)
+  {
+  if (main_binary || main_filename == NULL || main_filename[0] == 0 ||
+      Ustrcmp(main_filename, "-") == 0)
+    {
+    error_moan(74, currentbuffer->bufferno);
+    return FALSE;
+    }
+
+  if ((fid = sys_fopen(main_filename, US"r")) == NULL)
+    {
+    error_moan(5, main_filename, "reading", strerror(errno));
+    return FALSE;
+    }
+
+  if (!sys_fileident(NULL, fid, &size, &ident) ||
+      (size >= currentbuffer->readsize &&
+        fseeko(fid, (off_t)currentbuffer->readsize, SEEK_SET) != 0))
+    {
+    error_moan(5, main_filename, "reading", strerror(errno));
+    fclose(fid);
+    return FALSE;
+    }
+
+  f = store_Xget(sizeof(followstr));
+  f->fid = fid;
+  f->offset = currentbuffer->readsize;
+  f->ident = ident;
+  f->partial = NULL;
+  f->partlen = f->partsize = 0;
+  currentbuffer->follow = f;
+  }
+
+while (follow_update(f, SIZE_MAX, &count) == 0);
+cmd_refresh = TRUE;
+return TRUE;
+}
+
+
+
+/*************************************************
+*      Read from the file while waiting          *
+*************************************************/
+
+/* This is called when NE is waiting for a keystroke in screen mode. Nothing
+is done while a command line or a reply to a prompt is being read. When lines
+are added, the screen is updated, keeping the cursor at the end of the buffer
+if it was there.
+
+Arguments:   none
+Returns:     -1 if nothing is being followed; otherwise the number of
+               milliseconds to wait for a keystroke before calling again
+*/
+
+int
+follow_idle(void)
+{
+followstr *f = (currentbuffer == NULL)? NULL : currentbuffer->follow;
+usint count;
+int rc;
+
+if (f == NULL || s_window() == message_window) return -1;
+
+rc = follow_update(f, slice_size, &count);
+if (count > 0) scrn_hint(sh_insert, count, NULL);
+if (count > 0 || screen_forcecls) scrn_display();
+return (rc < 0)? -1 : (rc == 0)? 0 : poll_interval;
+}
+
+/* End of efollow.c */
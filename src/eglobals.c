@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2021 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: May 2021 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains all the global data */
@@ -31,11 +31,15 @@ FILE *kbd_fid;
 
 BOOL    allow_wide = FALSE;
 
-uschar *arg_from_name = NULL;         /* Names on command line */
+uschar *arg_batch_name = NULL;        /* Names on command line */
+uschar *arg_from_name = NULL;
 uschar *arg_to_name = NULL;
+uschar *arg_trace_name = NULL;
+uschar *arg_stats_name = NULL;
 uschar *arg_ver_name = NULL;
 uschar *arg_with_name = NULL;
 uschar *arg_zero;                     /* ARGV[0] */
+int     arg_jobcount = 0;             /* Processes for -batch; 0 => default */
 
 bufferstr *currentbuffer;
 
@@ -48,7 +52,9 @@ linestr *cmd_cbufferline;
 uschar *cmd_cmdline;
 BOOL  cmd_eoftrap;
 BOOL  cmd_faildecode;
+int   cmd_joincount = 0;
 int   cmd_ist;
+int   cmd_loopdepth = 0;
 BOOL  cmd_onecommand;
 uschar *cmd_ptr;
 BOOL  cmd_refresh;
@@ -77,7 +83,8 @@ jmp_buf error_jmpbuf;
 BOOL    error_longjmpOK = FALSE;
 BOOL    error_werr = FALSE;
 
-filewritstr *files_written = NULL;
+uint64_t file_readsize = 0;         /* Bytes read before last input eof */
+filewritstr *files_written[file_hashsize];
 
 uschar    key_codes[256];
 int key_controlmap;
@@ -89,6 +96,9 @@ sestr *last_abese;
 qsstr *last_abent;
 sestr *last_gse;
 qsstr *last_gnt;
+sestr *last_se_source;
+sestr *last_abese_source;
+sestr *last_gse_source;
 
 linestr *main_bottom;
 linestr *main_current;
@@ -97,12 +107,14 @@ linestr *main_top;
 linestr *main_undelete;
 
 bufferstr *main_bufferchain;
+bufferstr *main_bufferhash[buffer_hashsize];
 backstr   *main_backlist;
-procstr   *main_proclist = NULL;
+procstr   *main_proclist[proc_hashsize];
 
 BOOL  main_appendswitch = FALSE;
 BOOL  main_attn = TRUE;
 BOOL  main_AutoAlign = FALSE;
+BOOL  main_autosave = TRUE;         /* Autosave logging option */
 usint main_backnext = 0;
 usint main_backtop = 0;
 usint main_backregionsize = 12;
@@ -114,6 +126,7 @@ BOOL  main_done = FALSE;
 int   main_drawgraticules;
 BOOL  main_eightbit = FALSE;
 uschar *main_einit = NULL;
+BOOL  main_einitdone = FALSE;
 BOOL  main_eoftrap = FALSE;
 BOOL  main_escape_pressed = FALSE;
 uschar *main_filealias;
@@ -126,7 +139,10 @@ int   main_imax;
 int   main_imin;
 BOOL  main_initialized = FALSE;
 BOOL  main_interactive = TRUE;
+BOOL  main_keypressed = FALSE;
 BOOL  main_leave_message = FALSE;
+BOOL  main_latency = FALSE;
+BOOL  main_library = FALSE;
 usint main_linecount = 0;
 BOOL  main_logging = FALSE;
 int   main_nextbufferno;
@@ -140,6 +156,8 @@ BOOL  main_overstrike = FALSE;
 BOOL  main_pendnl = FALSE;
 int   main_rc = 0;                  /* The final return code */
 BOOL  main_readonly = FALSE;
+BOOL  main_recover = FALSE;         /* Apply recovery logs */
+recoverstr *main_recovery = NULL;   /* Logging state for current buffer */
 BOOL  main_repaint;
 usint main_rmargin = 79;            /* Default for line-by-line */
 BOOL  main_screenmode = TRUE;
@@ -147,12 +165,21 @@ BOOL  main_screenOK = FALSE;
 BOOL  main_screensuspended = FALSE;
 BOOL  main_selectedbuffer;
 BOOL  main_shownlogo = FALSE;       /* FALSE if need to show logo on error */
+statstr main_statdata;              /* Counters for statistics */
+BOOL  main_stats = FALSE;           /* Statistics are being recorded */
+BOOL  main_storerelease = FALSE;    /* Give free system blocks back */
+int   main_storetag = st_other;     /* Subsystem getting store */
 size_t main_storetotal = 0;         /* Total store used */
 BOOL  main_tabflag = FALSE;
 BOOL  main_tabin = FALSE;
 BOOL  main_tabout = FALSE;
 uschar *main_tabs = NULL;
+BOOL  main_tracing = FALSE;         /* Events are being traced */
 int   main_undeletecount = 0;
+int   main_unloaded = 0;
+BOOL  main_undo = TRUE;             /* Undo recording option */
+usint main_undolimit = 32768;       /* Undo journal limit, in K */
+undostr *main_journal = NULL;       /* Journal for current buffer */
 BOOL  main_unixregexp = FALSE;
 BOOL  main_utf8terminal = FALSE;
 int   main_vcursorscroll = 1;
@@ -194,16 +221,22 @@ sestr *saved_se = NULL;
 
 BOOL  screen_autoabove;
 BOOL  screen_forcecls = FALSE;
+usint screen_frames = 0;            /* Output frames delivered */
+usint screen_maxwrites = 0;         /* Most writes for one frame */
 usint screen_max_col;               /* Applies to whole screen */
 usint screen_max_row;
 int   screen_subchar = '?';         /* Substitute character */
 BOOL  screen_suspend = TRUE;        /* Suspend for * commands */
 BOOL  screen_use_scroll = TRUE;     /* Use optimizing scrolls */
+usint screen_writes = 0;            /* Total writes for all frames */
 
 int   sys_openfail_reason = of_other;
 
 int   topbit_minimum = 160;         /* minimum top-bit uschar */
 
+BOOL  undo_keeping = TRUE;          /* Changes are being kept for undo */
+BOOL  undo_recording = TRUE;        /* Changes are being journalled or logged */
+
 uschar *version_copyright;          /* Copyright string */
 uschar  version_date[20];           /* Identity date */
 uschar *version_string;             /* Identity of program version */
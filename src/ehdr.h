@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2021 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: May 2021 */
+/* This file last modified: October 2026 */
 
 
 /******************************************************************************
@@ -45,6 +45,7 @@ See the doc/ChangeLog file for a list of changes in the various releases.
 
 #include "config.h"
 #include "mytypes.h"
+#include "tracehdr.h"
 
 #ifdef USE_PCRE1
 #include <pcre.h>
@@ -102,8 +103,24 @@ See the doc/ChangeLog file for a list of changes in the various releases.
 
 #define back_size           20    /* number of "back" reference regions */
 
+#define buffer_hashsize   1024    /* buckets in the buffer number index */
+#define proc_hashsize      256    /* buckets in the procedure index */
+#define file_hashsize     1024    /* buckets in the written files index */
+
+#define load_slice  (1024*1024)   /* read between keystroke checks */
+
 #define mac_skipspaces(a)  while (*a == ' ') a++
 
+/* Trace points; see etrace.c. Building with -DNO_TRACE removes them, leaving
+only a reference to the data to avoid "unused variable" warnings. */
+
+#ifdef NO_TRACE
+#define TRACE(e,a,b) do { (void)(a); (void)(b); } while (0)
+#else
+#define TRACE(e,a,b) \
+  do { if (main_tracing) trace_event(e, (a), (uint64_t)(b)); } while (0)
+#endif
+
 /* Graticules flags */
 
 #define dg_none        0  /* nothing to be drawn */
@@ -185,14 +202,22 @@ enum { cuttype_text, cuttype_rect };
 
 enum { show_ckeys = 1, show_fkeys, show_xkeys, show_allkeys,
   show_keystrings, show_buffers, show_wordcount, show_version,
-  show_actions, show_commands, show_wordchars, show_settings };
+  show_actions, show_commands, show_wordchars, show_settings, show_latency,
+  show_undo, show_stats, show_store };
 
 enum { abe_a, abe_b, abe_e };
 
 enum { cbuffer_c, cbuffer_cd };
 
 enum { set_autovscroll = 1, set_autovmousescroll, set_splitscrollrow,
-  set_oldcommentstyle, set_newcommentstyle };
+  set_oldcommentstyle, set_newcommentstyle, set_latency, set_undo,
+  set_undolimit, set_autosave, set_stats, set_trace, set_storerelease };
+
+/* Latency measuring points; lat_datakey is passed to latency_function() for a
+data keystroke. */
+
+enum { lat_key, lat_handled, lat_displayed, lat_flushed };
+#define lat_datakey  (-1)
 
 enum { debug_crash = 1, debug_exceedstore, debug_nullline, debug_baderror };
 
@@ -202,7 +227,8 @@ enum { detrail_buffer, detrail_output };
 
 enum { backup_files };
 
-enum { ci_move, ci_type, ci_read, ci_cmd, ci_delete, ci_scan, ci_loop };
+enum { ci_move, ci_type, ci_read, ci_cmd, ci_delete, ci_scan, ci_loop,
+  ci_search };
 
 enum { of_other, of_existence };
 
@@ -337,11 +363,15 @@ extern FILE *kbd_fid;
 
 extern BOOL    allow_wide;             /* TRUE to recognized UTF-8 */
 
-extern uschar *arg_from_name;          /* Names on command line */
+extern uschar *arg_batch_name;         /* Names on command line */
+extern uschar *arg_from_name;
 extern uschar *arg_to_name;
+extern uschar *arg_stats_name;
+extern uschar *arg_trace_name;
 extern uschar *arg_ver_name;
 extern uschar *arg_with_name;
 extern uschar *arg_zero;               /* ARGV[0] */
+extern int     arg_jobcount;          /* Processes for -batch */
 
 extern bufferstr *currentbuffer;
 
@@ -362,6 +392,8 @@ extern uschar *cmd_list[];             /* List of command names */
 extern int     cmd_listsize;           /* Size of command list */
 extern BOOL    cmd_faildecode;         /* Failure flag */
 extern int     cmd_ist;                /* Delimiter for inserting in cmd concats */
+extern int     cmd_joincount;          /* Count of continuation line reads */
+extern int     cmd_loopdepth;          /* Depth of active loops */
 extern BOOL    cmd_eoftrap;            /* Trapping eof */
 extern BOOL    cmd_onecommand;         /* Command line is a single command */
 extern uschar *cmd_ptr;                /* Current pointer */
@@ -391,7 +423,8 @@ extern jmp_buf error_jmpbuf;           /* For disastrous errors */
 extern BOOL    error_longjmpOK;        /* Set when longjmp can be taken */
 extern BOOL    error_werr;             /* Force window-type error */
 
-extern filewritstr *files_written;     /* Chain of written file names */
+extern uint64_t file_readsize;         /* Bytes read before last input eof */
+extern filewritstr *files_written[];   /* Index of written file names */
 
 extern uschar *key_actionnames[];
 extern int     key_actnamecount;       /* size of following table */
@@ -410,16 +443,21 @@ extern sestr *last_abese;              /* last se for abe */
 extern qsstr *last_abent;              /* last replacement for abe */
 extern sestr *last_gse;                /* last se for global */
 extern qsstr *last_gnt;                /* last replacement qs for global */
+extern sestr *last_se_source;          /* block last_se was copied from */
+extern sestr *last_abese_source;       /* block last_abese was copied from */
+extern sestr *last_gse_source;         /* block last_gse was copied from */
 
 extern linestr *main_bottom;           /* last line */
 extern linestr *main_current;          /* current line */
 extern linestr *main_top;              /* first line */
 
 extern bufferstr *main_bufferchain;
+extern bufferstr *main_bufferhash[];     /* Index of buffers by number */
 
 extern BOOL  main_appendswitch;        /* cut append option */
 extern BOOL  main_attn;                /* attention on/off switch */
 extern BOOL  main_AutoAlign;
+extern BOOL    main_autosave;          /* autosave logging option */
 extern backstr *main_backlist;         /* list of "back" positions */
 extern usint   main_backnext;          /* next backup to use */
 extern usint   main_backtop;           /* topmost recorded position */
@@ -432,6 +470,7 @@ extern BOOL    main_done;              /* job is finished */
 extern int     main_drawgraticules;    /* an option value */
 extern BOOL    main_eightbit;          /* display option */
 extern uschar *main_einit;             /* initializing file name */
+extern BOOL    main_einitdone;         /* it was obeyed by the daemon */
 extern BOOL    main_eoftrap;           /* until eof flag */
 extern BOOL    main_escape_pressed;    /* a human interrupt */
 extern uschar *main_fromlist[];        /* additional input files */
@@ -443,8 +482,11 @@ extern uschar *main_fixedKstrings[];   /* fixed key strings */
 extern usint   main_hscrollamount;     /* left/right scroll value */
 extern int     main_ilinevalue;        /* boundary between up/down scroll */
 extern BOOL    main_interactive;       /* set if interactive */
+extern BOOL    main_keypressed;        /* a keystroke cancels a search */
 extern int     main_imax;              /* number of last line read */
 extern int     main_imin;              /* number of last insert */
+extern BOOL    main_latency;           /* keystroke latency recording */
+extern BOOL    main_library;           /* libne: each buffer is a session */
 extern usint   main_linecount;         /* number of lines in current buffer */
 extern BOOL    main_logging;           /* turns on debugging logging */
 extern BOOL    main_nlexit;            /* needs NL on exit */
@@ -459,9 +501,11 @@ extern BOOL    main_oneattn;           /* had one suppressed attention */
 extern uschar *main_opt;               /* the "opt" argument */
 extern BOOL    main_overstrike;
 extern BOOL    main_pendnl;            /* pending nl if more line-by-line output */
-extern procstr *main_proclist;         /* procedure chain */
+extern procstr *main_proclist[];       /* Index of procedures */
 extern int     main_rc;                /* The final return code */
 extern BOOL    main_readonly;          /* Buffer is read only */
+extern BOOL    main_recover;           /* apply recovery logs */
+extern recoverstr *main_recovery;      /* logging state for current buffer */
 extern BOOL    main_repaint;           /* Force screen repaint after command */
 extern usint   main_rmargin;           /* current margin */
 extern BOOL    main_screenmode;        /* true if full-screen operation */
@@ -469,6 +513,11 @@ extern BOOL    main_screenOK;          /* screen mode and not suspended */
 extern BOOL    main_screensuspended;   /* screen temporarily suspended */
 extern BOOL    main_selectedbuffer;    /* true if buffer has changed */
 extern BOOL    main_shownlogo;         /* FALSE if need to show logo on error */
+extern statstr main_statdata;          /* counters for statistics */
+extern BOOL    main_storerelease;      /* give free system blocks back */
+extern int     main_storetag;          /* subsystem getting store */
+extern BOOL    main_stats;             /* statistics are being recorded */
+extern BOOL    main_tracing;           /* events are being traced */
 extern size_t  main_storetotal;        /* Total store used */
 extern BOOL    main_tabflag;           /* Flag tabbed input lines */
 extern BOOL    main_tabin;             /* the tabin option */
@@ -476,6 +525,10 @@ extern BOOL    main_tabout;            /* the tabout option */
 extern uschar *main_tabs;              /* the default tabs text option */
 extern linestr *main_undelete;         /* first undelete structure */
 extern int     main_undeletecount;     /* count of lines */
+extern int     main_unloaded;          /* count of unloaded buffers */
+extern BOOL    main_undo;              /* undo recording option */
+extern usint   main_undolimit;         /* undo journal limit (K) */
+extern undostr *main_journal;          /* undo journal for current buffer */
 extern BOOL    main_unixregexp;        /* Unix regular expressions */
 extern BOOL    main_utf8terminal;      /* Terminal is UTF-8 */
 extern int     main_vcursorscroll;     /* Vertical scroll amount */
@@ -514,9 +567,12 @@ extern pcre2_match_data *re_match_data;
 
 extern BOOL    screen_autoabove;
 extern BOOL    screen_forcecls;        /* Force a complete refresh */
+extern usint   screen_frames;          /* Output frames delivered */
+extern usint   screen_maxwrites;       /* Most writes for one frame */
 extern int     screen_subchar;         /* Substitute character */
 extern BOOL    screen_suspend;         /* Set to cause suspension over * commands */
 extern BOOL    screen_use_scroll;      /* Use scroll to speed up displaying */
+extern usint   screen_writes;          /* Total writes for all frames */
 
 extern usint   screen_max_col;         /* Applies to full screen */
 extern usint   screen_max_row;
@@ -528,6 +584,9 @@ extern int     sys_openfail_reason;    /* Reason for open failure */
 
 extern int     topbit_minimum;         /* lowest top-bit char */
 
+extern BOOL    undo_keeping;           /* changes are being kept for undo */
+extern BOOL    undo_recording;         /* changes are being journalled or logged */
+
 extern const   int utf8_table3[];      /* Globally used UTF-8 table */
 extern const   uschar utf8_table4[];   /* Globally used UTF-8 table */
 
@@ -557,21 +616,34 @@ extern void    debug_printf(const char *, ...) PRINTF_FUNCTION;
 extern void    debug_screen(void);
 extern void    debug_writelog(const char *, ...) PRINTF_FUNCTION;
 
+extern FILE   *batch_run(uschar *, uschar *, int, uschar **);
+
+extern int     daemon_client(uschar *, int, char **);
+extern void    daemon_run(uschar *, int *, char ***);
+
 extern BOOL    cmd_atend(void);
+extern void    cmd_cacheflush(void);
 extern cmdstr *cmd_compile(void);
 extern int     cmd_confirmoutput(uschar *, BOOL, BOOL, BOOL, int, uschar **);
+extern void    cmd_deferback(BOOL);
 extern void   *cmd_copyblock(cmdblock *);
 extern BOOL    cmd_emptybuffer(bufferstr *, uschar *);
 extern bufferstr *cmd_findbuffer(int);
 extern BOOL    cmd_findproc(uschar *, procstr **);
+extern void    cmd_forgetback(linestr *);
 extern void    cmd_freeblock(cmdblock *);
 extern cmdstr *cmd_getcmdstr(int);
+extern usint   cmd_hash(uschar *, BOOL);
+extern int     cmd_idcount(void);
+extern uschar *cmd_idname(int, uschar *);
+extern void    cmd_indexbuffer(bufferstr *);
 extern BOOL    cmd_joinline(BOOL);
 extern BOOL    cmd_makeCRE(qsstr *);
 extern int     cmd_matchqsR(qsstr *, linestr *, int);
 extern int     cmd_matchse(sestr *, linestr *, int);
 extern int     cmd_obey(uschar *);
 extern int     cmd_obeyline(cmdstr *);
+extern procstr **cmd_proclist(uschar *);
 extern int     cmd_readnumber(void);
 extern BOOL    cmd_readprocname(stringstr **name);
 extern BOOL    cmd_readqualstr(qsstr **, int);
@@ -582,6 +654,7 @@ extern int     cmd_readUstring(stringstr **);
 extern void    cmd_readword(void);
 extern linestr *cmd_ReChange(linestr *, uschar *, usint, BOOL, BOOL, BOOL);
 extern void    cmd_recordchanged(linestr *, int);
+extern void    cmd_unindexbuffer(bufferstr *);
 extern BOOL    cmd_yesno(const char *, ...) PRINTF_FUNCTION;
 
 extern void    crash_handler(int);
@@ -594,6 +667,7 @@ extern int     cut_pastetext(void);
 extern void    error_moan(int, ...);
 extern void    error_moanqse(int, sestr *);
 extern void    error_printf(const char *, ...) PRINTF_FUNCTION;
+extern void    error_write(uschar *, size_t);
 extern void    error_printflush(void);
 
 extern linestr *file_nextline(FILE **, int *);
@@ -602,8 +676,16 @@ extern void    file_setwritten(uschar *);
 extern BOOL    file_written(uschar *);
 extern int     file_writeline(linestr *, FILE *);
 
-extern void    init_buffer(bufferstr *, int, uschar *, uschar *, FILE *, int);
+extern int     follow_idle(void);
+extern BOOL    follow_start(void);
+extern void    follow_stop(bufferstr *);
+
+extern void    init_buffer(bufferstr *, int, uschar *, uschar *, FILE *, int,
+                  BOOL);
 extern BOOL    init_init(FILE *, uschar *, uschar *);
+extern void    init_library(uschar *, uschar *);
+extern BOOL    init_loadidle(void);
+extern BOOL    init_readbuffer(bufferstr *, size_t);
 extern void    init_selectbuffer(bufferstr *, BOOL);
 
 extern void    key_handle_data(int);
@@ -612,6 +694,11 @@ extern void    key_makespecialname(int, uschar *);
 extern int     key_set(uschar *, BOOL);
 extern void    key_setfkey(int, uschar *);
 
+extern void    latency_enable(BOOL);
+extern void    latency_function(int);
+extern void    latency_mark(int);
+extern void    latency_show(void (*)(const char *, ...));
+
 extern int     line_bytecount(uschar *, int);
 extern usint   line_charcount(uschar *, usint);
 extern int     line_checkabove(linestr *);
@@ -621,10 +708,14 @@ extern linestr *line_cutpart(linestr *, int, int, BOOL);
 extern linestr *line_delete(linestr *, BOOL);
 extern void    line_deletech(linestr *, int, int, BOOL);
 extern void    line_deletebytes(linestr *, int, int, BOOL);
+extern linestr *line_deleterange(linestr *, linestr *, BOOL);
+extern void    line_forget(linestr *, linestr *, BOOL);
 extern void    line_formatpara(BOOL);
 extern void    line_insertbytes(linestr *, int, int, uschar *, int, usint);
+extern linestr *line_join(linestr *, int, int);
 extern void    line_leftalign(linestr *, int, int *);
 extern usint   line_offset(linestr *, int);
+extern uschar *line_reserve(linestr *, usint);
 extern int     line_soffset(uschar *, uschar *, int);
 extern linestr *line_split(linestr *, usint);
 extern void    line_verify(linestr *, BOOL, BOOL);
@@ -639,6 +730,24 @@ extern int     ord2utf8(int, uschar *);
 
 extern int rdargs(int, char **, uschar *, arg_result *);
 
+extern void    recover_delete(linestr *, linestr *);
+extern void    recover_enable(BOOL);
+extern void    recover_free(recoverstr *, BOOL);
+extern void    recover_idle(void);
+extern void    recover_insert(linestr *, linestr *);
+extern void    recover_join(linestr *, linestr *, usint);
+extern void    recover_open(uschar *, BOOL);
+extern void    recover_replace(linestr *, usint, usint, uschar *, usint);
+extern void    recover_split(linestr *);
+extern void    recover_text(linestr *, usint, usint, usint);
+extern void    recover_textdone(linestr *);
+extern void    recover_tidy(BOOL);
+
+extern void    save_crash(void);
+extern BOOL    save_idle(void);
+extern void    save_start(FILE *, uschar *, uschar *, BOOL, linestr *, linestr *);
+extern void    save_wait(void);
+
 extern void    scrn_afterhscroll(void);
 extern void    scrn_display(void);
 extern void    scrn_displayline(linestr *, int, int);
@@ -654,7 +763,7 @@ extern void    scrn_terminate(void);
 extern void    scrn_windows(void);
 
 extern int     setup_dbuffer(bufferstr *);
-extern int     setup_newbuffer(uschar *);
+extern int     setup_newbuffer(uschar *, BOOL);
 
 extern void    store_chop(void *, size_t);
 extern void   *store_copy(void *);
@@ -662,12 +771,32 @@ extern linestr *store_copyline(linestr *);
 extern uschar *store_copystring(uschar *);
 extern uschar *store_copystring2(uschar *, uschar *);
 extern void    store_free(void *);
+extern void    store_freelbuff(linestr *);
+extern void   *store_share(void *);
+extern BOOL    store_shared(void *);
+extern void   *store_unshare(void *);
+extern void    store_freevector(void **, size_t);
 extern void    store_freequeuecheck(void);
 extern void    store_free_all(void);
 extern void   *store_get(size_t);
 extern void   *store_getlbuff(size_t);
+extern void   *store_getpacked(size_t);
+extern void    store_info(storeinfostr *);
 extern void    store_init(void);
+extern int     store_release(void);
+extern size_t  store_size(void *);
 extern void   *store_Xget(size_t);
+extern void   *store_Xgettag(size_t, int);
+
+extern void    stats_enable(BOOL);
+extern int     stats_obey(cmdstr *);
+extern void    stats_show(void (*)(const char *, ...));
+extern void    stats_showstore(void (*)(const char *, ...));
+extern void    stats_writejson(uschar *);
+
+extern BOOL    trace_dump(int);
+extern void    trace_enable(BOOL);
+extern void    trace_event(int, usint, uint64_t);
 
 extern uschar *sys_argstring(uschar *);
 extern void    sys_beep(void);
@@ -682,15 +811,38 @@ extern FILE   *sys_fopen(uschar *, uschar *);
 extern BOOL    sys_help(uschar *);
 extern void    sys_init1(void);
 extern void    sys_init2(uschar *);
+extern BOOL    sys_inputready(int);
 extern uschar *sys_keyreason(int);
 extern void    sys_keystroke(int);
 extern void    sys_mprintf(FILE *, const char *, ...) FPRINTF_FUNCTION;
+extern void    sys_mwrite(FILE *, uschar *, size_t);
 extern void    sys_mouse(BOOL);
 extern int     sys_rc(int);
 extern void    sys_runscreen(void);
 extern void    sys_runwindow(void);
 extern void    sys_specialnotes(usint *, void(*)(usint, usint *));
+extern BOOL    sys_fileident(uschar *, FILE *, uint64_t *, uint64_t *);
+extern BOOL    sys_filestamp(uschar *, uint64_t *, uint64_t *);
+extern uschar *sys_recoveryname(uschar *);
+extern BOOL    sys_syncfile(FILE *);
 extern void    sys_tidy_up(void);
+extern uint64_t sys_usecs(void);
+
+extern int     undo_apply(BOOL);
+extern void    undo_attr(linestr *);
+extern void    undo_delete(linestr *, linestr *, usint);
+extern void    undo_enable(BOOL);
+extern void    undo_free(undostr *);
+extern void    undo_group(BOOL);
+extern void    undo_insert(linestr *, linestr *, usint);
+extern void    undo_join(linestr *, linestr *, usint);
+extern void    undo_setlimit(usint);
+extern void    undo_setstate(BOOL);
+extern void    undo_show(void);
+extern void    undo_split(linestr *, linestr *);
+extern void    undo_text(linestr *, usint, usint, usint);
+extern void    undo_textdone(linestr *);
+
 extern int     utf82ord(uschar *, int *);
 extern void    version_init(void);
 
@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2021 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: May 2021 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains initializing code, including the main program, which is
@@ -66,6 +66,7 @@ BOOL main_interrupted(int type)
 {
 main_cicount++;
 sys_checkinterrupt(type);
+if (main_keypressed) return TRUE;    /* Search cancelled; see search_end() */
 if (main_escape_pressed)
   {
   main_escape_pressed = FALSE;
@@ -101,12 +102,72 @@ if (main_escape_pressed)
 
 
 
+/*************************************************
+*            Read lines into a buffer            *
+*************************************************/
+
+/* This reads the file for a buffer that is being set up, or for a buffer that
+was set up unloaded and has not yet been selected (see init_buffer() below). In
+the latter case it may be called several times, each time reading a little more
+of the file, so that the file can be read while NE is waiting for a keystroke.
+When the end of the file is reached, file_nextline() closes it and sets
+from_fid to NULL. In binary mode this happens when the last partial line is
+read, so there is one more call to get the end-of-file line.
+
+Arguments:
+  buffer       the buffer
+  limit        the amount of data to read
+
+Returns:       TRUE if the whole file has been read
+*/
+
+BOOL init_readbuffer(bufferstr *buffer, size_t limit)
+{
+size_t size = 0;
+usint count = 0;
+uint64_t start = main_stats? sys_usecs() : 0;
+
+TRACE(tr_read, buffer->bufferno, 0);
+while (buffer->bottom == NULL || (buffer->bottom->flags & lf_eof) == 0)
+  {
+  linestr *line;
+  if (buffer->from_fid != NULL && size >= limit) break;
+  line = file_nextline(&buffer->from_fid, &buffer->binoffset);
+  count++;
+  if (buffer->bottom == NULL)
+    {
+    buffer->top = buffer->current = line;
+    line->key = buffer->linecount = 1;
+    }
+  else
+    {
+    line->key = buffer->imax += 1;
+    buffer->bottom->next = line;
+    line->prev = buffer->bottom;
+    buffer->linecount += 1;
+    }
+  buffer->bottom = line;
+  size += line->len + 1;
+  if ((line->flags & lf_eof) != 0) buffer->readsize = file_readsize;
+  }
+
+if (main_stats) main_statdata.readtime += sys_usecs() - start;
+TRACE(tr_readend, count, size);
+return buffer->from_fid == NULL;
+}
+
+
+
 /*************************************************
 *            Initialize a new buffer             *
 *************************************************/
 
+/* If the buffer is to be unloaded, the file is not read now, but when the
+buffer is first selected, or while NE is waiting for a keystroke in screen
+mode. */
+
 void init_buffer(bufferstr *buffer, int n, uschar *name, uschar *alias,
-  FILE *ffid, int rmargin)
+  FILE *ffid, int rmargin, BOOL unloaded)
 {
 usint i;
 for (i = 0; i < sizeof(bufferstr)/sizeof(int); i++) ((int *)buffer)[i] = 0;
@@ -127,30 +188,48 @@ buffer->backtop = 0;
 
 /* Set up first line in the buffer */
 
+buffer->from_fid = ffid;
+
 if (ffid == NULL)
   {
-  buffer->bottom = buffer->top = store_getlbuff(0);
+  buffer->bottom = buffer->top = buffer->current = store_getlbuff(0);
   buffer->top->flags |= lf_eof;
   buffer->top->key = buffer->linecount = 1;
   }
-else
+else if (unloaded)
   {
-  buffer->bottom = buffer->top = file_nextline(&ffid, &buffer->binoffset);
-  buffer->top->key = buffer->linecount = 1;
+  buffer->unloaded = TRUE;
+  main_unloaded++;
+  }
+else (void)init_readbuffer(buffer, SIZE_MAX);
+}
+
 
-  while ((buffer->bottom->flags & lf_eof) == 0)
+
+/*************************************************
+*      Read unloaded buffers while waiting       *
+*************************************************/
+
+/* This is called when NE is waiting for a keystroke in screen mode. Some of
+the file for the first buffer that has not been completely read is read.
+
+Arguments:   none
+Returns:     TRUE if there is more to read
+*/
+
+BOOL init_loadidle(void)
+{
+bufferstr *b;
+if (main_unloaded == 0) return FALSE;
+for (b = main_bufferchain; b != NULL; b = b->next)
+  {
+  if (b->unloaded && b->from_fid != NULL)
     {
-    linestr *last = buffer->bottom;
-    buffer->bottom = file_nextline(&ffid, &buffer->binoffset);
-    buffer->bottom->key = buffer->imax += 1;
-    last->next = buffer->bottom;
-    buffer->bottom->prev = last;
-    buffer->linecount += 1;
+    (void)init_readbuffer(b, load_slice);
+    return TRUE;
     }
   }
-
-buffer->from_fid = ffid;
-buffer->current = buffer->top;
+return FALSE;
 }
 
 
@@ -162,10 +241,13 @@ buffer->current = buffer->top;
 void init_selectbuffer(bufferstr *buffer, BOOL changeflag)
 {
 
-/* First of all, salt away current parameters */
+/* First of all, salt away current parameters, after finishing any background
+write and writing out any autosave records for the buffer. */
 
 if (currentbuffer != NULL)
   {
+  save_wait();
+  recover_idle();
   currentbuffer->backlist = main_backlist;
   currentbuffer->backnext = main_backnext;
   currentbuffer->backtop = main_backtop;
@@ -184,6 +266,8 @@ if (currentbuffer != NULL)
   currentbuffer->current = main_current;
   currentbuffer->filename = main_filename;
   currentbuffer->filealias = main_filealias;
+  currentbuffer->journal = main_journal;
+  currentbuffer->recovery = main_recovery;
 
   currentbuffer->marktype = mark_type;
   currentbuffer->markline = mark_line;
@@ -195,6 +279,10 @@ if (currentbuffer != NULL)
     currentbuffer->scrntop = window_vector[0];
   }
 
+/* If the buffer is unloaded, read the rest of its file. */
+
+if (buffer->unloaded) (void)init_readbuffer(buffer, SIZE_MAX);
+
 /* Now set parameters from saved block */
 
 main_backlist = buffer->backlist;
@@ -215,6 +303,9 @@ main_bottom = buffer->bottom;
 main_current = buffer->current;
 main_filename = buffer->filename;
 main_filealias = buffer->filealias;
+main_journal = buffer->journal;
+main_recovery = buffer->recovery;
+undo_group(FALSE);
 
 mark_type = buffer->marktype;
 mark_line = buffer->markline;
@@ -230,6 +321,16 @@ if (main_screenOK)
   screen_forcecls = TRUE;
   scrn_hint(sh_topline, 0, buffer->scrntop);
   }
+
+/* When an unloaded buffer is first selected, its autosave log is dealt with,
+as it would have been if the file had been loaded at the start. */
+
+if (buffer->unloaded)
+  {
+  buffer->unloaded = FALSE;
+  main_unloaded--;
+  recover_open(main_filename, TRUE);
+  }
 }
 
 
@@ -275,7 +376,9 @@ main_initialized = FALSE;    /* errors now are fatal */
 
 main_bufferchain = store_Xget(sizeof(bufferstr));
 init_buffer(main_bufferchain, 0, store_copystring(toname),
-  store_copystring(toname), from_fid, main_rmargin);
+  store_copystring(toname), from_fid, main_rmargin, FALSE);
+memset(main_bufferhash, 0, sizeof(bufferstr *) * buffer_hashsize);
+cmd_indexbuffer(main_bufferchain);
 main_nextbufferno = 1;
 init_selectbuffer(main_bufferchain, FALSE);
 
@@ -283,34 +386,34 @@ main_filechanged = TRUE;
 if ((fromname == NULL && toname == NULL) ||
     (fromname != NULL && toname != NULL && Ustrcmp(fromname, toname) == 0 &&
       Ustrcmp(fromname, "-") != 0))
-        main_filechanged = FALSE;
+  {
+  main_filechanged = FALSE;
+  recover_open(fromname, TRUE);
+  }
 
 cmd_stackptr = 0;
 last_se = NULL;
 last_gse = last_abese = NULL;
 last_gnt = last_abent = NULL;
-main_proclist = NULL;
+last_se_source = last_abese_source = last_gse_source = NULL;
+if (!main_einitdone) memset(main_proclist, 0, sizeof(procstr *) * proc_hashsize);
 cut_buffer = NULL;
 cmd_cbufferline = NULL;
 main_undelete = main_lastundelete = NULL;
 main_undeletecount = 0;
 par_begin = par_end = NULL;
-files_written = NULL;
+memset(files_written, 0, sizeof(filewritstr *) * file_hashsize);
 
-/* There may be additional file names, to be loaded into other buffers. */
+/* There may be additional file names, to be loaded into other buffers. These
+are set up unloaded, so that their files are not read until they are needed. */
 
   {
   int i;
-  cmdstr cmd;
-  stringstr str;
   bufferstr *firstbuffer = main_bufferchain;
   for (i = 0; i < MAX_FROM; i++)
     {
     if (main_fromlist[i] == NULL) break;
-    str.text = main_fromlist[i];
-    cmd.arg1.string = &str;
-    cmd.flags |= cmdf_arg1;
-    if (e_newbuffer(&cmd) != done_continue) break;
+    if (setup_newbuffer(main_fromlist[i], TRUE) != done_continue) break;
     }
   init_selectbuffer(firstbuffer, TRUE);
   }
@@ -332,6 +435,12 @@ printf("-from <files>  input files, default null, - means stdin, key can be omit
 printf("-to <file>     output file for 1st input, default = from\n");
 printf("-with <file>   command file, default is terminal\n");
 printf("-ver <file>    verification file, default is screen\n");
+printf("-batch <file>  apply the -with file to each file named in <file>\n");
+printf("-jobs <n>      number of files processed at once by -batch\n");
+printf("-daemon <socket>  (first) run as a daemon, listening on <socket>\n");
+printf("-client <socket>  (first) pass the remaining arguments to a daemon\n");
+printf("-stats <file>  write command statistics to <file> in JSON format\n");
+printf("-trace <file>  trace events, dumping them to <file>\n");
 printf("-line          run in line-by-line mode\n");
 printf("-opt <string>  initial line of commands\n");
 printf("-noinit        don\'t obey .nerc file\n");
@@ -343,6 +452,8 @@ printf("-tabin         expand input tabs; no tabs on output\n");
 printf("-tabout        use tabs in all output lines\n");
 printf("-notabs        no special tab treatment\n");
 printf("-notraps       don't catch signals (debugging option)\n");
+printf("-noundo        don't record changes for undo\n");
+printf("-recover       apply recovery logs left by a crash\n");
 printf("-w[idechars]   recognize UTF-8 characters in files\n");
 printf("--version      show current version\n");
 printf("-v[ersion]     show current version\n");
@@ -356,6 +467,7 @@ printf("\nThe tabbing default is -notabs unless overridden by the NETABS "
 printf("          EXAMPLES\n");
 printf("ne myfile -notabs\n");
 printf("ne myfile -with commands -to outfile -line\n");
+printf("ne -batch filelist -with commands -jobs 4\n");
 }
 
 
@@ -369,7 +481,9 @@ static void decode_command(int argc, char **argv)
 enum { arg_from,     arg_to=MAX_FROM, arg_id,        arg_help,   arg_line,
        arg_with,     arg_ver,         arg_opt,       arg_noinit, arg_tabs,
        arg_tabin,    arg_tabout,      arg_notabs,    arg_binary,
-       arg_notraps,  arg_readonly,    arg_widechars, arg_end };
+       arg_notraps,  arg_readonly,    arg_widechars, arg_noundo,
+       arg_recover,  arg_batch,       arg_jobs,      arg_stats,
+       arg_trace,    arg_end };
 
 int i, rc;
 uschar argstring[256];
@@ -382,7 +496,8 @@ Ustrcpy(argstring,
   XSTR(MAX_FROM)
   ",to/k,id=-version=version=v/s,help=-help=h/s,line/s,with/k,ver/k,"
   "opt/k,noinit/s,tabs/s,tabin/s,tabout/s,notabs/s,binary=b/s,"
-  "notraps/s,readonly=r/s,widechars=w/s");
+  "notraps/s,readonly=r/s,widechars=w/s,noundo/s,recover/s,batch/k,jobs/k/n,"
+  "stats/k,trace/k");
 #undef STR
 #undef XSTR
 
@@ -455,15 +570,28 @@ if (results[arg_widechars].data.number != 0) allow_wide = TRUE;
 
 if (results[arg_notraps].data.number != 0) no_signal_traps = TRUE;
 
+/* Noundo option */
+
+if (results[arg_noundo].data.number != 0)
+  {
+  main_undo = FALSE;
+  undo_setstate(FALSE);
+  }
+
+/* Recover option */
+
+if (results[arg_recover].data.number != 0) main_recover = TRUE;
+
 /* Deal with an initial opt command line */
 
 main_opt = results[arg_opt].data.text;
 
-/* Set up a command file - this implies line-by-line mode */
+/* Set up a command file - this implies line-by-line mode, and there is no
+autosaving by default. */
 
 if (results[arg_with].data.text != NULL)
   {
-  main_screenmode = main_screenOK = main_interactive = FALSE;
+  main_screenmode = main_screenOK = main_interactive = main_autosave = FALSE;
   arg_with_name = store_copystring(results[arg_with].data.text);
   }
 
@@ -525,6 +653,37 @@ if (results[arg_to].data.text != NULL)
       }
     }
   }
+
+/* A batch run applies the -with file to each file in a list, so there must
+not be any other files. */
+
+if (results[arg_batch].data.text != NULL)
+  {
+  if (arg_with_name == NULL || Ustrcmp(arg_with_name, "-") == 0 ||
+      arg_from_name != NULL || arg_to_name != NULL || arg_ver_name != NULL)
+    {
+    main_screenmode = FALSE;
+    error_moan(75);    /* Hard */
+    }
+  arg_batch_name = store_copystring(results[arg_batch].data.text);
+  arg_jobcount = results[arg_jobs].data.number;
+  }
+
+/* Statistics are recorded from the start if they are to be written out. */
+
+if (results[arg_stats].data.text != NULL)
+  {
+  arg_stats_name = store_copystring(results[arg_stats].data.text);
+  stats_enable(TRUE);
+  }
+
+/* Likewise, events are traced from the start if -trace is given. */
+
+if (results[arg_trace].data.text != NULL)
+  {
+  arg_trace_name = store_copystring(results[arg_trace].data.text);
+  trace_enable(TRUE);
+  }
 }
 
 
@@ -684,6 +843,7 @@ if (init_init(NULL, fromname, toname))
       n = Ustrlen(cmd_buffer);
       if (n > 0 && cmd_buffer[n-1] == '\n') cmd_buffer[n-1] = 0;
       (void)cmd_obey(cmd_buffer);
+      recover_idle();
       }
     else
       {
@@ -728,6 +888,13 @@ Returns:   nothing
                                 
 static void tidy_up(void)
 {                
+save_wait();
+recover_tidy(FALSE);
+if (main_latency && main_screenmode) latency_show(debug_printf);
+if (arg_stats_name != NULL) stats_writejson(arg_stats_name);
+if (!trace_dump(0))
+  fprintf(stderr, "** NE: failed to write the event trace: %s\n",
+    strerror(errno));
 if (debug_file != NULL) fclose(debug_file);
 if (crash_logfile != NULL) fclose(crash_logfile);
 
@@ -745,10 +912,58 @@ store_free_all();
 }
 
 
+/*************************************************
+*      Initialize for use as a library           *
+*************************************************/
+
+/* This does the same early initialization as main(), for a program that uses
+NE through the interface in elib.c. There is no command line, no signals are
+trapped, and everything is as for a non-interactive run, except that messages
+are suppressed until a command is obeyed.
+
+Arguments:
+  cbuffer      a buffer of CMD_BUFFER_SIZE for reading command lines
+  nercbuffer   a buffer of FNAME_BUFFER_SIZE for sys_init2()
+
+Returns:       nothing
+*/
+
+void init_library(uschar *cbuffer, uschar *nercbuffer)
+{
+uschar *tabs = US getenv("NETABS");
+
+cmd_buffer = cbuffer;
+kbd_fid = stdin;
+cmdin_fid = NULL;
+msgs_fid = stderr;
+arg_zero = US"libne";
+
+main_screenmode = main_screenOK = main_interactive = main_autosave = FALSE;
+main_verify = FALSE;
+main_library = main_shownlogo = TRUE;
+if (tabs != NULL) main_tabs = tabs;
+
+store_init();
+tables_init();
+keystrings_init();
+version_init();
+tab_init();
+sys_init2(nercbuffer);
+}
+
+
+
 /*************************************************
 *                Entry Point                     *
 *************************************************/
 
+/* When NE is built as a library, main() is renamed so that it does not clash
+with the caller's, but it can still be called to run NE as a command. */
+
+#ifdef NE_LIBRARY
+#define main ne_main
+#endif
+
 int main(int argc, char **argv)
 {
 int sigptr = 0;
@@ -757,6 +972,12 @@ uschar fbuffer1[FNAME_BUFFER_SIZE];
 uschar fbuffer2[FNAME_BUFFER_SIZE];
 uschar fbuffer3[FNAME_BUFFER_SIZE];
 
+/* A client just passes its arguments to a daemon, and needs no
+initialization. */
+
+if (argc > 2 && strcmp(argv[1], "-client") == 0)
+  return daemon_client(US argv[2], argc - 3, argv + 3);
+
 if (atexit(tidy_up) != 0) error_moan(68);  /* Hard */
 
 cmd_buffer = cbuffer;            /* make globally available */
@@ -776,6 +997,26 @@ sys_init1();                     /* Early local initialization */
 version_init();                  /* Set up for messages */
 tab_init();                      /* Set default tab options */
 arg_zero = US argv[0];           /* Some systems want this */
+
+/* A daemon returns only in a child process, with the arguments of a request,
+which is always run in line-by-line mode. The initialization file is obeyed
+once, in the daemon, with an empty buffer, so that its settings, keys, and
+procedures are inherited by every request, and the file is not obeyed again. */
+
+if (argc > 2 && strcmp(argv[1], "-daemon") == 0)
+  {
+  main_screenmode = main_screenOK = main_interactive = FALSE;
+  sys_init2(fbuffer3);
+  if (main_einit != NULL && init_init(NULL, NULL, NULL))
+    {
+    obey_init(main_einit);
+    main_einitdone = main_noinit = TRUE;
+    }
+  daemon_run(US argv[2], &argc, &argv);
+  main_screenmode = main_screenOK = FALSE;
+  main_interactive = TRUE;
+  }
+
 decode_command(argc, argv);      /* Decode command line */
 if (main_binary && allow_wide) error_moan(64);  /* Hard */
 sys_init2(fbuffer3);             /* Final local initialization */
@@ -797,6 +1038,18 @@ if (!no_signal_traps)
   while (signal_list[sigptr] > 0) signal(signal_list[sigptr++], crash_handler);
   }
 
+/* In a batch run, only a child process returns from batch_run(), with its
+file name and its copy of the command file. */
+
+if (arg_batch_name != NULL)
+  {
+  uschar *name;
+  cmdin_fid = batch_run(arg_batch_name, arg_with_name, arg_jobcount, &name);
+  arg_from_name = arg_from_buffer;
+  Ustrcpy(arg_from_name, name);
+  arg_with_name = NULL;
+  }
+
 /* The variables main_screenmode and main_interactive will have been set to
 indicate the style of editing run. */
 
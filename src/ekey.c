@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2021 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: May 2021 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains code for handling individual function keystrokes. */
@@ -305,7 +305,9 @@ usint byteoffset = line_offset(main_current, cursor_col);
 BOOL waseof = (main_current->flags & lf_eof) != 0;
 uschar bp[8];
 
+if (main_latency) latency_function(lat_datakey);
 if (main_readonly) { read_only_error(); return; }
+undo_group(TRUE);
 
 if (allow_wide && key > 127)
   {
@@ -327,7 +329,10 @@ if (main_overstrike && byteoffset < main_current->len)
   int clen = line_bytecount(main_current->text + byteoffset, 1);
   if (clen == blen)
     {
+    main_current->text = store_unshare(main_current->text);
+    if (undo_recording) undo_text(main_current, byteoffset, blen, blen);
     memcpy(main_current->text + byteoffset, bp, blen);
+    if (undo_recording) undo_textdone(main_current);
     }
   else
     {
@@ -702,23 +707,19 @@ if (op == lb_rectsp ||
 
 if (op == lb_delete)
   {
-  int done = 1;
-  usint count = 0;
+  int done;
+  usint count = 1;
+  linestr *last = line;
 
-  while (done > 0)
+  if ((line->flags & lf_eof) != 0) return;   /* Not deleted anything */
+
+  while (last != endline && (last->next->flags & lf_eof) == 0)
     {
-    if ((line->flags & lf_eof) != 0)
-      {
-      if (count == 0) return;          /* Not deleted anything */
-      done = 0;
-      }
-    else
-      {
-      if (line == endline) done = -1;
-      line = line_delete(line, TRUE);
-      count++;
-      }
+    last = last->next;
+    count++;
     }
+  done = (last == endline)? -1 : 0;
+  line = line_deleterange(line, last, TRUE);
 
   main_current = line;
 
@@ -906,6 +907,9 @@ if (function <= s_f_umax+max_fkey) function = key_table[function];
     function = key_fixedtable[function-s_f_fbase];
   else function = ka_push;    /* unknown are ignored */
 
+if (main_latency) latency_function(function);
+undo_group(FALSE);
+
 if (main_readonly && function >= ka_firstka && function <= ka_lastka &&
   !key_readonly[function - ka_firstka])
     { read_only_error();  return; }
@@ -1654,6 +1658,8 @@ switch (function)
   break;
   }
 
+if (main_latency) latency_mark(lat_handled);
+
 if (!main_done && currentbuffer != NULL)
   {
   scrn_display();   /* Adjusts cursor_row */
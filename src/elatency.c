@@ -0,0 +1,264 @@
+/*************************************************
+*       The E text editor - 3rd incarnation      *
+*************************************************/
+
+/* Copyright (c) University of Cambridge, 1991 - 2026 */
+
+/* Written by Philip Hazel, starting November 1991 */
+/* This file last modified: October 2026 */
+
+
+/* This file contains code for measuring the time from the arrival of a
+keystroke to the moment its effect has been delivered to the terminal. It is
+enabled by SET LATENCY ON; when disabled, each measuring point costs only a
+test of main_latency. The time for each keystroke is split into three stages:
+handling (up to the end of key_handle_function() or key_handle_data()),
+display (to the end of the last scrn_display()) and output (to the end of the
+next screen flush). Times are kept in microseconds in histograms whose buckets
+are linear within each power of two, in the manner of HDR histograms, so that
+percentiles are accurate to within an eighth. */
+
+
+#include "ehdr.h"
+#include "keyhdr.h"
+
+
+/* Histogram shape: values less than lat_sub are counted exactly; above that,
+each power of two is divided into lat_sub buckets. */
+
+#define lat_subbits   3
+#define lat_sub       (1 << lat_subbits)
+#define lat_buckets   (lat_sub + (32 - lat_subbits) * lat_sub)
+
+typedef struct {
+  usint    count;
+  usint    max;
+  uint64_t total;
+  usint    bucket[lat_buckets];
+} histogram;
+
+/* Histograms for each kind of keystroke: data, keystrings, others, and then
+one per keystroke action. */
+
+#define lat_hdata     0
+#define lat_hstring   1
+#define lat_hother    2
+#define lat_hfirstka  3
+#define lat_hcount    (lat_hfirstka + ka_lastka - ka_firstka + 1)
+
+static histogram *lat_hists = NULL;
+static histogram *lat_stages = NULL;  /* handle, display, output */
+
+static uint64_t time_key = 0;
+static uint64_t time_handled;
+static uint64_t time_displayed;
+static int lat_which = -1;
+
+static const char *stage_names[] = { "handle", "display", "output" };
+
+
+
+/*************************************************
+*        Add a value to a histogram              *
+*************************************************/
+
+static void
+lat_add(histogram *h, uint64_t value)
+{
+usint v = (value > 0xffffffffu)? 0xffffffffu : (usint)value;
+int n;
+
+if (v < lat_sub) n = v; else
+  {
+  int p = 31;
+  while ((v & (1u << p)) == 0) p--;
+  n = lat_sub + (p - lat_subbits) * lat_sub +
+    ((v >> (p - lat_subbits)) & (lat_sub - 1));
+  }
+
+h->bucket[n]++;
+h->count++;
+h->total += v;
+if (v > h->max) h->max = v;
+}
+
+
+
+/*************************************************
+*      Find a percentile value in a histogram    *
+*************************************************/
+
+/* The value returned is the middle of the bucket that contains the given
+percentile, or the maximum if that is smaller. */
+
+static usint
+lat_percentile(histogram *h, int percent)
+{
+usint wanted = (usint)(((uint64_t)h->count * percent + 99) / 100);
+usint sofar = 0;
+int n;
+
+for (n = 0; n < lat_buckets; n++)
+  {
+  sofar += h->bucket[n];
+  if (sofar >= wanted && sofar > 0)
+    {
+    usint lower, width;
+    if (n < lat_sub) return n;
+    lower = (usint)(lat_sub + (n % lat_sub)) << ((n / lat_sub) - 1);
+    width = 1u << ((n / lat_sub) - 1);
+    lower += width/2;
+    return (lower > h->max)? h->max : lower;
+    }
+  }
+return h->max;
+}
+
+
+
+/*************************************************
+*           Enable or disable recording          *
+*************************************************/
+
+/* The histograms are obtained the first time recording is enabled. They are
+not reset when it is disabled, so that the results can still be shown. */
+
+void
+latency_enable(BOOL on)
+{
+if (on && lat_hists == NULL)
+  {
+  size_t size = (lat_hcount + 3) * sizeof(histogram);
+  lat_hists = store_Xget(size);
+  memset(lat_hists, 0, size);
+  lat_stages = lat_hists + lat_hcount;
+  }
+main_latency = on;
+time_key = 0;
+lat_which = -1;
+}
+
+
+
+/*************************************************
+*     Note the action for the current keystroke  *
+*************************************************/
+
+/* Key handling may be recursive; only the outermost action is noted. The
+argument is a keystroke action, a keystring number, or lat_datakey. */
+
+void
+latency_function(int function)
+{
+if (time_key == 0 || lat_which >= 0) return;
+if (function == lat_datakey) lat_which = lat_hdata;
+else if (function >= ka_firstka && function <= ka_lastka)
+  lat_which = lat_hfirstka + function - ka_firstka;
+else if ((1 <= function && function <= max_keystring) ||
+     (256 - max_fixedKstring <= function && function <= 255))
+  lat_which = lat_hstring;
+else lat_which = lat_hother;
+}
+
+
+
+/*************************************************
+*            Record a time point                 *
+*************************************************/
+
+/* A keystroke is recorded only if its handling has finished by the time the
+following flush happens. If, for example, a keystroke causes a command line
+to be read, the flushes that happen while it is being typed abandon the
+measurement, and the time for the command is then measured from the final
+keystroke of the command line. The action is retained from the original
+keystroke, so the time is attributed to it. */
+
+void
+latency_mark(int point)
+{
+uint64_t now = sys_usecs();
+
+switch (point)
+  {
+  case lat_key:
+  time_key = now;
+  time_handled = time_displayed = 0;
+  break;
+
+  case lat_handled:
+  if (time_key != 0 && time_handled == 0) time_handled = now;
+  break;
+
+  case lat_displayed:
+  if (time_handled != 0) time_displayed = now;
+  break;
+
+  case lat_flushed:
+  if (time_key != 0 && time_handled != 0)
+    {
+    if (time_displayed == 0) time_displayed = time_handled;
+    lat_add(lat_hists + ((lat_which < 0)? lat_hother : lat_which),
+      now - time_key);
+    lat_add(lat_stages, time_handled - time_key);
+    lat_add(lat_stages + 1, time_displayed - time_handled);
+    lat_add(lat_stages + 2, now - time_displayed);
+    lat_which = -1;
+    }
+  time_key = 0;
+  break;
+  }
+}
+
+
+
+/*************************************************
+*              Show the results                  *
+*************************************************/
+
+/* This is called for SHOW LATENCY, with error_printf() as the output
+function, and at the end of a run, with debug_printf(). */
+
+void
+latency_show(void (*oprintf)(const char *, ...))
+{
+int i;
+
+if (lat_hists == NULL)
+  {
+  oprintf("Latency recording has not been enabled\n");
+  return;
+  }
+
+oprintf("Keystroke latency (microseconds)\n");
+oprintf("%-9s %7s %8s %8s %8s %8s %8s\n", "action", "count", "mean", "p50",
+  "p90", "p99", "max");
+
+for (i = 0; i < lat_hcount + 3; i++)
+  {
+  histogram *h = lat_hists + i;
+  char buff[16];
+  const char *name = buff;
+
+  if (i == lat_hcount) oprintf("Stages:\n");
+  if (h->count == 0) continue;
+
+  if (i >= lat_hcount) name = stage_names[i - lat_hcount];
+  else if (i == lat_hdata) name = "data";
+  else if (i == lat_hstring) name = "keystring";
+  else if (i == lat_hother) name = "other";
+  else
+    {
+    int j;
+    int ka = ka_firstka + i - lat_hfirstka;
+    sprintf(buff, "ka%d", ka);
+    for (j = 0; j < key_actnamecount; j++)
+      if (key_actnames[j].code == ka) { name = CS key_actnames[j].name; break; }
+    }
+
+  oprintf("%-9s %7u %8u %8u %8u %8u %8u\n", name, h->count,
+    (usint)(h->total / h->count), lat_percentile(h, 50),
+    lat_percentile(h, 90), lat_percentile(h, 99), h->max);
+  }
+}
+
+/* End of elatency.c */
@@ -0,0 +1,518 @@
+/*************************************************
+*       The E text editor - 3rd incarnation      *
+*************************************************/
+
+/* Copyright (c) University of Cambridge, 1991 - 2021 */
+
+/* Written by Philip Hazel, starting November 1991 */
+/* This file last modified: October 2026 */
+
+
+/* This file contains the interface for using NE as a library; it is linked
+into libne.a but not into the ne command. The functions are described in
+libne.h.
+
+Each session is an NE buffer, so the per-buffer state (lines, current line,
+cursor, marks, undo journal, and so on) is switched by init_selectbuffer() as
+it is for the BUFFER command. The rest of the state that one editing job can
+leave behind for the next, including the options that commands such as
+CASEMATCH, WORD, KEY, and SET change, is saved in the session block when a call
+returns, and restored when the next call for the session starts. A new session
+starts with the options as they were after initialization. The caller's threads
+are serialized by a mutex, so sessions do not actually run concurrently. */
+
+
+#include "ehdr.h"
+#include "cmdhdr.h"
+#include "keyhdr.h"
+#include "libne.h"
+#include <pthread.h>
+
+/* The option settings. Latency, statistics, tracing, and store release are
+left out, because they apply to the whole process. */
+
+typedef struct {
+  BOOL       appendswitch;
+  BOOL       attn;
+  BOOL       autoalign;
+  BOOL       autosave;
+  BOOL       backupfiles;
+  BOOL       casematch;
+  BOOL       detrail;
+  BOOL       eightbit;
+  BOOL       overstrike;
+  BOOL       undo;
+  BOOL       verify;
+  BOOL       warnings;
+  int        ilinevalue;
+  int        oldcomment;
+  int        subchar;
+  int        vcursorscroll;
+  int        vmousescroll;
+  usint      backregionsize;
+  usint      undolimit;
+  uschar     ch_tab[256];
+  short int  key_table[s_f_umax+max_fkey+1];
+  uschar    *keystrings[max_keystring+1];
+} lib_options;
+
+struct ne_session {
+  bufferstr *buffer;            /* The session's buffer */
+  char      *messages;          /* Messages from the last command string */
+  size_t     msglen;            /* Their length */
+
+  sestr     *last_se;           /* Saved global state */
+  sestr     *last_abese;
+  sestr     *last_gse;
+  qsstr     *last_abent;
+  qsstr     *last_gnt;
+  linestr   *cut_buffer;
+  linestr   *cut_last;
+  int        cut_type;
+  BOOL       cut_pasted;
+  linestr   *mark_line_global;
+  usint      mark_col_global;
+  linestr   *main_undelete;
+  linestr   *main_lastundelete;
+  int        main_undeletecount;
+  sestr     *par_begin;
+  sestr     *par_end;
+  procstr   *proclist[proc_hashsize];
+  lib_options options;
+};
+
+static pthread_mutex_t lib_mutex = PTHREAD_MUTEX_INITIALIZER;
+static BOOL lib_initialized = FALSE;
+
+static lib_options lib_defaults;
+static int lib_rmargin;
+
+static uschar lib_cbuffer[CMD_BUFFER_SIZE];
+static uschar lib_nercbuffer[FNAME_BUFFER_SIZE];
+
+
+
+/*************************************************
+*         Save and restore the options           *
+*************************************************/
+
+/* The keystrings are copied by pointer; each session has its own copies, which
+KEY and FKEYSTRING free and replace as they do the global ones.
+
+Argument:   the block to save into
+Returns:    nothing
+*/
+
+static void
+lib_getoptions(lib_options *o)
+{
+o->appendswitch = main_appendswitch;
+o->attn = main_attn;
+o->autoalign = main_AutoAlign;
+o->autosave = main_autosave;
+o->backupfiles = main_backupfiles;
+o->casematch = cmd_casematch;
+o->detrail = main_detrail_output;
+o->eightbit = main_eightbit;
+o->overstrike = main_overstrike;
+o->undo = main_undo;
+o->verify = main_verify;
+o->warnings = main_warnings;
+o->ilinevalue = main_ilinevalue;
+o->oldcomment = main_oldcomment;
+o->subchar = screen_subchar;
+o->vcursorscroll = main_vcursorscroll;
+o->vmousescroll = main_vmousescroll;
+o->backregionsize = main_backregionsize;
+o->undolimit = main_undolimit;
+memcpy(o->ch_tab, ch_tab, sizeof(o->ch_tab));
+memcpy(o->key_table, key_table, sizeof(o->key_table));
+memcpy(o->keystrings, main_keystrings, sizeof(o->keystrings));
+}
+
+
+/* The compiled command cache is flushed if the word characters differ, as it
+is by the WORD command.
+
+Argument:   the block to restore from
+Returns:    nothing
+*/
+
+static void
+lib_setoptions(lib_options *o)
+{
+main_appendswitch = o->appendswitch;
+main_attn = o->attn;
+main_AutoAlign = o->autoalign;
+main_autosave = o->autosave;
+main_backupfiles = o->backupfiles;
+cmd_casematch = o->casematch;
+main_detrail_output = o->detrail;
+main_eightbit = o->eightbit;
+main_overstrike = o->overstrike;
+main_undo = o->undo;
+main_verify = o->verify;
+main_warnings = o->warnings;
+main_ilinevalue = o->ilinevalue;
+main_oldcomment = o->oldcomment;
+screen_subchar = o->subchar;
+main_vcursorscroll = o->vcursorscroll;
+main_vmousescroll = o->vmousescroll;
+main_backregionsize = o->backregionsize;
+main_undolimit = o->undolimit;
+if (memcmp(ch_tab, o->ch_tab, sizeof(o->ch_tab)) != 0)
+  {
+  memcpy(ch_tab, o->ch_tab, sizeof(o->ch_tab));
+  cmd_cacheflush();
+  }
+memcpy(key_table, o->key_table, sizeof(o->key_table));
+memcpy(main_keystrings, o->keystrings, sizeof(o->keystrings));
+undo_setstate(main_undo);
+}
+
+
+
+/*************************************************
+*         Switch to and from a session           *
+*************************************************/
+
+/* The session's buffer is selected, and its saved state is put back into the
+global variables.
+
+Argument:   the session
+Returns:    nothing
+*/
+
+static void
+lib_enter(ne_session *s)
+{
+if (currentbuffer != s->buffer) init_selectbuffer(s->buffer, FALSE);
+
+last_se = s->last_se;
+last_abese = s->last_abese;
+last_gse = s->last_gse;
+
+/* The sources of the saved searches are not kept, because another session may
+free a cached command whose store is then reused for a new search in this one,
+which would then not be copied. Forgetting them makes the next search command
+copy its argument. */
+
+last_se_source = last_abese_source = last_gse_source = NULL;
+
+last_abent = s->last_abent;
+last_gnt = s->last_gnt;
+cut_buffer = s->cut_buffer;
+cut_last = s->cut_last;
+cut_type = s->cut_type;
+cut_pasted = s->cut_pasted;
+mark_line_global = s->mark_line_global;
+mark_col_global = s->mark_col_global;
+main_undelete = s->main_undelete;
+main_lastundelete = s->main_lastundelete;
+main_undeletecount = s->main_undeletecount;
+par_begin = s->par_begin;
+par_end = s->par_end;
+memcpy(main_proclist, s->proclist, sizeof(s->proclist));
+lib_setoptions(&(s->options));
+
+main_rc = error_count = 0;
+}
+
+
+/* The global state is saved in the session.
+
+Argument:   the session
+Returns:    nothing
+*/
+
+static void
+lib_leave(ne_session *s)
+{
+s->last_se = last_se;
+s->last_abese = last_abese;
+s->last_gse = last_gse;
+s->last_abent = last_abent;
+s->last_gnt = last_gnt;
+s->cut_buffer = cut_buffer;
+s->cut_last = cut_last;
+s->cut_type = cut_type;
+s->cut_pasted = cut_pasted;
+s->mark_line_global = mark_line_global;
+s->mark_col_global = mark_col_global;
+s->main_undelete = main_undelete;
+s->main_lastundelete = main_lastundelete;
+s->main_undeletecount = main_undeletecount;
+s->par_begin = par_begin;
+s->par_end = par_end;
+memcpy(s->proclist, main_proclist, sizeof(s->proclist));
+lib_getoptions(&(s->options));
+}
+
+
+
+/*************************************************
+*           Free a chain of lines                *
+*************************************************/
+
+static void
+lib_freelines(linestr *line)
+{
+while (line != NULL)
+  {
+  linestr *next = line->next;
+  store_free(line->text);
+  store_freelbuff(line);
+  line = next;
+  }
+}
+
+
+
+/*************************************************
+*              Initialize                        *
+*************************************************/
+
+/* This may be called more than once; only the first call does anything. The
+initial buffer is not used by any session. The options are remembered as the
+defaults for new sessions.
+
+Arguments:   none
+Returns:     0 on success, -1 on failure
+*/
+
+int
+ne_init(void)
+{
+int yield = 0;
+pthread_mutex_lock(&lib_mutex);
+if (!lib_initialized)
+  {
+  init_library(lib_cbuffer, lib_nercbuffer);
+  if (init_init(NULL, NULL, NULL))
+    {
+    main_initialized = lib_initialized = TRUE;
+    lib_getoptions(&lib_defaults);
+    lib_rmargin = main_rmargin;
+    }
+  else yield = -1;
+  }
+pthread_mutex_unlock(&lib_mutex);
+return yield;
+}
+
+
+
+/*************************************************
+*              Create a session                  *
+*************************************************/
+
+/* The text is read as if it were a file, so the tab and binary options apply.
+
+Arguments:
+  text         the initial text
+  len          its length
+
+Returns:       the session, or NULL on failure
+*/
+
+ne_session *
+ne_open(const char *text, size_t len)
+{
+ne_session *s;
+bufferstr *buffer;
+FILE *f = NULL;
+int i;
+
+if (!lib_initialized) return NULL;
+if (len > 0 && (f = fmemopen((void *)text, len, "r")) == NULL) return NULL;
+
+pthread_mutex_lock(&lib_mutex);
+
+s = store_Xget(sizeof(ne_session));
+memset(s, 0, sizeof(ne_session));
+s->cut_pasted = TRUE;
+s->options = lib_defaults;
+for (i = 0; i <= max_keystring; i++)
+  s->options.keystrings[i] = store_copystring(lib_defaults.keystrings[i]);
+
+buffer = store_Xget(sizeof(bufferstr));
+while (cmd_findbuffer(main_nextbufferno++) != NULL);
+init_buffer(buffer, main_nextbufferno - 1, NULL, NULL, f, lib_rmargin,
+  FALSE);
+buffer->noprompt = TRUE;
+buffer->next = main_bufferchain;
+main_bufferchain = buffer;
+cmd_indexbuffer(buffer);
+s->buffer = buffer;
+
+pthread_mutex_unlock(&lib_mutex);
+return s;
+}
+
+
+
+/*************************************************
+*            Obey a command string               *
+*************************************************/
+
+/* The lines are obeyed in the same way as those of a C command file, so that
+commands such as IF can continue onto following lines. Messages are collected
+in the session.
+
+Arguments:
+  s            the session
+  commands     the command lines
+
+Returns:       0 if all was well, otherwise NE's return code
+*/
+
+int
+ne_command(ne_session *s, const char *commands)
+{
+size_t len = strlen(commands);
+int yield = done_continue;
+int rc;
+FILE *mf;
+
+pthread_mutex_lock(&lib_mutex);
+lib_enter(s);
+
+free(s->messages);
+s->messages = NULL;
+s->msglen = 0;
+mf = open_memstream(&(s->messages), &(s->msglen));
+msgs_fid = (mf == NULL)? stderr : mf;
+
+cmdin_fid = (len == 0)? NULL : fmemopen((void *)commands, len, "r");
+cmd_cbufferline = NULL;
+cmd_clineno = 0;
+
+while (cmdin_fid != NULL && yield == done_continue)
+  {
+  int n;
+  if (Ufgets(cmd_buffer, CMD_BUFFER_SIZE, cmdin_fid) == NULL) break;
+  cmd_clineno++;
+  n = Ustrlen(cmd_buffer);
+  if (n > 0 && cmd_buffer[n-1] == '\n') cmd_buffer[n-1] = 0;
+  yield = cmd_obey(cmd_buffer);
+  if (yield == done_wait || yield == done_break || yield == done_loop)
+    yield = done_continue;
+  }
+
+if (cmdin_fid != NULL) fclose(cmdin_fid);
+cmdin_fid = NULL;
+main_done = FALSE;
+
+error_printflush();
+msgs_fid = stderr;
+if (mf != NULL) fclose(mf);
+
+rc = main_rc;
+lib_leave(s);
+pthread_mutex_unlock(&lib_mutex);
+return rc;
+}
+
+
+
+/*************************************************
+*          Get the messages and text             *
+*************************************************/
+
+const char *
+ne_messages(ne_session *s, size_t *lenptr)
+{
+if (lenptr != NULL) *lenptr = s->msglen;
+return (s->messages == NULL)? "" : s->messages;
+}
+
+
+/* The lines are written as they would be to a file.
+
+Arguments:
+  s            the session
+  lenptr       where to put the length, or NULL
+
+Returns:       the text, which must be freed by the caller; NULL on failure
+*/
+
+char *
+ne_text(ne_session *s, size_t *lenptr)
+{
+char *text = NULL;
+size_t len = 0;
+FILE *f;
+
+pthread_mutex_lock(&lib_mutex);
+lib_enter(s);
+
+f = open_memstream(&text, &len);
+if (f != NULL)
+  {
+  linestr *line;
+  for (line = main_top; (line->flags & lf_eof) == 0; line = line->next)
+    if (file_writeline(line, f) < 0) break;
+  fclose(f);
+  }
+
+lib_leave(s);
+pthread_mutex_unlock(&lib_mutex);
+
+if (lenptr != NULL) *lenptr = len;
+return text;
+}
+
+
+
+/*************************************************
+*              Discard a session                 *
+*************************************************/
+
+void
+ne_close(ne_session *s)
+{
+int i;
+
+pthread_mutex_lock(&lib_mutex);
+lib_enter(s);
+
+if (last_se != NULL) cmd_freeblock((cmdblock *)last_se);
+if (last_abese != NULL) cmd_freeblock((cmdblock *)last_abese);
+if (last_gse != NULL) cmd_freeblock((cmdblock *)last_gse);
+if (last_abent != NULL) cmd_freeblock((cmdblock *)last_abent);
+if (last_gnt != NULL) cmd_freeblock((cmdblock *)last_gnt);
+if (par_begin != NULL) cmd_freeblock((cmdblock *)par_begin);
+if (par_end != NULL) cmd_freeblock((cmdblock *)par_end);
+last_se = last_abese = last_gse = NULL;
+last_se_source = last_abese_source = last_gse_source = NULL;
+last_abent = last_gnt = NULL;
+
+lib_freelines(cut_buffer);
+lib_freelines(main_undelete);
+cut_buffer = cut_last = main_undelete = main_lastundelete = NULL;
+main_undeletecount = 0;
+mark_line_global = NULL;
+par_begin = par_end = NULL;
+
+for (i = 0; i < proc_hashsize; i++)
+  {
+  while (main_proclist[i] != NULL)
+    {
+    procstr *p = main_proclist[i];
+    main_proclist[i] = p->next;
+    cmd_freeblock((cmdblock *)p);
+    }
+  }
+
+for (i = 0; i <= max_keystring; i++)
+  if (main_keystrings[i] != NULL) store_free(main_keystrings[i]);
+lib_setoptions(&lib_defaults);
+
+(void)setup_dbuffer(s->buffer);
+free(s->messages);
+store_free(s);
+
+pthread_mutex_unlock(&lib_mutex);
+}
+
+/* End of elib.c */
@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2018 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: August 2018 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains code for making changes to individual lines */
@@ -62,6 +62,7 @@ line_offset(linestr *line, int col)
 {
 uschar *p = line->text;
 uschar *pe = p + line->len;
+if (!allow_wide) return col;     /* Bytes and characters are the same */
 while (col > 0 && p < pe)
   {
   SKIPCHAR(p, pe);
@@ -90,6 +91,7 @@ line_charcount(uschar *ptr, usint len)
 {
 int yield = 0;
 uschar *pe = ptr + len;
+if (!allow_wide) return len;
 while (ptr < pe)
   {
   SKIPCHAR(ptr, pe);
@@ -117,6 +119,7 @@ int
 line_bytecount(uschar *ptr, int len)
 {
 uschar *ps = ptr;
+if (!allow_wide) return (len > 0)? len : 0;
 while (len-- > 0) SKIPCHAR(ptr, ptr + 10);
 return ptr - ps;
 }
@@ -148,17 +151,59 @@ return (up == NULL)? -1 : count;
 *             Make a copy of a line              *
 *************************************************/
 
+/* The text is shared with the original line; functions that alter a line's
+text in place must call store_unshare() first. */
+
 linestr *line_copy(linestr *line)
 {
-linestr *nline = store_getlbuff(line->len);
+linestr *nline = store_getlbuff(0);
 nline->key = line->key;
-nline->flags = line->flags;
-if (line->len > 0) memcpy(nline->text, line->text, line->len);
+nline->flags = line->flags & ~lf_back;
+nline->text = store_share(line->text);
+nline->len = line->len;
 return nline;
 }
 
 
 
+/*************************************************
+*        Make room at the end of a line          *
+*************************************************/
+
+/* This ensures that the store for a line's text has room for at least the
+given number of bytes after its current length. If it has to be replaced, the
+new store is at least twice the length of the line, so that a sequence of
+appends to one line takes time proportional to its final length. A shared text
+is always replaced. The length of the line is not changed.
+
+Arguments:
+  line       the line
+  extra      the number of bytes required
+
+Returns:     a pointer to the end of the line's text
+*/
+
+uschar *
+line_reserve(linestr *line, usint extra)
+{
+usint needed = line->len + extra;
+
+if (store_shared(line->text) || store_size(line->text) < needed)
+  {
+  usint size = 2*line->len;
+  uschar *newtext;
+  if (size < needed) size = needed;
+  newtext = store_Xget(size);
+  if (line->len > 0) memcpy(newtext, line->text, line->len);
+  store_free(line->text);
+  line->text = newtext;
+  }
+
+return line->text + line->len;
+}
+
+
+
 /*************************************************
 *           Insert bytes into a line             *
 *************************************************/
@@ -206,36 +251,61 @@ else              /* Byte offset given */
 
 extra = (bcol > oldlen)? bcol - oldlen : 0;
 newlen = oldlen + extra + count + padcount;
-newtext = store_Xget(newlen);
-np = newtext;
 
 leftcount = (extra == 0)? bcol : oldlen;
 if (oldlen >= bcol) rightcount = oldlen - bcol;
   else rightcount = 0;
 
-memcpy(np, line->text, leftcount);
-np += leftcount;
+if (undo_recording) undo_text(line, leftcount, 0, newlen - oldlen);
+
+/* If the line's store is not shared and already has room, which is often the
+case when a global change is replacing one string by another, the insertion is
+done in place, provided the inserted bytes are not in the line itself. This
+saves getting and freeing store for each changed line. */
+
+if (line->text != NULL && !store_shared(line->text) &&
+    store_size(line->text) >= newlen &&
+    (ptr < line->text || ptr >= line->text + oldlen))
+  {
+  newtext = line->text;
+  memmove(newtext + newlen - rightcount, newtext + bcol, rightcount);
+  np = newtext + leftcount;
+  rightcount = 0;
+  }
+else
+  {
+  newtext = store_Xget(newlen);
+  memcpy(newtext, line->text, leftcount);
+  np = newtext + leftcount;
+  }
+
 for (i = 0; i < extra; i++) *np++ = ' ';
 memcpy(np, ptr, count);
 np += count;
 for (i = 0; i < padcount; i++) *np++ = ' ';
 memcpy(np, line->text + bcol, rightcount);
 
-if (line->text != NULL) store_free(line->text);
-line->text = newtext;
+if (newtext != line->text)
+  {
+  if (line->text != NULL) store_free(line->text);
+  line->text = newtext;
+  }
 line->len = newlen;
+if (undo_recording) undo_textdone(line);
 
 /* If we have added data to the end-of-file line, make a new, null eof line and
 add it on the end. */
 
 if ((line->flags & lf_eof) != 0)
   {
+  if (undo_recording) undo_attr(line);
   main_bottom = store_getlbuff(0);
   line->next = main_bottom;
   main_bottom->prev = line;
   line->flags &= ~lf_eof;
   main_bottom->flags |= lf_eof + lf_shn;
   main_linecount++;
+  if (undo_recording) undo_insert(main_bottom, main_bottom, 1);
 
   if (extra == 0)
     {
@@ -319,6 +389,9 @@ else
 
 backcol = col;
 
+/* The text is altered in place, so it must not be shared with another line. */
+
+line->text = store_unshare(line->text);
 a = b = line->text + bcol;
 z = line->text + line->len;
 
@@ -363,7 +436,7 @@ if (main_undelete == NULL || (main_undelete->flags & lf_udch) == 0 ||
     if (prev == NULL) break;   /* Should not occur */
     prev->next = NULL;
     store_free(main_lastundelete->text);
-    store_free(main_lastundelete);
+    store_freelbuff(main_lastundelete);
     main_lastundelete = prev;
     main_undeletecount--;
     }
@@ -401,6 +474,7 @@ main_undelete->len = t - main_undelete->text;
 /* Close up the line, adjust its length, mark it changed, and sort out the mark
 positions if necessary. */
 
+if (undo_recording) undo_text(line, a - line->text, b - a, 0);
 line->len -= b - a;
 memmove(a, b, z - b);
 
@@ -469,21 +543,108 @@ line_deletepart(line, -1, -1, offset, count, forwardsflag);
 
 
 
+/*************************************************
+*          Trim the undelete list                *
+*************************************************/
+
+/* Only max_undelete lines are kept; the oldest are at the end of the list. */
+
+static void
+line_trimundelete(void)
+{
+while (main_undeletecount > max_undelete)
+  {
+  linestr *prev = main_lastundelete->prev;
+  if (prev == NULL) break;   /* Should not occur */
+  prev->next = NULL;
+  store_free(main_lastundelete->text);
+  store_freelbuff(main_lastundelete);
+  main_lastundelete = prev;
+  main_undeletecount--;
+  }
+}
+
+
+
+/*************************************************
+*    Remove references to a deleted line         *
+*************************************************/
+
+/* A line that is being deleted must be removed from the back list, and marks
+on it move to the following line. If the line's store is about to be freed and
+we are in screen mode, ensure that the table of lines that are currently
+displayed does not contain it. This is necessary because a new line could be
+read before re-display happens, and it might re-use the same block of store,
+leading to confusion. We can't set the value to NULL, as that implies the
+screen line is blank. Use (+1) and assume that will never be a valid line
+address...
+
+Arguments:
+  line       the line that is being deleted
+  nextline   the line that will follow the deletion
+  freeing    TRUE if the line's store is to be freed
+
+Returns:     nothing
+*/
+
+void
+line_forget(linestr *line, linestr *nextline, BOOL freeing)
+{
+usint i;
+
+if (freeing && main_screenOK)
+  {
+  for (i = 0; i <= window_depth; i++)
+    if (window_vector[i] == line) window_vector[i] = (linestr *)(+1);
+  }
+
+cmd_forgetback(line);
+
+if (mark_line == line)
+  {
+  mark_line = nextline;
+  mark_col = 0;
+  nextline->flags |= lf_shn;
+  }
+
+if (mark_line_global == line)
+  {
+  mark_line_global = nextline;
+  mark_col_global = 0;
+  nextline->flags |= lf_shn;
+  }
+}
+
+
+
 /*************************************************
 *              Delete line                       *
 *************************************************/
 
+/* When changes are being kept for undo, the line itself goes to the undo
+journal, and a copy goes on the undelete list. */
+
 linestr *line_delete(linestr *line, BOOL undelete)
 {
-usint i;
 linestr *prevline = line->prev;
 linestr *nextline = line->next;
+BOOL journalled = undo_keeping;
 
 nextline->prev = prevline;
 if (prevline == NULL) main_top = nextline; else prevline->next = nextline;
 
+line_forget(line, nextline, !undelete || journalled);
+
+if (journalled)
+  {
+  linestr *copy = undelete? line_copy(line) : NULL;
+  undo_delete(line, line, 1);
+  line = copy;
+  }
+else if (undo_recording) undo_delete(line, line, 1);
+
 /* If required, add the line to the deleted list, ensuring that there are
-only so many lines on the list. */
+only so many lines on the list. Otherwise free the line's store. */
 
 if (undelete)
   {
@@ -493,76 +654,187 @@ if (undelete)
     else main_undelete->prev = line;
   main_undelete = line;
   main_undeletecount++;
-  while (main_undeletecount > max_undelete)
-    {
-    linestr *prev = main_lastundelete->prev;
-    if (prev == NULL) break;   /* Should not occur */
-    prev->next = NULL;
-    store_free(main_lastundelete->text);
-    store_free(main_lastundelete);
-    main_lastundelete = prev;
-    main_undeletecount--;
-    }
+  line_trimundelete();
   }
 
-/* Otherwise free the line's store. If we are in screen mode, ensure that the
-table of lines that are currently displayed does not contain the line we are
-about to throw away. This is necessary because a new line could be read before
-re-display happens, and it might re-use the same block of store, leading to
-confusion. We can't set the value to NULL, as that implies the screen line is
-blank. Use (+1) and assume that will never be a valid line address... */
-
-else
+else if (!journalled)
   {
-  if (main_screenOK)
-    {
-    for (i = 0; i <= window_depth; i++)
-      if (window_vector[i] == line) window_vector[i] = (linestr *)(+1);
-    }
-
   store_free(line->text);
-  store_free(line);
+  store_freelbuff(line);
   }
 
-/* Remove deleted lines from the back list. There is only ever one instance of
-a line on the list. */
+cmd_recordchanged(nextline, 0);
+main_linecount--;
+return nextline;
+}
+
+
+
+/*************************************************
+*        Compare line addresses for sorting      *
+*************************************************/
+
+static int
+line_ptrcmp(const void *a, const void *b)
+{
+uintptr_t x = (uintptr_t)(*(linestr * const *)a);
+uintptr_t y = (uintptr_t)(*(linestr * const *)b);
+return (x < y)? -1 : (x > y)? 1 : 0;
+}
+
+
+
+
+/*************************************************
+*            Delete a range of lines             *
+*************************************************/
+
+/* This has the same effect as calling line_delete() for each line from first
+to last in turn, except that the back list gets just one new entry, for the
+line that follows the range. The range is unlinked in one step, and the lines
+are then either freed or put on the undelete list; only the last max_undelete
+lines can survive on that list, so any before those are freed at once.
+
+The text of lines that are not kept is freed in batches, each of which is
+merged into the free queue in one pass. When changes are being kept for undo,
+the whole range goes to the undo journal instead, and the undelete list gets
+copies.
+
+The addresses of lines that are on the screen, on the back list, or marked are
+collected into a sorted vector, so that each line in the range can be checked
+against them with a binary search instead of scanning every table for every
+line. Only lines that are found need any further attention.
 
+Arguments:
+  first      the first line to delete
+  last       the last line to delete; neither this nor first may be eof
+  undelete   TRUE if the lines are to be put on the undelete list
+
+Returns:     the line following the deleted range
+*/
+
+#define FREEBATCH 4096
+
+linestr *
+line_deleterange(linestr *first, linestr *last, BOOL undelete)
+{
+usint i;
+usint wcount = 0;
+usint count = 0;
+usint kept = 0;
+usint freecount = 0;
+BOOL freeing;
+BOOL journalled = undo_keeping;
+linestr *prevline = first->prev;
+linestr *nextline = last->next;
+linestr *keep = NULL;
+linestr *line;
+linestr **watch;
+void *freed[FREEBATCH];
+
+if (first == last) return line_delete(first, undelete);
+
+/* Unlink the whole range */
+
+nextline->prev = prevline;
+if (prevline == NULL) main_top = nextline; else prevline->next = nextline;
+if (undo_recording && !journalled) undo_delete(first, last, 0);
+
+/* Build the sorted vector of interesting lines */
+
+watch = store_Xget((window_depth + back_size + 3) * sizeof(linestr *));
+if (main_screenOK)
+  {
+  for (i = 0; i <= window_depth; i++)
+    if ((intptr_t)(window_vector[i]) > 1) watch[wcount++] = window_vector[i];
+  }
 for (i = 0; i <= main_backtop; i++)
+  if (main_backlist[i].line != NULL) watch[wcount++] = main_backlist[i].line;
+if (mark_line != NULL) watch[wcount++] = mark_line;
+if (mark_line_global != NULL) watch[wcount++] = mark_line_global;
+qsort(watch, wcount, sizeof(linestr *), line_ptrcmp);
+
+/* If saving for undelete, find the first line that will survive on the
+undelete list. */
+
+if (undelete)
+  {
+  keep = last;
+  for (i = 1; i < max_undelete && keep != first; i++) keep = keep->prev;
+  }
+
+/* Scan the range. Lines before "keep" are freed; the others have their
+pointers swapped so that they can be put at the head of the undelete list in
+reverse order, as if they had been deleted one at a time. */
+
+freeing = (keep != first);
+line = first;
+for (;;)
   {
-  if (main_backlist[i].line == line)
+  linestr *next = line->next;
+  BOOL done = (line == last);
+
+  if (line == keep) freeing = FALSE;
+  if (wcount > 0 &&
+      bsearch(&line, watch, wcount, sizeof(linestr *), line_ptrcmp) != NULL)
+    line_forget(line, nextline, freeing || journalled);
+
+  if (journalled)
     {
-    if (main_backtop == 0)
+    if (!freeing)
       {
-      main_backlist[0].line = NULL;
+      linestr *copy = line_copy(line);
+      copy->next = main_undelete;
+      if (main_lastundelete == NULL) main_lastundelete = copy;
+        else main_undelete->prev = copy;
+      main_undelete = copy;
+      main_undeletecount++;
       }
-    else
+    }
+  else if (freeing)
+    {
+    if (freecount >= FREEBATCH)
       {
-      memmove(main_backlist + i, main_backlist + i + 1,
-        (main_backtop - i) * sizeof(backstr));
-      if (main_backnext == main_backtop) main_backnext--;
-      main_backtop--;
+      store_freevector(freed, freecount);
+      freecount = 0;
       }
-    break;
+    freed[freecount++] = line->text;
+    store_freelbuff(line);
+    }
+  else
+    {
+    line->next = line->prev;
+    line->prev = next;
+    kept++;
     }
+
+  count++;
+  if (done) break;
+  line = next;
   }
 
-cmd_recordchanged(nextline, 0);
+store_freevector(freed, freecount);
 
-if (mark_line == line)
+if (journalled)
   {
-  mark_line = nextline;
-  mark_col = 0;
-  nextline->flags |= lf_shn;
+  line_trimundelete();
+  undo_delete(first, last, count);
   }
 
-if (mark_line_global == line)
+else if (keep != NULL)
   {
-  mark_line_global = nextline;
-  mark_col_global = 0;
-  nextline->flags |= lf_shn;
+  keep->next = main_undelete;
+  if (main_lastundelete == NULL) main_lastundelete = keep;
+    else main_undelete->prev = keep;
+  last->prev = NULL;
+  main_undelete = last;
+  main_undeletecount += kept;
+  line_trimundelete();
   }
 
-main_linecount--;
+store_free(watch);
+cmd_recordchanged(nextline, 0);
+main_linecount -= count;
 return nextline;
 }
 
@@ -694,6 +966,12 @@ if ((line->flags & lf_eof) != 0)
   if (col != cursor_offset) splitline->flags |= lf_shn;
   }
 
+if (undo_recording)
+  {
+  undo_split(line, splitline);
+  undo_insert(splitline, splitline, 1);
+  }
+
 cmd_recordchanged(splitline, 0);
 
 main_linecount++;
@@ -706,35 +984,45 @@ return splitline;
 *       Concatenate line with previous           *
 *************************************************/
 
-/* The existence of a previous line has already been checked.
+/* The existence of a previous line has already been checked. The caller may
+supply the length of the previous line in characters, if it is known, to save
+counting it; otherwise the backcol argument is negative.
 
 Arguments:
   line        the second of the two lines
   padcount    count of spaces to insert between the lines
+  backcol     the character length of the previous line, or -1
 
 Returns:      the combined line
 */
 
 linestr *
-line_concat(linestr *line, int padcount)
+line_join(linestr *line, int padcount, int backcol)
 {
 linestr *prev = line->prev;
 int newlen = line->len + prev->len + padcount;
-int backcol = line_charcount(prev->text, prev->len);
-uschar *newtext = store_Xget(newlen);
 uschar *p;
 
+if (backcol < 0) backcol = line_charcount(prev->text, prev->len);
+
 if (mark_line == line) mark_col += backcol + padcount;
 if (mark_line_global == line) mark_col_global += backcol + padcount;
+if (undo_recording) undo_join(line, prev, padcount);
+
+/* The second line's text is appended to the first line's text, which is then
+moved to the second line. When the same line is extended repeatedly (CL with a
+count, for example) there is usually room already, so the growing text is not
+copied each time. */
 
-if (prev->len > 0) memcpy(newtext, prev->text, prev->len);
-for (p = newtext + prev->len; p < newtext + prev->len + padcount; p++) *p = ' ';
-if (line->len > 0)
-  memcpy(newtext + prev->len + padcount, line->text, line->len);
+p = line_reserve(prev, line->len + padcount);
+memset(p, ' ', padcount);
+if (line->len > 0) memcpy(p + padcount, line->text, line->len);
 
 store_free(line->text);
-line->text = newtext;
+line->text = prev->text;
 line->len = newlen;
+prev->text = NULL;
+prev->len = 0;
 line->key = prev->key;
 line->flags |= lf_shn;
 
@@ -743,6 +1031,12 @@ cmd_recordchanged(line, backcol);
 return line;
 }
 
+linestr *
+line_concat(linestr *line, int padcount)
+{
+return line_join(line, padcount, -1);
+}
+
 
 
 /*************************************************
@@ -789,6 +1083,20 @@ for (n = 1, i = 0; i < n; i++)
   while (p < pe)
     {
     usint c, m;
+    uschar cc;
+
+    /* In the first pass, runs of displayable ASCII characters, which are the
+    same in UTF-8, are output as they stand. */
+
+    if (i == 0)
+      {
+      uschar *q = p;
+      while (p < pe && *p < 127 && (ch_displayable[*p/8] & (1<<(*p%8))) == 0)
+        p++;
+      if (p > q) error_write(q, p - q);
+      if (p >= pe) break;
+      }
+
     GETCHARINC(c, p, pe);    /* If allow_wide, may be > 256 */
 
     /* Handle displayable characters < 256; show those that are greater than
@@ -799,7 +1107,7 @@ for (n = 1, i = 0; i < n; i++)
       {
       if (c < 127)
         {
-        error_printf("%c", (i == 0)? c : ' ');
+        error_write(US" ", 1);
         continue;
         }
       else if (main_interactive)
@@ -810,14 +1118,15 @@ for (n = 1, i = 0; i < n; i++)
             {
             uschar buff[8];
             int len = ord2utf8(c, buff);
-            error_printf("%.*s", len,  CS buff);
+            error_write(buff, len);
             }
-          else error_printf(" ");
+          else error_write(US" ", 1);
           continue;
           }
         else if (main_eightbit)
           {
-          error_printf("%c", (i == 0)? c : ' ');
+          cc = (i == 0)? c : ' ';
+          error_write(&cc, 1);
           continue;
           }
         }
@@ -837,20 +1146,21 @@ for (n = 1, i = 0; i < n; i++)
 
     if (i == 0 && n < m) n = m;
 
-    if (i < m) error_printf("%x", (c >> (4*(m - i - 1))) & 15);
-      else error_printf(" ");
+    error_write((i < m)? US"0123456789abcdef" + ((c >> (4*(m - i - 1))) & 15) :
+      US" ", 1);
     }
 
-  error_printf("\n");
+  error_write(US"\n", 1);
   }
 
 if (showcursor && cursor_col > 0)
   {
-  for (i = 1; i < cursor_col; i++) error_printf(" ");
-  error_printf(">");
+  for (i = 1; i < cursor_col; i++) error_write(US" ", 1);
+  error_write(US">", 1);
+  error_printflush();
   main_verified_ptr = TRUE;
   }
-error_printflush();
+else error_printflush();
 }
 
 
@@ -939,15 +1249,125 @@ return FALSE;
 }
 
 
+/* While a paragraph is being formatted, the text of the line that is being
+built is kept in a buffer that grows at the end as following lines are joined
+on, and from whose start finished lines are copied out. Its length in
+characters is maintained as text is added and removed, so that a long line is
+never re-scanned. */
+
+typedef struct {
+  uschar *text;      /* The store */
+  usint  size;       /* Its size */
+  usint  start;      /* Offset of the start of the current line */
+  usint  end;        /* Offset of its end */
+  usint  chars;      /* Its length in characters */
+} fmtbuffer;
+
+/* Add text to the end of the current line, preceded by some spaces. When the
+buffer is full, the current line is moved to the start of it if that frees
+enough space; otherwise a buffer twice the required size is obtained. */
+
+static void fmt_append(fmtbuffer *fb, uschar *s, usint len, usint padcount)
+{
+usint used = fb->end - fb->start;
+usint needed = used + padcount + len;
+
+if (fb->end + padcount + len > fb->size)
+  {
+  if (2*needed <= fb->size)
+    memmove(fb->text, fb->text + fb->start, used);
+  else
+    {
+    uschar *newtext = store_Xget(2*needed);
+    if (used > 0) memcpy(newtext, fb->text + fb->start, used);
+    store_free(fb->text);
+    fb->text = newtext;
+    fb->size = 2*needed;
+    }
+  fb->start = 0;
+  fb->end = used;
+  }
+
+memset(fb->text + fb->end, ' ', padcount);
+if (len > 0) memcpy(fb->text + fb->end + padcount, s, len);
+fb->end += padcount + len;
+fb->chars += padcount + line_charcount(s, len);
+}
+
+/* Put text, followed by some spaces, at the start of the current line. This
+normally fits in the space that the previous line occupied. */
+
+static void fmt_prepend(fmtbuffer *fb, uschar *s, usint len, usint padcount)
+{
+usint used = fb->end - fb->start;
+
+if (fb->start < len + padcount)
+  {
+  usint size = 2*(used + len + padcount);
+  uschar *newtext = store_Xget(size);
+  if (used > 0) memcpy(newtext + len + padcount, fb->text + fb->start, used);
+  store_free(fb->text);
+  fb->text = newtext;
+  fb->size = size;
+  fb->start = len + padcount;
+  fb->end = fb->start + used;
+  }
+
+fb->start -= len + padcount;
+if (len > 0) memcpy(fb->text + fb->start, s, len);
+memset(fb->text + fb->start + len, ' ', padcount);
+fb->chars += padcount + line_charcount(s, len);
+}
+
+/* Remove trailing spaces from the current line */
+
+static void fmt_detrail(fmtbuffer *fb)
+{
+while (fb->end > fb->start && fb->text[fb->end - 1] == ' ')
+  {
+  fb->end--;
+  fb->chars--;
+  }
+}
+
+/* Put a finished line of a paragraph into the buffer, using the next of the
+lines that have already been absorbed if there is one, or a new line before
+the first line that has not. */
+
+static linestr *fmt_output(linestr *line, linestr *nextline, uschar *s,
+  usint len)
+{
+if (line == nextline)
+  {
+  line = store_getlbuff(0);
+  line->prev = nextline->prev;
+  line->next = nextline;
+  nextline->prev->next = line;
+  nextline->prev = line;
+  main_linecount++;
+  if (undo_recording) undo_insert(line, line, 1);
+  }
+
+if (undo_recording) undo_text(line, 0, line->len, len);
+store_free(line->text);
+line->text = (len == 0)? NULL : store_Xget(len);
+if (len > 0) memcpy(line->text, s, len);
+line->len = len;
+if (undo_recording) undo_textdone(line);
+line->flags |= lf_shn;
+cmd_recordchanged(line, 0);
+return line;
+}
+
 /* Functions for helping decide whether to concatenate lines. The first
 computes the number of character spaces left, where width is the splitting
 character column. The returned value allows for one space to be inserted at the
 join. */
 
-static usint spaceleft(linestr *line, usint width)
+static usint spaceleft(fmtbuffer *fb, usint width)
 {
-usint yield = width - line_charcount(line->text, line->len);
-if (line->len > 0 && line->text[line->len-1] != ' ') yield--;
+usint yield = width - fb->chars;
+if (fb->end > fb->start && fb->text[fb->end - 1] != ' ') yield--;
 return yield;
 }
 
@@ -967,17 +1387,6 @@ while (p < pe)
 return n;
 }
 
-/* Function to remove trailing spaces in a line */
-
-static void detrail(linestr *line)
-{
-int i;
-uschar *p = line->text;
-for (i = line->len - 1; i >= 0; i--) if (p[i] != ' ') break;
-line->len = i + 1;
-store_chop(line->text, line->len);
-}
-
 
 
 /*************************************************
@@ -1019,6 +1428,7 @@ if (!copyflag)
     {
     if (bleft < line->len)
       {
+      if (undo_recording) undo_text(line, bleft, line->len - bleft, 0);
       line->len = bleft;
       line->flags |= lf_clend;
       cmd_recordchanged(line, left);
@@ -1061,6 +1471,9 @@ usint width = main_rmargin;
 usint len;
 BOOL one_line_para;
 linestr *nextline = main_current->next;
+linestr *reuse = main_current;
+uschar *prefix;
+fmtbuffer fb;
 
 /* If unformatting, set the width "infinite"; otherwise, if margin is disabled,
 use the remembered value */
@@ -1164,15 +1577,31 @@ if (!one_line_para)
     }
   }
 
+/* The paragraph is formatted in a single pass. Lines that are joined on are
+appended to the buffer, and lines that are split off are copied out of it. The
+lines of the paragraph are re-used in order for the output; extra ones are
+created if needed, and any left over are deleted at the end. A line that is
+split off and that is followed by more of the paragraph starts with the
+following line's indent and tag; otherwise it gets them from the prefix. */
+
+prefix = store_Xget(minlen + indent2 + 1);
+memset(prefix, ' ', indent);
+memcpy(prefix + indent, leftbuf, leftbuflen);
+memset(prefix + minlen, ' ', indent2);
+
+fb.text = NULL;
+fb.size = fb.start = fb.end = fb.chars = 0;
+fmt_append(&fb, main_current->text, main_current->len, 0);
+
 /* Start of main loop - exit by return. */
 
 for (;;)
   {
-  detrail(main_current);
+  fmt_detrail(&fb);
 
   /* Loop until current line is short enough, counting characters, not bytes. */
 
-  while(line_charcount(main_current->text, main_current->len) > width)
+  while (fb.chars > width)
     {
     BOOL ended;
     BOOL gotspace;
@@ -1181,12 +1610,12 @@ for (;;)
     usint jchar;
     usint jbyte;
     usint widthoffset;
+    uschar *t = fb.text + fb.start;
 
-    cmd_recordchanged(main_current, 0);
-    p = main_current->text;
-    q = main_current->text + main_current->len;
+    p = t;
+    q = fb.text + fb.end;
     for (ichar = 0; ichar < width; ichar++) SKIPCHAR(p, q);
-    widthoffset = p - main_current->text;
+    widthoffset = p - t;
 
     /* We now have ichar at the maximum width character offset and p pointing
     after the last possible character that can be on this line. We want to
@@ -1203,7 +1632,7 @@ for (;;)
         gotspace = TRUE;
         break;
         }
-      BACKCHAR(p, main_current->text);
+      BACKCHAR(p, t);
       if (ichar == minlen) break;
       ichar--;
       }
@@ -1220,14 +1649,14 @@ for (;;)
     else
       {
       uschar *pj;
-      ibyte = p - main_current->text;
+      ibyte = p - t;
       jbyte = ibyte + 1;
       jchar = ichar + 1;
 
       /* Advance j.. to pass over any spaces */
 
       pj = p + 1;
-      while (jbyte < main_current->len)
+      while (jbyte < fb.end - fb.start)
         {
         if (*pj++ == ' ')
           {
@@ -1246,62 +1675,36 @@ for (;;)
         }
       }
 
-    /* If next is paragraph end, make a new part line and make it the current
-    line. */
+    /* Output the line that has been split off, and remove it and the spaces
+    that follow it from the buffer. */
 
     ended = parend(nextline, indent, indent2, leftbuf, leftbuflen);
+    reuse = fmt_output(reuse, nextline, t, ibyte)->next;
+    fb.start += jbyte;
+    fb.chars -= jchar;
 
-    /* The next line is not to be included in this paragraph. So what we split
-    off this line must become a new line on its own. */
-
-    if (ended)
-      {
-      linestr *extra = line_cutpart(main_current, jchar,
-        line_charcount(main_current->text, main_current->len), FALSE);
-      main_current->len -= jbyte - ibyte;
-      if (main_current->len == widthoffset) main_current->flags |= lf_shn;
-      main_current->next = extra;
-      extra->next = nextline;
-      nextline->prev = extra;
-      extra->prev = main_current;
-      main_current = extra;
-      main_linecount++;
-
-      /* If there's an indent or a tag or 2nd line indent, insert them. */
-
-      if (indent > 0) line_insertbytes(main_current, 0, -1, NULL, 0, indent);
-      if (leftbuflen > 0)
-        line_insertbytes(main_current, indent, -1, leftbuf, leftbuflen, 0);
-      if (indent2 > 0)
-        line_insertbytes(main_current, minlen, -1, NULL, 0, indent2);
-      }
-
-    /* Otherwise, move text onto the start of the next line, and make it the
-    current line. We know that if there's an indent or tag, or second indent,
-    they will exist on the next line, so just insert after them. */
+    /* If the next line is not part of this paragraph, the rest becomes a line
+    on its own, with the indent, tag, and second indent. Otherwise, the rest
+    is moved to the start of the next line, after its indent and tag. */
 
-    else
+    if (ended) fmt_prepend(&fb, prefix, minlen + indent2, 0); else
       {
-      line_insertbytes(nextline, indent + leftbuflen + indent2, -1,
-        main_current->text + jbyte,
-        main_current->len - jbyte, 1);
-      nextline->flags |= lf_shn;
-      main_current->len = ibyte;               /* shorten current */
-      if (main_current->len == widthoffset) main_current->flags |= lf_shn;
-        else main_current->flags |= lf_clend;  /* clear out end */
-      main_current = nextline;
+      usint pbyte = line_offset(nextline, minlen + indent2);
+      usint pkeep = (pbyte < nextline->len)? pbyte : nextline->len;
+      fmt_prepend(&fb, nextline->text, pkeep, pbyte - pkeep);
+      fmt_append(&fb, nextline->text + pkeep, nextline->len - pkeep, 1);
       nextline = nextline->next;
       }
 
-    detrail(main_current);                     /* includes store_chop() */
+    fmt_detrail(&fb);
     }
 
   /* We now have a current line that is shorter than the required width.
   Concatenate with following lines until it exceeds the width, but only if
   there is room for the next word on the line. However, if the end of the
-  paragraph is reached, exit from the function. */
+  paragraph is reached, output the line and exit from the function. */
 
-  while (line_charcount(main_current->text, main_current->len) <= width)
+  while (fb.chars <= width)
     {
     BOOL ended = parend(nextline, indent, indent2, leftbuf, leftbuflen);
 
@@ -1309,8 +1712,14 @@ for (;;)
 
     if (ended)
       {
+      reuse = fmt_output(reuse, nextline, fb.text + fb.start,
+        fb.end - fb.start)->next;
       main_current = nextline;
       cursor_col = indent;
+      if (reuse != nextline)
+        (void)line_deleterange(reuse, nextline->prev, FALSE);
+      store_free(fb.text);
+      store_free(prefix);
       return;
       }
 
@@ -1318,10 +1727,9 @@ for (;;)
     optimisation that works in common cases, but not when the second line
     starts with a space. However, it is fail-safe. */
 
-    if (firstwordlen(nextline) <= spaceleft(main_current, width))
+    if (firstwordlen(nextline) <= spaceleft(&fb, width))
       {
       int sp = 0;
-      cmd_recordchanged(main_current, 0);
 
       /* If an indent or tag exists, it has been checked to be on the next
       line, so we can remove them. (Indents and tags are always ASCII
@@ -1329,23 +1737,27 @@ for (;;)
 
       if (minlen > 0) line_deletech(nextline, 0, minlen + indent2, TRUE);
 
-      if (main_current->len > 0 &&
-        main_current->text[main_current->len - 1] != ' ' &&
+      if (fb.end > fb.start && fb.text[fb.end - 1] != ' ' &&
           nextline->len > 0 && nextline->text[0] != ' ')
-            sp = 1;
+        sp = 1;
 
-      main_current = line_concat(nextline, sp);
+      fmt_append(&fb, nextline->text, nextline->len, sp);
       }
 
-    /* Do not join the lines; just move on to the next. */
+    /* Do not join the lines; output the current line and move on to the
+    next. */
 
     else
       {
-      main_current = nextline;
+      reuse = fmt_output(reuse, nextline, fb.text + fb.start,
+        fb.end - fb.start)->next;
+      fb.start = fb.end;
+      fb.chars = 0;
+      fmt_append(&fb, nextline->text, nextline->len, 0);
       }
 
-    detrail(main_current);
-    nextline = main_current->next;
+    fmt_detrail(&fb);
+    nextline = nextline->next;
     }
   }
 }
@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2016 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: December 2016 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains code for matching a search expression. The global
@@ -91,6 +91,8 @@ BOOL U = (qs->flags & qsef_U) != 0 ||
 BOOL W = ((qs->flags | USW) & qsef_W) != 0;           /* wordsearch state */
 BOOL yield = MATCH_FAILED;                            /* default reply */
 
+if (main_stats) main_statdata.qsmatches++;
+
 /* If hex string, adjust pointers */
 
 if ((flags & qsef_X) != 0)
@@ -249,9 +251,10 @@ return yield;
 variables match_start and match_end contain the start and end of the matched
 string (or whole line). The left and right margins for the search are set in
 globals to avoid too many arguments. There is also the flag match_L, set during
-backwards find operations. */
+backwards find operations. This function calls itself for the parts of a
+search expression; cmd_matchse() below is the external entry. */
 
-int cmd_matchse(sestr *se, linestr *line, int USW)
+static int matchse(sestr *se, linestr *line, int USW)
 {
 int yield;
 
@@ -270,7 +273,7 @@ if (se->type == cb_qstype)
 
 /* Got a search expression node - yield is a line */
 
-yield = cmd_matchse(se->left.se, line, USW);
+yield = matchse(se->left.se, line, USW);
 if (yield == MATCH_ERROR) return yield;
 
 /* Deal with OR */
@@ -278,12 +281,12 @@ if (yield == MATCH_ERROR) return yield;
 if ((se->flags & qsef_AND) == 0)
   {
   if (yield == MATCH_FAILED && se->right.se != NULL)
-    yield = cmd_matchse(se->right.se, line, USW);
+    yield = matchse(se->right.se, line, USW);
   }
 
 /* Deal with AND */
 
-else if (yield == MATCH_OK) yield = cmd_matchse(se->right.se, line, USW);
+else if (yield == MATCH_OK) yield = matchse(se->right.se, line, USW);
 
 if (yield == MATCH_ERROR) return yield;
 
@@ -303,4 +306,16 @@ if (yield == MATCH_OK)
 return yield;
 }
 
+
+/* Each call counts as one line searched when statistics are being kept. */
+
+int cmd_matchse(sestr *se, linestr *line, int USW)
+{
+int yield;
+if (main_stats) main_statdata.lines++;
+yield = matchse(se, line, USW);
+TRACE(tr_match, line->key, (int64_t)yield);
+return yield;
+}
+
 /* End of ematch.c */
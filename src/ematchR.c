@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2001 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: June 2001 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains code for matching a regular expression */
@@ -105,6 +105,7 @@ BOOL backwards = (flags & qsef_L) != 0 || ((match_L || (flags & qsef_E) != 0) &&
   (flags & qsef_B) == 0);
 
 Journal_Overflowed = FALSE;
+if (main_stats) main_statdata.rematches++;
 
 /* Take note of line length && sig space qualifier */
 
@@ -0,0 +1,977 @@
+/*************************************************
+*       The E text editor - 3rd incarnation      *
+*************************************************/
+
+/* Copyright (c) University of Cambridge, 1991 - 2026 */
+
+/* Written by Philip Hazel, starting November 1991 */
+/* This file last modified: October 2026 */
+
+
+/* This file contains code for autosaving. While a buffer that was loaded from
+a file is being edited, each change to its lines is appended to a recovery log
+beside the file, so that if NE or the system crashes, the edits can be replayed
+onto the file by starting NE with -recover. The functions that change lines
+already report every change to the undo journal, and the undo functions pass
+each change on to this module. Records are buffered, and are written when NE is
+waiting for input; the log is forced to disc at most once a second. When the
+log has grown to twice its size after the last checkpoint, it is replaced by a
+checkpoint, which describes the whole buffer compactly. The log is deleted when
+the buffer is saved to its file, and when NE finishes normally.
+
+Lines are identified by numbers in their id fields. When logging starts, the
+lines are numbered from 1 in order, and the numbers up to the line count (the
+"base") then identify lines of the file as it was. When the text of such a line
+is changed, or it is put back into the buffer, it is given a new number first,
+so that a line with a number up to the base always has its original text. This
+allows a checkpoint to describe runs of unchanged lines by their numbers only.
+*/
+
+
+#include "ehdr.h"
+
+
+/* The log starts with this text, followed by the size and time of the file
+and the base. */
+
+#define log_magic     "NE recovery log 1\n"
+#define log_magiclen  18
+
+#define log_bufsize   (64*1024)   /* stdio buffer for writing */
+#define log_syncgap   1000000     /* least time between syncs (usec) */
+#define log_checkmin  (1024*1024) /* no checkpoint for a smaller log */
+
+/* Record types. The values that follow each type are 32-bit numbers, written
+with the least significant byte first; text bytes follow the numbers.
+
+lr_newid   oldid newid             A line has a new number
+lr_replace id offset old new text  Old bytes at offset replaced by new ones
+lr_truncate id length              A line was shortened by a split
+lr_insert  id previd length text   A line was inserted after previd (0 = top)
+lr_delete  firstid lastid          A range of lines was removed
+lr_begin                           A checkpoint starts; the buffer is empty
+lr_keep    firstid count           Unchanged lines are added at the end
+lr_line    id length text          A line is added at the end
+lr_end                             A checkpoint is complete
+*/
+
+#define lr_newid      'N'
+#define lr_replace    'R'
+#define lr_truncate   'T'
+#define lr_insert     'I'
+#define lr_delete     'D'
+#define lr_begin      'B'
+#define lr_keep       'K'
+#define lr_line       'L'
+#define lr_end        'E'
+
+/* Logging state for a buffer */
+
+struct recoverstr {
+  FILE    *fid;            /* the log, or NULL before the first change */
+  uschar  *buffer;         /* stdio buffer for the log */
+  uschar  *name;           /* the log's name */
+  uint64_t filesize;       /* size of the file when it was loaded */
+  uint64_t filetime;       /* its modification time */
+  uint64_t size;           /* bytes written to the log */
+  uint64_t flushed;        /* bytes passed to the system */
+  uint64_t synced;         /* bytes forced to disc */
+  uint64_t checksize;      /* size after the last checkpoint */
+  uint64_t synctime;       /* time of the last sync */
+  usint    base;           /* ids up to this are unchanged lines */
+  usint    nextid;         /* the next id to give a line */
+  BOOL     lost;           /* a line had no id; a checkpoint is needed */
+};
+
+
+
+/*************************************************
+*                 Static data                    *
+*************************************************/
+
+/* A change of text whose new bytes are still to be written */
+
+static linestr *pendline = NULL;
+static usint pendoffset;
+static usint pendoldlen;
+static usint pendnewlen;
+
+
+
+/*************************************************
+*              Write to the log                  *
+*************************************************/
+
+static void
+put_num(recoverstr *r, usint n)
+{
+putc(n & 255, r->fid);
+putc((n >> 8) & 255, r->fid);
+putc((n >> 16) & 255, r->fid);
+putc((n >> 24) & 255, r->fid);
+r->size += 4;
+}
+
+static void
+put_type(recoverstr *r, int type)
+{
+putc(type, r->fid);
+r->size++;
+}
+
+static void
+put_text(recoverstr *r, uschar *s, usint len)
+{
+if (len > 0) (void)fwrite(s, 1, len, r->fid);
+r->size += len;
+}
+
+static void
+put_header(recoverstr *r)
+{
+(void)fwrite(log_magic, 1, log_magiclen, r->fid);
+r->size = log_magiclen;
+put_num(r, (usint)(r->filesize & 0xffffffffu));
+put_num(r, (usint)(r->filesize >> 32));
+put_num(r, (usint)(r->filetime & 0xffffffffu));
+put_num(r, (usint)(r->filetime >> 32));
+put_num(r, r->base);
+}
+
+
+
+/*************************************************
+*          Free logging state                    *
+*************************************************/
+
+/* The log is closed, and deleted unless it is to be kept.
+
+Arguments:
+  r          the logging state, or NULL
+  keep       TRUE to keep the log
+
+Returns:     nothing
+*/
+
+void
+recover_free(recoverstr *r, BOOL keep)
+{
+if (r == NULL) return;
+if (r->fid != NULL)
+  {
+  if (keep) (void)sys_syncfile(r->fid);
+  fclose(r->fid);
+  if (!keep) Uunlink(r->name);
+  }
+if (r == main_recovery)
+  {
+  main_recovery = NULL;
+  pendline = NULL;
+  undo_setstate(undo_keeping);
+  }
+store_free(r->buffer);
+store_free(r->name);
+store_free(r);
+}
+
+/* Logging stops if the log cannot be written */
+
+static void
+log_failed(recoverstr *r)
+{
+int save_errno = errno;
+error_moan(72, r->name, strerror(save_errno), currentbuffer->bufferno);
+recover_free(r, FALSE);
+}
+
+
+
+/*************************************************
+*           Open the log for writing             *
+*************************************************/
+
+static BOOL
+log_open(recoverstr *r, uschar *name, uschar *type)
+{
+r->fid = Ufopen(name, type);
+if (r->fid == NULL) return FALSE;
+setvbuf(r->fid, CS r->buffer, _IOFBF, log_bufsize);
+return TRUE;
+}
+
+/* A record is about to be written. The log is created at the first change. */
+
+static BOOL
+rec_start(recoverstr *r)
+{
+if (r->fid != NULL) return TRUE;
+if (!log_open(r, r->name, US"wb"))
+  {
+  log_failed(r);
+  return FALSE;
+  }
+put_header(r);
+r->checksize = r->size;
+return TRUE;
+}
+
+
+
+/*************************************************
+*                 Line ids                       *
+*************************************************/
+
+/* For a line that is referred to. A line without an id should not occur; if
+it does, a checkpoint is made at the next opportunity. */
+
+static usint
+line_id(recoverstr *r, linestr *line)
+{
+if (line->id == 0)
+  {
+  line->id = r->nextid++;
+  r->lost = TRUE;
+  }
+return line->id;
+}
+
+/* For a line whose text is about to be changed, or which is being put into
+the buffer, and so cannot keep an original line's id. A new line has no id
+yet. */
+
+static usint
+new_id(recoverstr *r, linestr *line)
+{
+if (line->id <= r->base)
+  {
+  usint old = line->id;
+  line->id = r->nextid++;
+  if (old != 0)
+    {
+    put_type(r, lr_newid);
+    put_num(r, old);
+    put_num(r, line->id);
+    }
+  }
+return line->id;
+}
+
+
+
+/*************************************************
+*             Record changes                     *
+*************************************************/
+
+/* These are called from the undo functions, which are called by all the
+functions that change lines. See eundo.c for when each is called. The current
+buffer's logging state is in main_recovery, which is not NULL. */
+
+void
+recover_replace(linestr *line, usint offset, usint oldlen, uschar *s,
+  usint newlen)
+{
+recoverstr *r = main_recovery;
+if (!rec_start(r)) return;
+(void)new_id(r, line);
+put_type(r, lr_replace);
+put_num(r, line->id);
+put_num(r, offset);
+put_num(r, oldlen);
+put_num(r, newlen);
+put_text(r, s, newlen);
+}
+
+/* A change of text is reported before it is made, and the new bytes are
+written when it is complete. */
+
+void
+recover_text(linestr *line, usint offset, usint oldlen, usint newlen)
+{
+if (newlen == 0)
+  {
+  recover_replace(line, offset, oldlen, NULL, 0);
+  return;
+  }
+pendline = line;
+pendoffset = offset;
+pendoldlen = oldlen;
+pendnewlen = newlen;
+}
+
+void
+recover_textdone(linestr *line)
+{
+if (pendline != line) return;
+pendline = NULL;
+recover_replace(line, pendoffset, pendoldlen, line->text + pendoffset,
+  pendnewlen);
+}
+
+/* A line has been split; the new line is inserted next */
+
+void
+recover_split(linestr *line)
+{
+recoverstr *r = main_recovery;
+if (!rec_start(r)) return;
+(void)new_id(r, line);
+put_type(r, lr_truncate);
+put_num(r, line->id);
+put_num(r, line->len);
+}
+
+/* A line is about to be joined to the previous line. The previous line's text
+and the padding are put in front of it, and the previous line is removed next.
+*/
+
+void
+recover_join(linestr *line, linestr *prev, usint padcount)
+{
+recoverstr *r = main_recovery;
+if (!rec_start(r)) return;
+(void)new_id(r, line);
+put_type(r, lr_replace);
+put_num(r, line->id);
+put_num(r, 0);
+put_num(r, 0);
+put_num(r, prev->len + padcount);
+put_text(r, prev->text, prev->len);
+r->size += padcount;
+while (padcount-- > 0) putc(' ', r->fid);
+}
+
+/* Lines have been linked into the buffer */
+
+void
+recover_insert(linestr *first, linestr *last)
+{
+recoverstr *r = main_recovery;
+usint previd;
+if (!rec_start(r)) return;
+previd = (first->prev == NULL)? 0 : line_id(r, first->prev);
+for (;;)
+  {
+  usint id = new_id(r, first);
+  put_type(r, lr_insert);
+  put_num(r, id);
+  put_num(r, previd);
+  put_num(r, first->len);
+  put_text(r, first->text, first->len);
+  if (first == last) break;
+  previd = id;
+  first = first->next;
+  }
+}
+
+/* Lines have been unlinked from the buffer */
+
+void
+recover_delete(linestr *first, linestr *last)
+{
+recoverstr *r = main_recovery;
+if (!rec_start(r)) return;
+put_type(r, lr_delete);
+put_num(r, line_id(r, first));
+put_num(r, line_id(r, last));
+}
+
+
+
+/*************************************************
+*             Write a checkpoint                 *
+*************************************************/
+
+/* The checkpoint is written to a new file, which then replaces the log, so
+that there is always a complete log on disc. */
+
+static BOOL
+checkpoint(recoverstr *r)
+{
+linestr *line;
+usint keepfirst = 0;
+usint keepcount = 0;
+FILE *oldfid = r->fid;
+uschar *oldbuffer = r->buffer;
+uschar *newname = store_Xget(Ustrlen(r->name) + 5);
+
+sprintf(CS newname, "%s.new", r->name);
+r->buffer = store_Xgettag(log_bufsize, st_recover);
+if (!log_open(r, newname, US"wb"))
+  {
+  store_free(r->buffer);
+  r->buffer = oldbuffer;
+  r->fid = oldfid;
+  store_free(newname);
+  return FALSE;
+  }
+
+put_header(r);
+put_type(r, lr_begin);
+
+for (line = main_top; line != NULL; line = line->next)
+  {
+  usint id = line->id;
+  if (id != 0 && id <= r->base)
+    {
+    if (keepcount > 0 && id == keepfirst + keepcount)
+      {
+      keepcount++;
+      continue;
+      }
+    if (keepcount > 0)
+      {
+      put_type(r, lr_keep);
+      put_num(r, keepfirst);
+      put_num(r, keepcount);
+      }
+    keepfirst = id;
+    keepcount = 1;
+    continue;
+    }
+
+  if (keepcount > 0)
+    {
+    put_type(r, lr_keep);
+    put_num(r, keepfirst);
+    put_num(r, keepcount);
+    keepcount = 0;
+    }
+  if (id == 0) id = line->id = r->nextid++;
+  put_type(r, lr_line);
+  put_num(r, id);
+  put_num(r, line->len);
+  put_text(r, line->text, line->len);
+  }
+
+if (keepcount > 0)
+  {
+  put_type(r, lr_keep);
+  put_num(r, keepfirst);
+  put_num(r, keepcount);
+  }
+put_type(r, lr_end);
+
+if (!sys_syncfile(r->fid) || Urename(newname, r->name) != 0)
+  {
+  int save_errno = errno;
+  fclose(r->fid);
+  Uunlink(newname);
+  store_free(r->buffer);
+  store_free(newname);
+  r->buffer = oldbuffer;
+  r->fid = oldfid;
+  errno = save_errno;
+  return FALSE;
+  }
+
+if (oldfid != NULL) fclose(oldfid);
+store_free(oldbuffer);
+store_free(newname);
+r->checksize = r->flushed = r->synced = r->size;
+r->synctime = sys_usecs();
+r->lost = FALSE;
+return TRUE;
+}
+
+
+
+/*************************************************
+*         Write out records when idle            *
+*************************************************/
+
+/* This is called when NE is about to wait for input. Buffered records are
+passed to the system, which preserves them if NE crashes, and they are forced
+to disc if it is a second since that was last done. A checkpoint is made
+instead if the log has doubled in size. */
+
+void
+recover_idle(void)
+{
+recoverstr *r = main_recovery;
+uint64_t now;
+
+if (r == NULL || r->fid == NULL) return;
+
+if (r->lost || (r->size >= log_checkmin && r->size >= 2*r->checksize))
+  {
+  if (!checkpoint(r)) log_failed(r);
+  return;
+  }
+
+if (r->size == r->synced) return;
+if (r->size != r->flushed)
+  {
+  if (fflush(r->fid) == EOF || ferror(r->fid))
+    {
+    log_failed(r);
+    return;
+    }
+  r->flushed = r->size;
+  }
+
+now = sys_usecs();
+if (now - r->synctime >= log_syncgap)
+  {
+  if (!sys_syncfile(r->fid))
+    {
+    log_failed(r);
+    return;
+    }
+  r->synced = r->size;
+  r->synctime = now;
+  }
+}
+
+
+
+/*************************************************
+*               Read from a log                  *
+*************************************************/
+
+static BOOL
+get_num(FILE *f, usint *n)
+{
+int i;
+usint value = 0;
+for (i = 0; i < 4; i++)
+  {
+  int c = getc(f);
+  if (c == EOF) return FALSE;
+  value |= (usint)c << (8*i);
+  }
+*n = value;
+return TRUE;
+}
+
+/* Read text into new store; NULL is returned for an empty text */
+
+static BOOL
+get_text(FILE *f, usint len, uschar **s)
+{
+*s = NULL;
+if (len == 0) return TRUE;
+if (len > MAX_LINELENGTH) return FALSE;
+*s = store_Xget(len);
+if (fread(*s, 1, len, f) == len) return TRUE;
+store_free(*s);
+*s = NULL;
+return FALSE;
+}
+
+
+
+/*************************************************
+*           Replay a log onto the buffer         *
+*************************************************/
+
+/* The lines of the current buffer, as loaded from the file, are numbered from
+1 upwards, and the records are then applied in turn. The base is the number of
+lines in the file, or zero if the log does not refer to the file's lines, in
+which case they are all replaced by its checkpoint. Lines are kept in a
+table indexed by their ids. Replaying stops quietly at an incomplete record at
+the end, which is what a crash while writing leaves, and with a message at a
+record that does not fit the buffer. Lines that are no longer in the buffer
+are freed at the end.
+
+Arguments:
+  f          the log, positioned after the header
+  name       the log's name, for messages
+  base       the number of lines in the file
+  maxid      where to return the largest id used
+
+Returns:     nothing
+*/
+
+static void
+replay(FILE *f, uschar *name, usint base, usint *maxid)
+{
+linestr **table;
+linestr *top = main_top;
+linestr *bottom = main_bottom;
+linestr *line;
+usint tablesize = main_linecount + 1024;
+usint id = 0;
+usint i;
+BOOL damaged = FALSE;
+BOOL incheckpoint = FALSE;
+
+table = store_Xget(tablesize * sizeof(linestr *));
+memset(table, 0, tablesize * sizeof(linestr *));
+for (line = main_top; line != NULL; line = line->next)
+  {
+  table[++id] = line;
+  line->id = id;
+  }
+*maxid = base;
+
+for (;;)
+  {
+  usint a, b = 0, c, d;
+  uschar *s;
+  linestr *p;
+  int type = getc(f);
+
+  if (type == EOF) break;
+
+  switch (type)
+    {
+    case lr_newid:
+    if (!get_num(f, &a) || !get_num(f, &b)) goto ENDLOG;
+    if (a >= tablesize || table[a] == NULL || b <= base) goto DAMAGED;
+    id = b;
+    line = table[a];
+    table[a] = NULL;
+    break;
+
+    case lr_replace:
+    if (!get_num(f, &a) || !get_num(f, &b) || !get_num(f, &c) ||
+        !get_num(f, &d)) goto ENDLOG;
+    if (!get_text(f, d, &s)) goto ENDLOG;
+    if (a >= tablesize || (line = table[a]) == NULL ||
+        b > line->len || c > line->len - b ||
+        line->len - c > MAX_LINELENGTH - d)
+      {
+      store_free(s);
+      goto DAMAGED;
+      }
+      {
+      usint newlen = line->len - c + d;
+      uschar *t = (newlen == 0)? NULL : store_Xget(newlen);
+      if (b > 0) memcpy(t, line->text, b);
+      if (d > 0) memcpy(t + b, s, d);
+      if (line->len > b + c)
+        memcpy(t + b + d, line->text + b + c, line->len - b - c);
+      store_free(line->text);
+      store_free(s);
+      line->text = t;
+      line->len = newlen;
+      }
+    continue;
+
+    case lr_truncate:
+    if (!get_num(f, &a) || !get_num(f, &b)) goto ENDLOG;
+    if (a >= tablesize || (line = table[a]) == NULL || b > line->len)
+      goto DAMAGED;
+    line->len = b;
+    continue;
+
+    case lr_insert:
+    case lr_line:
+    if (!get_num(f, &a)) goto ENDLOG;
+    if (type == lr_insert && !get_num(f, &b)) goto ENDLOG;
+    if (!get_num(f, &c) || !get_text(f, c, &s)) goto ENDLOG;
+    if (a == 0 || (a <= base && (a >= tablesize || table[a] == NULL)) ||
+        (type == lr_insert && b != 0 && (b >= tablesize || table[b] == NULL)))
+      {
+      store_free(s);
+      goto DAMAGED;
+      }
+    if (a < tablesize && table[a] != NULL)
+      {
+      line = table[a];
+      store_free(line->text);
+      }
+    else
+      {
+      line = store_getlbuff(0);
+      id = a;
+      }
+    line->text = s;
+    line->len = c;
+
+    if (type == lr_line)
+      {
+      line->next = NULL;
+      line->prev = bottom;
+      if (bottom == NULL) top = line; else bottom->next = line;
+      bottom = line;
+      }
+    else
+      {
+      p = (b == 0)? NULL : table[b];
+      line->prev = p;
+      line->next = (p == NULL)? top : p->next;
+      if (p == NULL) top = line; else p->next = line;
+      if (line->next == NULL) bottom = line; else line->next->prev = line;
+      }
+    if (line->id == a) continue;
+    break;
+
+    case lr_delete:
+    if (!get_num(f, &a) || !get_num(f, &b)) goto ENDLOG;
+    if (a >= tablesize || b >= tablesize || table[a] == NULL ||
+        table[b] == NULL) goto DAMAGED;
+    p = table[a]->prev;
+    line = table[b]->next;
+    if (p == NULL) top = line; else p->next = line;
+    if (line == NULL) bottom = p; else line->prev = p;
+    continue;
+
+    case lr_begin:
+    top = bottom = NULL;
+    incheckpoint = TRUE;
+    continue;
+
+    case lr_keep:
+    if (!get_num(f, &a) || !get_num(f, &b)) goto ENDLOG;
+    if (!incheckpoint || a == 0 || b > base || a > base - b + 1)
+      goto DAMAGED;
+    for (i = a; i < a + b; i++)
+      {
+      if ((line = table[i]) == NULL) goto DAMAGED;
+      line->next = NULL;
+      line->prev = bottom;
+      if (bottom == NULL) top = line; else bottom->next = line;
+      bottom = line;
+      }
+    continue;
+
+    case lr_end:
+    incheckpoint = FALSE;
+    continue;
+
+    default:
+    goto DAMAGED;
+    }
+
+  /* A line has a new id; enter it in the table, enlarging it if need be. */
+
+  if (id >= tablesize)
+    {
+    usint newsize = 2*tablesize;
+    linestr **newtable;
+    while (id >= newsize) newsize *= 2;
+    newtable = store_Xget(newsize * sizeof(linestr *));
+    memcpy(newtable, table, tablesize * sizeof(linestr *));
+    memset(newtable + tablesize, 0,
+      (newsize - tablesize) * sizeof(linestr *));
+    store_free(table);
+    table = newtable;
+    tablesize = newsize;
+    }
+  if (table[id] != NULL && table[id] != line) goto DAMAGED;
+  table[id] = line;
+  line->id = id;
+  if (id > *maxid) *maxid = id;
+  }
+
+ENDLOG:
+if (incheckpoint) damaged = TRUE;
+goto FINISH;
+
+DAMAGED:
+damaged = TRUE;
+
+/* Lines that are in the buffer are marked, so that the others can be freed.
+The last line must be an empty eof line. */
+
+FINISH:
+if (top == NULL)
+  {
+  top = bottom = store_getlbuff(0);
+  bottom->id = ++(*maxid);
+  }
+else if (bottom->len > 0)
+  {
+  line = store_getlbuff(0);
+  line->prev = bottom;
+  bottom->next = line;
+  bottom = line;
+  bottom->id = ++(*maxid);
+  }
+
+for (line = top; line != NULL; line = line->next) line->flags |= lf_back;
+for (i = 1; i < tablesize; i++)
+  {
+  if ((line = table[i]) == NULL || (line->flags & lf_back) != 0) continue;
+  store_free(line->text);
+  store_freelbuff(line);
+  }
+store_free(table);
+
+main_linecount = 0;
+for (line = top; line != NULL; line = line->next)
+  {
+  line->flags &= ~(lf_back | lf_eof);
+  main_linecount++;
+  }
+bottom->flags |= lf_eof;
+
+main_top = main_current = top;
+main_bottom = bottom;
+cursor_col = cursor_offset = 0;
+
+if (damaged)
+  error_printf("** %s is damaged, so not all the changes have been "
+    "recovered\n", name);
+}
+
+
+
+/*************************************************
+*           Start logging for a buffer           *
+*************************************************/
+
+/* This is called when a file has been loaded into the current buffer, and
+when the buffer has been saved to a file. A log that exists already is replayed
+if the -recover option was given at a load; otherwise logging is not started,
+so that the log is not lost. Logging then starts for the buffer if autosave is
+on or a log has been replayed. If the buffer differs from the file, the log is
+begun with a checkpoint.
+
+Arguments:
+  name       the file's name
+  load       TRUE if the file has just been loaded
+
+Returns:     nothing
+*/
+
+void
+recover_open(uschar *name, BOOL load)
+{
+recoverstr *r;
+linestr *line;
+uschar *logname;
+uint64_t size, mtime, logsize, logtime;
+usint base = 0;
+usint maxid = 0;
+BOOL changed = main_filechanged;
+BOOL replayed = FALSE;
+
+recover_free(main_recovery, FALSE);
+if (name == NULL || name[0] == 0 || Ustrcmp(name, "-") == 0 || main_binary ||
+    !sys_filestamp(name, &size, &mtime)) return;
+
+logname = sys_recoveryname(name);
+
+if (sys_filestamp(logname, &logsize, &logtime))
+  {
+  FILE *f;
+  uschar header[log_magiclen];
+  usint n[5];
+
+  if (!load || !main_recover)
+    {
+    error_printf("** A recovery log for \"%s\" exists (use -recover to apply "
+      "it)\n", name);
+    store_free(logname);
+    return;
+    }
+
+  /* Check that the log belongs to the file as loaded */
+
+  f = Ufopen(logname, "rb");
+  if (f == NULL || fread(header, 1, log_magiclen, f) != log_magiclen ||
+      memcmp(header, log_magic, log_magiclen) != 0 ||
+      !get_num(f, n) || !get_num(f, n+1) || !get_num(f, n+2) ||
+      !get_num(f, n+3) || !get_num(f, n+4) ||
+      size != ((uint64_t)n[1] << 32 | n[0]) ||
+      mtime != ((uint64_t)n[3] << 32 | n[2]) ||
+      (n[4] != 0 && n[4] != (usint)main_linecount))
+    {
+    if (f != NULL) fclose(f);
+    error_printf("** %s does not match \"%s\", so it has not been applied\n",
+      logname, name);
+    store_free(logname);
+    return;
+    }
+
+  base = n[4];
+  replay(f, logname, base, &maxid);
+  fclose(f);
+  error_printf("** Changes recovered from %s\n", logname);
+  main_filechanged = currentbuffer->changed = TRUE;
+  cmd_refresh = screen_forcecls = TRUE;
+  changed = FALSE;
+  replayed = TRUE;
+  }
+
+if (!main_autosave && !replayed)
+  {
+  store_free(logname);
+  return;
+  }
+
+r = store_Xgettag(sizeof(recoverstr), st_recover);
+memset(r, 0, sizeof(recoverstr));
+r->buffer = store_Xgettag(log_bufsize, st_recover);
+r->name = logname;
+r->filesize = size;
+r->filetime = mtime;
+
+/* A new log numbers the lines afresh; a replayed one keeps the ids it set. */
+
+if (!replayed)
+  {
+  for (line = main_top; line != NULL; line = line->next) line->id = ++base;
+  maxid = base;
+  }
+r->base = base;
+r->nextid = maxid + 1;
+
+main_recovery = r;
+undo_setstate(undo_keeping);
+
+/* A replayed log is replaced at once, because it may end with an incomplete
+record. If the buffer has been changed since it was loaded, all its lines are
+treated as new. */
+
+if (changed) r->base = 0;
+if (changed || replayed)
+  {
+  if (!checkpoint(r)) log_failed(r);
+  }
+}
+
+
+
+/*************************************************
+*          Turn autosaving on or off             *
+*************************************************/
+
+/* Turning it off deletes the logs for all buffers (only the current one in the
+library, where each buffer is a session with its own setting); turning it on
+starts logging for the current buffer. */
+
+void
+recover_enable(BOOL on)
+{
+bufferstr *b;
+main_autosave = on;
+if (on)
+  {
+  if (main_recovery == NULL) recover_open(main_filename, FALSE);
+  return;
+  }
+for (b = main_bufferchain; b != NULL && !main_library; b = b->next)
+  {
+  if (b != currentbuffer) recover_free(b->recovery, FALSE);
+  b->recovery = NULL;
+  }
+recover_free(main_recovery, FALSE);
+}
+
+
+
+/*************************************************
+*              Close all logs                    *
+*************************************************/
+
+/* This is called when NE finishes, to delete the logs, and when it crashes,
+to make sure they are complete on disc. */
+
+void
+recover_tidy(BOOL keep)
+{
+bufferstr *b;
+for (b = main_bufferchain; b != NULL; b = b->next)
+  {
+  if (b == currentbuffer) continue;
+  recover_free(b->recovery, keep);
+  b->recovery = NULL;
+  }
+recover_free(main_recovery, keep);
+if (currentbuffer != NULL) currentbuffer->recovery = NULL;
+}
+
+/* End of erecover.c */
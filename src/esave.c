@@ -0,0 +1,312 @@
+/*************************************************
+*       The E text editor - 3rd incarnation      *
+*************************************************/
+
+/* Copyright (c) University of Cambridge, 1991 - 2021 */
+
+/* Written by Philip Hazel, starting November 1991 */
+/* This file last modified: October 2026 */
+
+
+/* This file contains code for writing a buffer to a file while editing
+continues. When SAVE or WRITE is obeyed during an interactive screen session,
+the lines to be written are not written at once. Instead, the text of each of
+them is shared into a vector (see store_share()), so that a line that is
+changed or deleted while the write is in progress gets its own copy of its
+text, and the vector remains a snapshot of the buffer as it was. The vector is
+then written a slice at a time whenever NE is waiting for a keystroke and none
+has arrived, with progress shown in the message window.
+
+For SAVE, the buffer is marked unchanged only when the whole file has been
+written and closed, and only if it has not been changed in the meantime, which
+is known because a line that has been changed no longer has the snapshot's
+text. A write in progress is completed at once before anything that could
+interfere with it, such as another write, selecting another buffer, or the end
+of the run. */
+
+
+#include "ehdr.h"
+#include "shdr.h"
+
+/* The amount of data that is written between checks for a keystroke */
+
+#define slice_size    (256*1024)
+
+typedef struct {
+  uschar *text;
+  usint   len;
+  usint   flags;
+} saveline;
+
+static saveline *save_lines = NULL;     /* The snapshot; NULL if none */
+static usint     save_count;            /* Number of lines in it */
+static usint     save_next;             /* Next line to be written */
+static FILE     *save_fid;
+static uschar   *save_name;             /* File name */
+static uschar   *save_alias;            /* Name for messages */
+static BOOL      save_saving;           /* SAVE rather than WRITE */
+static BOOL      save_tabout;           /* Output settings at the start */
+static BOOL      save_detrail;
+static BOOL      save_failed;
+static BOOL      save_quiet;            /* Suppress progress messages */
+static BOOL      save_crashed;          /* Finished by the crash handler */
+static int       save_shown;            /* Percentage last shown */
+
+
+
+/*************************************************
+*         Show progress in message window        *
+*************************************************/
+
+/* Nothing is shown if the cursor is in the message window, because a command
+line is being read there. */
+
+static void
+save_message(const char *format, ...)
+{
+int w, x, y;
+uschar buff[256];
+va_list ap;
+
+if (save_quiet || !main_screenOK || (w = s_window()) == message_window)
+  return;
+
+va_start(ap, format);
+vsprintf(CS buff, format, ap);
+va_end(ap);
+
+x = s_x();
+y = s_y();
+s_selwindow(message_window, 0, 0);
+s_cls();
+s_printf("%s", buff);
+s_selwindow(w, x, y);
+s_flush();
+}
+
+
+
+/*************************************************
+*         Start writing in the background        *
+*************************************************/
+
+/* This is called from savew() when a write can be done in the background,
+after any write that was already in progress has been finished.
+
+Arguments:
+  fid          the open output file
+  name         the file name
+  alias        the name to use in messages
+  saveflag     TRUE for SAVE, FALSE for WRITE
+  line         the first line to write
+  last         the last line to write, or NULL for the rest of the buffer
+
+Returns:       nothing
+*/
+
+void
+save_start(FILE *fid, uschar *name, uschar *alias, BOOL saveflag,
+  linestr *line, linestr *last)
+{
+usint i;
+linestr *p;
+
+save_count = 0;
+for (p = line; (p->flags & lf_eof) == 0; p = p->next)
+  {
+  save_count++;
+  if (p == last) break;
+  }
+
+save_lines = store_Xget((save_count + 1) * sizeof(saveline));
+for (i = 0; i < save_count; i++, line = line->next)
+  {
+  save_lines[i].text = store_share(line->text);
+  save_lines[i].len = line->len;
+  save_lines[i].flags = line->flags;
+  }
+
+save_next = 0;
+save_fid = fid;
+save_name = store_copystring(name);
+save_alias = store_copystring(alias);
+save_saving = saveflag;
+save_tabout = main_tabout;
+save_detrail = main_detrail_output;
+save_failed = save_quiet = FALSE;
+save_shown = 0;
+
+save_message("%s %s", saveflag? "Saving" : "Writing", alias);
+main_leave_message = TRUE;
+}
+
+
+
+/*************************************************
+*          Finish a background write             *
+*************************************************/
+
+/* The file is closed and, for a successful SAVE, the buffer's state is
+updated. When size_t is only 32 bits wide, texts are copied instead of shared,
+so the buffer always looks as if it had been changed; this errs on the safe
+side. */
+
+static void
+save_done(void)
+{
+usint i;
+BOOL unchanged = TRUE;
+
+if (fclose(save_fid) != 0 && !save_failed)
+  {
+  error_moan(37, save_alias, strerror(errno));
+  save_failed = TRUE;
+  }
+
+if (save_saving && !save_failed)
+  {
+  linestr *line = main_top;
+  for (i = 0; i < save_count; i++, line = line->next)
+    {
+    if ((line->flags & lf_eof) != 0 || line->text != save_lines[i].text ||
+        line->len != save_lines[i].len)
+      {
+      unchanged = FALSE;
+      break;
+      }
+    }
+  if ((line->flags & lf_eof) == 0) unchanged = FALSE;
+
+  if (unchanged) main_filechanged = currentbuffer->changed = FALSE;
+  currentbuffer->saved = TRUE;
+  if (Ustrcmp(save_name, main_filename) == 0) recover_open(save_name, FALSE);
+  }
+
+if (!save_failed)
+  save_message("%s %s%s", save_saving? "Saved" : "Written", save_alias,
+    unchanged? "" : " (the buffer has changed since)");
+
+for (i = 0; i < save_count; i++) store_free(save_lines[i].text);
+store_free(save_lines);
+store_free(save_name);
+store_free(save_alias);
+save_lines = NULL;
+}
+
+
+
+/*************************************************
+*            Write some of the lines             *
+*************************************************/
+
+/* The output settings are those that were in force when the write started.
+
+Argument:   the amount of data to write
+Returns:    FALSE if there was a write error
+*/
+
+static BOOL
+save_write(size_t limit)
+{
+size_t size = 0;
+BOOL yield = TRUE;
+BOOL tabout = main_tabout;
+BOOL detrail = main_detrail_output;
+
+main_tabout = save_tabout;
+main_detrail_output = save_detrail;
+
+while (save_next < save_count && size < limit)
+  {
+  linestr line;
+  saveline *s = save_lines + save_next++;
+  line.text = s->text;
+  line.len = s->len;
+  line.flags = s->flags;
+  if (file_writeline(&line, save_fid) < 0)
+    {
+    yield = FALSE;
+    break;
+    }
+  size += s->len + 1;
+  }
+
+main_tabout = tabout;
+main_detrail_output = detrail;
+return yield;
+}
+
+
+
+/*************************************************
+*         Write the next slice of lines          *
+*************************************************/
+
+/* This is called when NE is waiting for a keystroke.
+
+Arguments:   none
+Returns:     TRUE if there is more to write
+*/
+
+BOOL
+save_idle(void)
+{
+int percent;
+
+if (save_lines == NULL || save_crashed) return FALSE;
+
+if (!save_write(slice_size))
+  {
+  error_moan(37, save_alias, strerror(errno));
+  save_failed = TRUE;
+  }
+
+if (save_failed || save_next >= save_count)
+  {
+  save_done();
+  return FALSE;
+  }
+
+percent = (int)(((uint64_t)save_next * 100) / save_count);
+if (percent != save_shown)
+  {
+  save_shown = percent;
+  save_message("%s %s: %d%%", save_saving? "Saving" : "Writing", save_alias,
+    percent);
+  }
+return TRUE;
+}
+
+
+
+/*************************************************
+*       Complete any write in progress           *
+*************************************************/
+
+void
+save_wait(void)
+{
+save_quiet = TRUE;
+while (save_idle());
+save_quiet = FALSE;
+}
+
+
+
+/*************************************************
+*       Complete a write after a crash           *
+*************************************************/
+
+/* This is called from the crash handler. The rest of the snapshot is written
+so that the file is not left incomplete, but nothing else is touched. */
+
+void
+save_crash(void)
+{
+if (save_lines == NULL || save_crashed) return;
+save_crashed = TRUE;
+(void)save_write(SIZE_MAX);
+fclose(save_fid);
+}
+
+/* End of esave.c */
@@ -0,0 +1,409 @@
+/*************************************************
+*       The E text editor - 3rd incarnation      *
+*************************************************/
+
+/* Copyright (c) University of Cambridge, 1991 - 2021 */
+
+/* Written by Philip Hazel, starting November 1991 */
+/* This file last modified: October 2026 */
+
+
+/* This file contains code for recording statistics about the commands that
+are obeyed. It is enabled by SET STATS ON or by the -stats command line
+option; when disabled, cmd_obeyline() and each counting point in the
+matchers, file handling, and store functions cost only a test of main_stats.
+
+For each command and each procedure, the number of times it is obeyed, the
+time taken, and the changes in the global counters (lines searched, strings
+tried, store, and line changes) are accumulated. Commands that obey other
+commands (bracketed sequences, loops, procedure calls, C and CBUFFER) include
+the figures for those commands. SHOW STATS outputs the figures, and if -stats
+was given, they are written to the named file in JSON format at the end of the
+run.
+
+SHOW STORE outputs the store figures that are kept by estore.c: the store in
+use by each kind of user, the system blocks, and the state of the free queue.
+The histogram of block sizes is recorded only while statistics are on. The same
+figures are included in the JSON output. */
+
+
+#include "ehdr.h"
+#include "cmdhdr.h"
+
+
+typedef struct {
+  usint    count;            /* times obeyed */
+  uint64_t time;             /* elapsed microseconds */
+  uint64_t lines;            /* lines searched */
+  uint64_t matches;          /* strings tried */
+  uint64_t store;            /* store got */
+  int64_t  storenet;         /* change in store in use */
+  uint64_t changes;          /* line changes */
+} cmdstats;
+
+typedef struct procstats {
+  struct procstats *next;
+  uschar  *name;
+  cmdstats s;
+} procstats;
+
+static const char *tag_names[] = { "other", "line headers", "file text",
+  "editing", "commands", "undo", "recovery" };
+
+static cmdstats  *stats_cmds = NULL;
+static int        stats_cmdcount;
+static procstats *stats_procs = NULL;
+
+
+
+/*************************************************
+*           Enable or disable recording          *
+*************************************************/
+
+/* The tables are obtained the first time recording is enabled. They are not
+reset when it is disabled, so that the results can still be shown. */
+
+void
+stats_enable(BOOL on)
+{
+if (on && stats_cmds == NULL)
+  {
+  size_t size;
+  stats_cmdcount = cmd_idcount();
+  size = stats_cmdcount * sizeof(cmdstats);
+  stats_cmds = store_Xget(size);
+  memset(stats_cmds, 0, size);
+  memset(&main_statdata, 0, sizeof(statstr));
+  }
+main_stats = on;
+}
+
+
+
+/*************************************************
+*          Add to a set of figures               *
+*************************************************/
+
+static void
+stats_add(cmdstats *s, cmdstats *d)
+{
+s->count += d->count;
+s->time += d->time;
+s->lines += d->lines;
+s->matches += d->matches;
+s->store += d->store;
+s->storenet += d->storenet;
+s->changes += d->changes;
+}
+
+
+
+/*************************************************
+*       Obey a command, recording statistics     *
+*************************************************/
+
+/* This is called from cmd_obeyline() instead of the command's function when
+statistics are enabled.
+
+Argument:   the command
+Returns:    the command's yield
+*/
+
+int
+stats_obey(cmdstr *cmd)
+{
+statstr before = main_statdata;
+size_t storetotal = main_storetotal;
+uint64_t start = sys_usecs();
+int yield = (cmd_Eproclist[(usint)(cmd->id)])(cmd);
+cmdstats d;
+
+if (stats_cmds == NULL || (int)(cmd->id) >= stats_cmdcount) return yield;
+
+d.count = 1;
+d.time = sys_usecs() - start;
+d.lines = main_statdata.lines - before.lines;
+d.matches = (main_statdata.qsmatches - before.qsmatches) +
+  (main_statdata.rematches - before.rematches);
+d.store = main_statdata.storebytes - before.storebytes;
+d.storenet = (int64_t)main_storetotal - (int64_t)storetotal;
+d.changes = main_statdata.changes - before.changes;
+
+stats_add(stats_cmds + cmd->id, &d);
+
+/* A procedure call is recorded under the procedure's name as well. */
+
+if (cmd_Eproclist[(usint)(cmd->id)] == e_obeyproc)
+  {
+  uschar *name = cmd->arg1.string->text;
+  procstats *p;
+  for (p = stats_procs; p != NULL; p = p->next)
+    if (Ustrcmp(p->name, name) == 0) break;
+  if (p == NULL)
+    {
+    p = store_Xget(sizeof(procstats));
+    memset(p, 0, sizeof(procstats));
+    p->name = store_copystring(name);
+    p->next = stats_procs;
+    stats_procs = p;
+    }
+  stats_add(&(p->s), &d);
+  }
+
+return yield;
+}
+
+
+
+/*************************************************
+*              Show the results                  *
+*************************************************/
+
+static void
+show_line(void (*oprintf)(const char *, ...), uschar *name, cmdstats *s)
+{
+oprintf("%-18s %7u %10lu %8lu %9lu %9lu %10lu %10ld %8lu\n", name, s->count,
+  (unsigned long int)s->time,
+  (unsigned long int)(s->time / s->count),
+  (unsigned long int)s->lines,
+  (unsigned long int)s->matches,
+  (unsigned long int)s->store,
+  (long int)s->storenet,
+  (unsigned long int)s->changes);
+}
+
+
+/* This is called for SHOW STATS, with error_printf() as the output
+function. */
+
+void
+stats_show(void (*oprintf)(const char *, ...))
+{
+statstr *d = &main_statdata;
+procstats *p;
+int i;
+
+if (stats_cmds == NULL)
+  {
+  oprintf("Statistics recording has not been enabled\n");
+  return;
+  }
+
+oprintf("Command statistics (times in microseconds)\n");
+oprintf("%-18s %7s %10s %8s %9s %9s %10s %10s %8s\n", "command", "count",
+  "time", "mean", "lines", "matches", "store", "net store", "changes");
+
+for (i = 0; i < stats_cmdcount; i++)
+  {
+  uschar temp[4];
+  if (stats_cmds[i].count == 0) continue;
+  show_line(oprintf, cmd_idname(i, temp), stats_cmds + i);
+  }
+
+if (stats_procs != NULL)
+  {
+  oprintf("Procedures:\n");
+  for (p = stats_procs; p != NULL; p = p->next)
+    show_line(oprintf, p->name, &(p->s));
+  }
+
+oprintf("Matching: %lu lines searched, %lu literal strings and %lu regular "
+  "expressions tried\n", (unsigned long int)d->lines,
+  (unsigned long int)d->qsmatches, (unsigned long int)d->rematches);
+oprintf("Files: %lu lines (%lu bytes) read in %lu us, %lu lines (%lu bytes) "
+  "written in %lu us\n", (unsigned long int)d->linesread,
+  (unsigned long int)d->bytesread, (unsigned long int)d->readtime,
+  (unsigned long int)d->lineswritten, (unsigned long int)d->byteswritten,
+  (unsigned long int)d->writetime);
+oprintf("Store: %lu gets (%lu bytes), %lu frees, %lu system blocks, "
+  "%lu bytes in use\n", (unsigned long int)d->storegets,
+  (unsigned long int)d->storebytes, (unsigned long int)d->storefrees,
+  (unsigned long int)d->storeblocks, (unsigned long int)main_storetotal);
+oprintf("Line changes: %lu\n", (unsigned long int)d->changes);
+}
+
+
+
+/*************************************************
+*            Show information about store        *
+*************************************************/
+
+/* This is called for SHOW STORE. The state of store is always available; the
+sizes of the blocks that were got, and the amount of store given back by
+shortening blocks, are counted only while statistics are being recorded. The
+fragmentation is the proportion of free store that is not in the largest free
+block. */
+
+static unsigned long int
+frag_permille(storeinfostr *info)
+{
+return (info->freebytes == 0)? 0 : (unsigned long int)
+  ((info->freebytes - info->largestfree) * (uint64_t)1000 / info->freebytes);
+}
+
+void
+stats_showstore(void (*oprintf)(const char *, ...))
+{
+storeinfostr info;
+statstr *d = &main_statdata;
+int i;
+
+store_info(&info);
+
+oprintf("Store in use: %lu bytes, peak %lu\n", (unsigned long int)info.inuse,
+  (unsigned long int)info.peak);
+for (i = 0; i < st_count; i++)
+  oprintf("  %-14s %10lu\n", tag_names[i], (unsigned long int)info.tagged[i]);
+oprintf("System blocks: %u (%lu bytes), peak %lu bytes; %u (%lu bytes) "
+  "given back\n", info.sysblocks, (unsigned long int)info.sysbytes,
+  (unsigned long int)info.syspeak, info.released,
+  (unsigned long int)info.releasedbytes);
+oprintf("Free queue: %u blocks, %lu bytes, largest %lu, fragmentation "
+  "%lu.%lu%%\n", info.freeblocks, (unsigned long int)info.freebytes,
+  (unsigned long int)info.largestfree, frag_permille(&info) / 10,
+  frag_permille(&info) % 10);
+oprintf("Unused in packing chunk: %lu bytes\n", (unsigned long int)info.packfree);
+
+if (stats_cmds == NULL)
+  {
+  oprintf("Block sizes are counted while statistics are being recorded\n");
+  return;
+  }
+
+oprintf("Blocks got, by size:\n");
+for (i = 0; i < store_sizeclasses; i++)
+  {
+  if (d->storesizes[i] == 0) continue;
+  if (i == store_sizeclasses - 1)
+    oprintf("  > %-9lu", 16ul << (store_sizeclasses - 2));
+  else
+    oprintf("  <= %-8lu", 16ul << i);
+  oprintf(" %10lu blocks %12lu bytes\n", (unsigned long int)d->storesizes[i],
+    (unsigned long int)d->storesizebytes[i]);
+  }
+oprintf("Shortened: %lu blocks, %lu bytes given back\n",
+  (unsigned long int)d->storechops, (unsigned long int)d->storechopbytes);
+}
+
+
+
+/*************************************************
+*          Write the results as JSON             *
+*************************************************/
+
+static void
+json_string(FILE *f, uschar *s)
+{
+fputc('"', f);
+for (; *s != 0; s++)
+  {
+  if (*s == '"' || *s == '\\') fprintf(f, "\\%c", *s);
+    else if (*s < 32) fprintf(f, "\\u%04x", *s);
+      else fputc(*s, f);
+  }
+fputc('"', f);
+}
+
+static void
+json_entry(FILE *f, uschar *name, cmdstats *s, BOOL first)
+{
+fprintf(f, "%s\n    {\"name\": ", first? "" : ",");
+json_string(f, name);
+fprintf(f, ", \"count\": %u, \"time_us\": %lu, \"lines\": %lu, "
+  "\"matches\": %lu, \"store\": %lu, \"net_store\": %ld, \"changes\": %lu}",
+  s->count, (unsigned long int)s->time, (unsigned long int)s->lines,
+  (unsigned long int)s->matches, (unsigned long int)s->store,
+  (long int)s->storenet, (unsigned long int)s->changes);
+}
+
+
+/* This is called at the end of a run when -stats was given. Failure to write
+the file is reported on the standard error, because NE is exiting.
+
+Argument:   the file name
+Returns:    nothing
+*/
+
+void
+stats_writejson(uschar *name)
+{
+statstr *d = &main_statdata;
+procstats *p;
+storeinfostr info;
+BOOL first = TRUE;
+FILE *f;
+int i;
+
+if (stats_cmds == NULL) return;
+store_info(&info);
+if ((f = sys_fopen(name, US"w")) == NULL)
+  {
+  fprintf(stderr, "** NE: failed to open %s for statistics: %s\n", name,
+    strerror(errno));
+  return;
+  }
+
+fprintf(f, "{\n  \"commands\": [");
+for (i = 0; i < stats_cmdcount; i++)
+  {
+  uschar temp[4];
+  if (stats_cmds[i].count == 0) continue;
+  json_entry(f, cmd_idname(i, temp), stats_cmds + i, first);
+  first = FALSE;
+  }
+
+fprintf(f, "\n  ],\n  \"procedures\": [");
+for (p = stats_procs, first = TRUE; p != NULL; p = p->next, first = FALSE)
+  json_entry(f, p->name, &(p->s), first);
+
+fprintf(f, "\n  ],\n"
+  "  \"match\": {\"lines\": %lu, \"literal\": %lu, \"regex\": %lu},\n",
+  (unsigned long int)d->lines, (unsigned long int)d->qsmatches,
+  (unsigned long int)d->rematches);
+fprintf(f, "  \"file\": {\"lines_read\": %lu, \"bytes_read\": %lu, "
+  "\"read_us\": %lu, \"lines_written\": %lu, \"bytes_written\": %lu, "
+  "\"write_us\": %lu},\n",
+  (unsigned long int)d->linesread, (unsigned long int)d->bytesread,
+  (unsigned long int)d->readtime, (unsigned long int)d->lineswritten,
+  (unsigned long int)d->byteswritten, (unsigned long int)d->writetime);
+fprintf(f, "  \"store\": {\"gets\": %lu, \"bytes\": %lu, \"frees\": %lu, "
+  "\"system_blocks\": %lu, \"in_use\": %lu, \"peak\": %lu, "
+  "\"chops\": %lu, \"chop_bytes\": %lu},\n",
+  (unsigned long int)d->storegets, (unsigned long int)d->storebytes,
+  (unsigned long int)d->storefrees, (unsigned long int)d->storeblocks,
+  (unsigned long int)main_storetotal, (unsigned long int)info.peak,
+  (unsigned long int)d->storechops, (unsigned long int)d->storechopbytes);
+
+fprintf(f, "  \"store_subsystems\": {");
+for (i = 0; i < st_count; i++)
+  fprintf(f, "%s\"%s\": %lu", (i == 0)? "" : ", ", tag_names[i],
+    (unsigned long int)info.tagged[i]);
+fprintf(f, "},\n  \"store_sizes\": [");
+for (i = 0, first = TRUE; i < store_sizeclasses; i++)
+  {
+  if (d->storesizes[i] == 0) continue;
+  fprintf(f, "%s\n    {\"max\": ", first? "" : ",");
+  if (i == store_sizeclasses - 1) fprintf(f, "null");
+    else fprintf(f, "%lu", 16ul << i);
+  fprintf(f, ", \"blocks\": %lu, \"bytes\": %lu}",
+    (unsigned long int)d->storesizes[i],
+    (unsigned long int)d->storesizebytes[i]);
+  first = FALSE;
+  }
+fprintf(f, "\n  ],\n");
+fprintf(f, "  \"store_system\": {\"blocks\": %u, \"bytes\": %lu, "
+  "\"peak_bytes\": %lu, \"released\": %u, \"released_bytes\": %lu},\n",
+  info.sysblocks, (unsigned long int)info.sysbytes,
+  (unsigned long int)info.syspeak, info.released,
+  (unsigned long int)info.releasedbytes);
+fprintf(f, "  \"free_queue\": {\"blocks\": %u, \"bytes\": %lu, "
+  "\"largest\": %lu, \"fragmentation\": %lu.%03lu},\n", info.freeblocks,
+  (unsigned long int)info.freebytes, (unsigned long int)info.largestfree,
+  frag_permille(&info) / 1000, frag_permille(&info) % 1000);
+fprintf(f, "  \"changes\": %lu\n}\n", (unsigned long int)d->changes);
+
+if (fclose(f) != 0)
+  fprintf(stderr, "** NE: failed to write %s: %s\n", name, strerror(errno));
+}
+
+/* End of estats.c */
@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2021 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: May 2021 */
+/* This file last modified: October 2026 */
 
 /* Store Management Routines. Nowadays the more common term is "memory". This 
 elaborate private block management scheme was invented in the days of RISC OS, 
@@ -43,14 +43,67 @@ typedef struct {
   size_t block_length;
 } block;   
 
+static freeblock *store_freefrom(freeblock *, void *);
+
+/* A block may be shared by several owners, for example when the text of a
+line is copied. The number of additional owners is kept in the top bits of the
+length; store_free() just decrements it while it is non-zero. A block that
+already has the maximum number of owners is copied instead of shared. There
+are no spare bits when size_t is only 32 bits long, so blocks are never shared
+in that case.
+
+The subsystem tag of a block (see structs.h) is kept in the bottom bits of the
+length, which are otherwise zero because lengths are multiples of
+sizeof(freeblock). Blocks on the free queue are not tagged. */
+
+#define tag_mask      ((size_t)7)
+
+#if SIZE_MAX > 0xffffffffu
+#define share_unit    ((size_t)1 << 48)
+#define share_max     ((size_t)0xffff)
+#define length_mask   ((share_unit - 1) & ~tag_mask)
+#else
+#define share_unit    SIZE_MAX
+#define share_max     ((size_t)0)
+#define length_mask   (SIZE_MAX & ~tag_mask)
+#endif
+
+
+
+/* Line headers are carved from chunks that hold this many of them. The texts
+of lines read from files are carved from chunks that exactly fill a block from
+the system. */
+
+#define lbuff_chunk   100
+#define pack_chunk    (store_allocation_unit - sizeof(freeblock))
+
 
 
 /*************************************************
 *                  Static data                   *
 *************************************************/
 
+/* The free queue is kept in address order. A freed block very often lies
+above the one freed before it, for example when a global change is replacing
+the texts of a run of lines, so the search for its place starts at the block
+that received the last freed store whenever that is lower. */
+
 static freeblock *store_anchor;
 static freeblock *store_freequeue;
+static freeblock *store_freehint;
+static linestr   *store_freelines;
+static uschar    *store_packnext;
+static uschar    *store_packend;
+
+/* Figures for SHOW STORE; these are always kept, because they cannot be
+worked out later. The header of each block from the system holds its size. */
+
+static size_t     store_tagged[st_count];  /* bytes in use, by subsystem */
+static size_t     store_peak = 0;          /* most bytes in use */
+static size_t     store_sysbytes = 0;      /* bytes held from the system */
+static size_t     store_syspeak = 0;
+static usint      store_released = 0;      /* blocks given back */
+static size_t     store_releasedbytes = 0;
 
 
 /*************************************************
@@ -89,9 +142,12 @@ means of anchoring the queue. Searches always start at the block it points to.
 void store_init(void)
 {
 store_anchor = NULL;
+store_freelines = NULL;
+store_packnext = store_packend = NULL;
 store_freequeue = (freeblock *)malloc(sizeof(freeblock));
 store_freequeue->free_block_next = NULL;
 store_freequeue->free_block_length = sizeof(freeblock);
+store_freehint = store_freequeue;
 }
 
 
@@ -119,6 +175,23 @@ free(store_freequeue);
 
 
 
+/*************************************************
+*          Count a block's size                  *
+*************************************************/
+
+/* This is called while statistics are being recorded. */
+
+static void store_countsize(size_t size)
+{
+int c = 0;
+size_t n = (size - 1) >> 4;
+while (n != 0 && c < store_sizeclasses - 1) { n >>= 1; c++; }
+main_statdata.storesizes[c]++;
+main_statdata.storesizebytes[c] += size;
+}
+
+
+
 /*************************************************
 *               Get block                        *
 *************************************************/
@@ -168,6 +241,7 @@ while(p != NULL)
     {    /* found suitable block */
     block *pp = (block *)p;
     size_t leftover = p->free_block_length - truebytesize;
+    if (p == store_freehint) store_freehint = previous;
     if (leftover == 0)
       {  /* block used completely */
       previous->free_block_next = p->free_block_next;
@@ -188,7 +262,16 @@ while(p != NULL)
       (void *)pp, leftover);
     #endif  
      
-    pp->block_length = truebytesize;  
+    pp->block_length = truebytesize | main_storetag;
+    store_tagged[main_storetag] += truebytesize;
+    if (main_storetotal > store_peak) store_peak = main_storetotal;
+    if (main_stats)
+      {
+      main_statdata.storegets++;
+      main_statdata.storebytes += truebytesize;
+      store_countsize(truebytesize);
+      }
+    TRACE(tr_storeget, truebytesize, (uintptr_t)(pp + 1));
     #ifdef FullTraceStore
     pdebug = store_freequeue->free_block_next;
     while (pdebug != NULL)
@@ -224,18 +307,103 @@ else
   block *newbigblock = (block *)(newblock + 1);
 
   newblock->free_block_next = store_anchor;      /* Chain blocks through their */
-  store_anchor = newblock;                       /* first block */
+  newblock->free_block_length = newlength;       /* first block, which holds */
+  store_anchor = newblock;                       /* the size */
+  store_sysbytes += newlength;
+  if (store_sysbytes > store_syspeak) store_syspeak = store_sysbytes;
   newlength -= sizeof(freeblock);
 
   newbigblock->block_length = newlength;         /* Set block length */
   main_storetotal += newlength;                  /* Correction */
-  store_free(newbigblock + 1);                   /* Add to free queue */
+  store_tagged[st_other] += newlength;
+  if (main_stats) main_statdata.storeblocks++;
+  TRACE(tr_storeblock, newlength, (uintptr_t)newblock);
+  (void)store_freefrom(store_freequeue,          /* Add to free queue */
+    newbigblock + 1);
   return store_get(bytesize);                    /* Try again */
   }
 }
 
 
 
+/*************************************************
+*          Get store from the packing chunk      *
+*************************************************/
+
+/* This is used for the texts of lines that are being read from a file. Blocks
+are carved from a chunk in turn, without searching the free queue, so that
+consecutive lines are adjacent in store. Each block has its own length word
+and can be freed or chopped in the normal way; freeing or chopping the most
+recent block just moves the chunk pointer back, so a block can be got at its
+maximum size and then cut down. When a chunk is used up, what is left of it is
+freed and a new one is got.
+
+Arguments:
+  bytesize   the size required
+  tag        the subsystem tag
+
+Returns:     pointer to the store; store_get() failure is hard
+*/
+
+static void *getpacked(size_t bytesize, int tag)
+{
+block *b;
+size_t truebytesize = bytesize + sizeof(block);
+int blockrem = truebytesize % sizeof(freeblock);
+if (blockrem != 0) truebytesize += sizeof(freeblock) - blockrem;
+
+if (store_packnext + truebytesize > store_packend || store_packnext == NULL)
+  {
+  size_t chunksize = (truebytesize > pack_chunk)? truebytesize : pack_chunk;
+  uschar *chunk = store_Xget(chunksize - sizeof(block));
+
+  /* Free the rest of the old chunk */
+
+  if (store_packnext < store_packend)
+    {
+    b = (block *)store_packnext;
+    b->block_length = store_packend - store_packnext;
+    main_storetotal += b->block_length;
+    store_tagged[st_other] += b->block_length;
+    store_packnext = store_packend = NULL;
+    store_free(b + 1);
+    }
+
+  /* The new chunk's length is spread over the blocks carved from it. */
+
+  store_packnext = chunk - sizeof(block);
+  b = (block *)store_packnext;
+  store_packend = store_packnext + (b->block_length & length_mask);
+  main_storetotal -= store_packend - store_packnext;
+  store_tagged[b->block_length & tag_mask] -= store_packend - store_packnext;
+  }
+
+b = (block *)store_packnext;
+b->block_length = truebytesize | tag;
+store_packnext += truebytesize;
+main_storetotal += truebytesize;
+store_tagged[tag] += truebytesize;
+if (main_storetotal > store_peak) store_peak = main_storetotal;
+if (main_stats)
+  {
+  main_statdata.storegets++;
+  main_statdata.storebytes += truebytesize;
+  store_countsize(truebytesize);
+  }
+TRACE(tr_storeget, truebytesize, (uintptr_t)(b + 1));
+return (void *)(b + 1);
+}
+
+
+/* Texts of lines read from files are got here. */
+
+void *store_getpacked(size_t bytesize)
+{
+return getpacked(bytesize, st_filetext);
+}
+
+
+
 /*************************************************
 *     Get store, failing if none available       *
 *************************************************/
@@ -248,23 +416,75 @@ return yield;
 }
 
 
+/* This is used for store that belongs to a subsystem other than the current
+one. */
+
+void *store_Xgettag(size_t bytesize, int tag)
+{
+int oldtag = main_storetag;
+void *yield;
+main_storetag = tag;
+yield = store_Xget(bytesize);
+main_storetag = oldtag;
+return yield;
+}
+
+
 
 /*************************************************
 *          Get a line buffer                     *
 *************************************************/
 
+/* Line headers are not taken from the free queue one at a time. They are
+carved from chunks of lbuff_chunk headers, without a length word each, and
+freed headers are kept on their own list, chained through their next fields,
+for re-use. As well as saving store, this means that the headers of lines that
+are created together, such as those that are read from a file, are adjacent,
+so a scan through a buffer touches consecutive addresses. The chunks come
+from the same packing chunks as the texts of lines read from files, and they
+are never returned to the free queue. */
+
 void *store_getlbuff(size_t size)
 {
-linestr *line = store_Xget(sizeof(linestr));
+linestr *line;
 uschar *text = (size == 0)? NULL : store_Xget(size);
+
+if (store_freelines == NULL)
+  {
+  int i;
+  linestr *chunk = getpacked(lbuff_chunk * sizeof(linestr), st_lines);
+  for (i = lbuff_chunk - 1; i >= 0; i--)
+    {
+    chunk[i].next = store_freelines;
+    store_freelines = chunk + i;
+    }
+  }
+
+line = store_freelines;
+store_freelines = line->next;
 line->prev = line->next = NULL;
 line->text = text;
 line->key = line->flags = 0;
 line->len = size;
+line->id = 0;
 return line;
 }
 
 
+/*************************************************
+*          Free a line buffer                    *
+*************************************************/
+
+/* Only the header is freed; the caller deals with the text. */
+
+void store_freelbuff(linestr *line)
+{
+line->next = store_freelines;
+store_freelines = line;
+}
+
+
+
 /*************************************************
 *                 Copy store                     *
 *************************************************/
@@ -273,7 +493,7 @@ void *store_copy(void *p)
 {
 if (p == NULL) return NULL; else
   {
-  size_t length = ((block *)p-1)->block_length - sizeof(block);
+  size_t length = (((block *)p-1)->block_length & length_mask) - sizeof(block);
   void *yield = store_Xget(length);
   memcpy(yield, p, length);
   return yield;
@@ -281,18 +501,84 @@ if (p == NULL) return NULL; else
 }
 
 
+/*************************************************
+*                 Share store                    *
+*************************************************/
+
+/* The yield is either the same block, with another owner recorded, or a copy
+if it cannot be shared. Each owner must eventually call store_free(), and must
+call store_unshare() before altering the contents. */
+
+void *store_share(void *p)
+{
+block *b;
+if (p == NULL) return NULL;
+b = ((block *)p) - 1;
+if (b->block_length / share_unit >= share_max) return store_copy(p);
+b->block_length += share_unit;
+return p;
+}
+
+
+
+/*************************************************
+*            Test for shared store               *
+*************************************************/
+
+BOOL store_shared(void *p)
+{
+return p != NULL && (((block *)p) - 1)->block_length >= share_unit;
+}
+
+
+
+/*************************************************
+*         Obtain an unshared copy of store       *
+*************************************************/
+
+/* If the block is shared, give up this owner's reference and return a private
+copy; otherwise return the block itself. */
+
+void *store_unshare(void *p)
+{
+void *yield;
+if (!store_shared(p)) return p;
+yield = store_copy(p);
+store_free(p);
+return yield;
+}
+
+
+
+/*************************************************
+*            Find usable size of store           *
+*************************************************/
+
+/* The yield is the number of bytes that the client may use, which may be more
+than was asked for. */
+
+size_t store_size(void *p)
+{
+if (p == NULL) return 0;
+return ((((block *)p) - 1)->block_length & length_mask) - sizeof(block);
+}
+
+
+
 /*************************************************
 *                 Copy a line                    *
 *************************************************/
 
+/* The text is shared, not copied. The copy is not on the back list. */
+
 linestr *store_copyline(linestr *line)
 {
-linestr *yield = store_getlbuff(line->len);
-uschar *yieldtext = yield->text;
+linestr *yield = store_getlbuff(0);
 memcpy((void *)yield, (void *)line, sizeof(linestr));
 yield->prev = yield->next = NULL;
-yield->text = yieldtext;
-if (line->len > 0) memcpy(yield->text, line->text, line->len);
+yield->flags &= ~lf_back;
+yield->text = store_share(line->text);
+yield->id = 0;
 return yield;
 }
 
@@ -334,17 +620,29 @@ return yield;
 
 /* The length is in the first word of the block, which is before the address
 that the client was given. If the argument is NULL, do nothing (used for the
-contents of empty lines). */
+contents of empty lines).
 
-void store_free(void *address)
+The search for the place in the free queue starts after the given block, which
+is either the anchor or a block that is known to be below the one being freed.
+When it is the anchor, the search starts at the hint instead if that is lower
+than the block being freed. The yield is the free block that now contains the
+freed store, from which a search for a higher address can start; it becomes the
+new hint. */
+
+static freeblock *store_freefrom(freeblock *previous, void *address)
 {
-size_t length;
-freeblock *previous, *this, *start, *end;
+size_t length, tag;
+freeblock *this, *start, *end;
 #ifdef FullTraceStore
 freeblock *pdebug = store_freequeue->free_block_next;
 #endif
 
-if (address == NULL) return;
+if (address == NULL) return previous;
+if ((((block *)address) - 1)->block_length >= share_unit)
+  {
+  (((block *)address) - 1)->block_length -= share_unit;
+  return previous;
+  }
 #ifdef FullTraceStore
 while (pdebug != NULL)
 { debug_printf("F1    %8p %8p %8ld\n", pdebug, pdebug->free_block_next, pdebug->free_block_length);
@@ -352,14 +650,22 @@ while (pdebug != NULL)
 }
 #endif
 
-previous = store_freequeue;
-this = previous->free_block_next;
-
 start = (freeblock *) (((block *)address) - 1);
 length = ((block *)start)->block_length;
+tag = length & tag_mask;
+length -= tag;
 end = (freeblock *)((uschar *)start + length);
 
 main_storetotal -= length;
+store_tagged[tag] -= length;
+
+/* The most recent block from the packing chunk goes back to the chunk. */
+
+if ((uschar *)end == store_packnext)
+  {
+  store_packnext = (uschar *)start;
+  return previous;
+  }
 
 #ifdef sanity
 store_freequeuecheck();
@@ -371,6 +677,11 @@ debug_printf("Free %5ld %8ld %8p\n", length, main_storetotal, (void *)start);
 
 /* Find where to insert */
 
+if (previous == store_freequeue && store_freehint != store_freequeue &&
+    store_freehint < start)
+  previous = store_freehint;
+this = previous->free_block_next;
+
 while (this != NULL)
   {
   if (start < this) break;
@@ -421,6 +732,7 @@ if (previous != store_freequeue)
     {
     previous->free_block_next = start->free_block_next;
     previous->free_block_length += start->free_block_length;
+    start = previous;
     }
   }
 
@@ -434,6 +746,45 @@ while (pdebug != NULL)
   pdebug = pdebug->free_block_next;
 }
 #endif
+
+store_freehint = start;
+return start;
+}
+
+
+void store_free(void *address)
+{
+if (main_stats) main_statdata.storefrees++;
+TRACE(tr_storefree, 1, (uintptr_t)address);
+(void)store_freefrom(store_freequeue, address);
+}
+
+
+
+/*************************************************
+*          Free a vector of chunks               *
+*************************************************/
+
+/* Freeing many blocks one at a time costs a scan of the free queue for each
+of them. Here the addresses are sorted first, so that they can all be merged
+into the queue in a single pass. The vector is reordered; NULL entries are
+ignored. */
+
+static int store_addrcmp(const void *a, const void *b)
+{
+uintptr_t x = (uintptr_t)(*(void * const *)a);
+uintptr_t y = (uintptr_t)(*(void * const *)b);
+return (x < y)? -1 : (x > y)? 1 : 0;
+}
+
+void store_freevector(void **vector, size_t count)
+{
+size_t i;
+freeblock *previous = store_freequeue;
+qsort(vector, count, sizeof(void *), store_addrcmp);
+if (main_stats) main_statdata.storefrees += count;
+TRACE(tr_storefree, count, (count == 1)? (uintptr_t)vector[0] : 0);
+for (i = 0; i < count; i++) previous = store_freefrom(previous, vector[i]);
 }
 
 
@@ -445,10 +796,17 @@ void store_chop(void *address, size_t bytesize)
 {
 usint blockrem;
 usint freelength;
+size_t tag;
 block *start, *end;
+freeblock *hint = store_freehint;
 
 start = ((block *)address) - 1;
 
+/* A shared block cannot be shortened; its other owners may need the rest. */
+
+if (start->block_length >= share_unit) return;
+tag = start->block_length & tag_mask;
+
 /* Round up new length as for new blocks */
 
 bytesize += sizeof(block);
@@ -461,16 +819,124 @@ debug_printf("Chop %5lu %p\n", bytesize, (void *)start);
 
 /* Compute amount to free, and don't bother if less than four freeblocks */
 
-freelength = start->block_length - bytesize;
+freelength = (start->block_length & length_mask) - bytesize;
 if (freelength < 4*sizeof(freeblock)) return;
 
 /* Set revised length into what remains, create a length for the
-bit to be freed, and free it via the normal function. */
+bit to be freed, and free it via the normal function. The piece is usually the
+top of store that has just been got, whereas the next block to be freed is more
+likely to be near the one freed before, so the free queue hint is put back if
+it is still valid, which it is if it was below the piece. */
 
-start->block_length = bytesize;
+start->block_length = bytesize | tag;
 end = (block *)(((uschar *)start) + bytesize);
-end->block_length = freelength;
+end->block_length = freelength | tag;
+if (main_stats)
+  {
+  main_statdata.storechops++;
+  main_statdata.storechopbytes += freelength;
+  }
 store_free(end + 1);
+if (hint == store_freequeue || hint < (freeblock *)end) store_freehint = hint;
+}
+
+
+
+
+/*************************************************
+*       Give free system blocks back             *
+*************************************************/
+
+/* A block from the system is completely free when there is an entry on the
+free queue that starts immediately after its header and has the rest of its
+size; free blocks are never merged across blocks from the system, because the
+headers are never free. Such blocks are taken off the free queue and the chain
+and given back to the system with free(). Whether the system returns them to
+the operating system is up to it.
+
+Arguments:  none
+Returns:    the number of blocks given back
+*/
+
+int store_release(void)
+{
+freeblock *previous = store_freequeue;
+freeblock *p = previous->free_block_next;
+int count = 0;
+
+while (p != NULL)
+  {
+  freeblock *next = p->free_block_next;
+
+  if (p->free_block_length >= pack_chunk)
+    {
+    freeblock *sys = p - 1;
+    freeblock **chain = &store_anchor;
+
+    while (*chain != NULL && *chain != sys)
+      chain = (freeblock **)(&((*chain)->free_block_next));
+
+    if (*chain != NULL &&
+        sys->free_block_length == p->free_block_length + sizeof(freeblock))
+      {
+      *chain = sys->free_block_next;
+      previous->free_block_next = next;
+      store_sysbytes -= sys->free_block_length;
+      store_releasedbytes += sys->free_block_length;
+      store_released++;
+      free(sys);
+      count++;
+      p = next;
+      continue;
+      }
+    }
+
+  previous = p;
+  p = next;
+  }
+
+if (count > 0) store_freehint = store_freequeue;
+return count;
+}
+
+
+
+/*************************************************
+*          Get information about store           *
+*************************************************/
+
+/* The free queue and the chain of blocks from the system are scanned.
+
+Argument:   where to put the information
+Returns:    nothing
+*/
+
+void store_info(storeinfostr *info)
+{
+freeblock *p;
+
+memset(info, 0, sizeof(storeinfostr));
+info->inuse = main_storetotal;
+info->peak = store_peak;
+memcpy(info->tagged, store_tagged, sizeof(store_tagged));
+info->syspeak = store_syspeak;
+info->released = store_released;
+info->releasedbytes = store_releasedbytes;
+info->packfree = store_packend - store_packnext;
+
+for (p = store_anchor; p != NULL; p = p->free_block_next)
+  {
+  info->sysblocks++;
+  info->sysbytes += p->free_block_length;
+  }
+
+for (p = store_freequeue->free_block_next; p != NULL; p = p->free_block_next)
+  {
+  info->freeblocks++;
+  info->freebytes += p->free_block_length;
+  if (p->free_block_length > info->largestfree)
+    info->largestfree = p->free_block_length;
+  }
 }
 
 /* End of estore.c */
@@ -0,0 +1,194 @@
+/*************************************************
+*       The E text editor - 3rd incarnation      *
+*************************************************/
+
+/* Copyright (c) University of Cambridge, 1991 - 2021 */
+
+/* Written by Philip Hazel, starting November 1991 */
+/* This file last modified: October 2026 */
+
+
+/* This file contains code for tracing events. It is enabled by SET TRACE ON or
+by the -trace command line option; when disabled, each trace point costs only a
+test of main_tracing, and if NE is built with -DNO_TRACE, the trace points are
+not compiled at all. The trace points are in the command dispatcher, the screen
+update, file reading and writing, the store functions, and the matchers; see
+tracehdr.h for the list of events.
+
+Each event is a fixed-size record containing the time and two numbers, written
+into a ring that holds the most recent trace_ringsize events. Nothing is
+written to a file until the ring is dumped, so that tracing disturbs timing as
+little as possible. The ring is dumped when NE receives SIGUSR1, when it
+crashes, and when it exits. The dump is written using only open(), write(),
+and close(), so that it can be done from a signal handler. The netrace program
+turns a dump into a timeline. */
+
+
+#include "ehdr.h"
+#include "cmdhdr.h"
+#include <fcntl.h>
+
+
+#define trace_ringsize  65536         /* must be a power of two */
+
+static tracerec *trace_ring = NULL;
+static uint64_t  trace_next = 0;      /* count of events recorded */
+static uschar   *trace_names;         /* command names for the decoder */
+static usint     trace_namesize;
+static uschar   *trace_filename;
+static BOOL      trace_crashed = FALSE;
+
+
+
+/*************************************************
+*              Record an event                   *
+*************************************************/
+
+/* This is called from the TRACE macro when main_tracing is TRUE.
+
+Arguments:
+  event       the event type
+  a, b        the event's data
+
+Returns:      nothing
+*/
+
+void
+trace_event(int event, usint a, uint64_t b)
+{
+tracerec *r = trace_ring + (trace_next & (trace_ringsize - 1));
+r->time = sys_usecs();
+r->event = event;
+r->a = a;
+r->b = b;
+trace_next++;
+}
+
+
+
+/*************************************************
+*              Write the ring                    *
+*************************************************/
+
+static BOOL
+trace_write(int fd, void *data, size_t size)
+{
+uschar *p = data;
+while (size > 0)
+  {
+  ssize_t n = write(fd, p, size);
+  if (n < 0)
+    {
+    if (errno == EINTR) continue;
+    return FALSE;
+    }
+  p += n;
+  size -= n;
+  }
+return TRUE;
+}
+
+
+/* A tr_dump event is added first, so that the dump records when it was made.
+If the dump is made while an event is being recorded (from a signal handler),
+that event's record may be incomplete. Recording continues afterwards, and a
+later dump overwrites the file, except after a crash: crash_handler() may be
+entered twice, and exit() calls tidy_up(), but the file should show the state
+at the time of the crash.
+
+Argument:   the signal that caused the dump, negative for a disaster, or zero
+Returns:    FALSE if the file could not be written
+*/
+
+BOOL
+trace_dump(int sig)
+{
+BOOL tracing = main_tracing;
+BOOL yield;
+traceheader h;
+usint count, start, wrap;
+int fd;
+
+if (trace_ring == NULL || trace_crashed) return TRUE;
+trace_crashed = sig != 0 && sig != SIGUSR1;
+
+trace_event(tr_dump, (usint)sig, 0);
+main_tracing = FALSE;
+
+count = (trace_next < trace_ringsize)? (usint)trace_next : trace_ringsize;
+start = (usint)((trace_next - count) & (trace_ringsize - 1));
+wrap = (start + count > trace_ringsize)? start + count - trace_ringsize : 0;
+
+memset(&h, 0, sizeof(h));
+memcpy(h.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+h.version = TRACE_VERSION;
+h.recsize = sizeof(tracerec);
+h.count = count;
+h.namesize = trace_namesize;
+h.lost = trace_next - count;
+
+fd = open(CS trace_filename, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+yield = fd >= 0 &&
+  trace_write(fd, &h, sizeof(h)) &&
+  trace_write(fd, trace_ring + start, (count - wrap) * sizeof(tracerec)) &&
+  trace_write(fd, trace_ring, wrap * sizeof(tracerec)) &&
+  trace_write(fd, trace_names, trace_namesize);
+if (fd >= 0 && close(fd) != 0) yield = FALSE;
+
+main_tracing = tracing;
+return yield;
+}
+
+
+
+/*************************************************
+*            SIGUSR1 handler                     *
+*************************************************/
+
+/* This dumps the ring on demand, for example when NE appears to be stuck. */
+
+static void
+trace_sighandler(int sig)
+{
+int save_errno = errno;
+(void)trace_dump(sig);
+errno = save_errno;
+}
+
+
+
+/*************************************************
+*           Enable or disable tracing            *
+*************************************************/
+
+/* The ring and the table of command names are set up the first time tracing
+is enabled. The ring is kept when tracing is disabled, so that it can still be
+dumped. */
+
+void
+trace_enable(BOOL on)
+{
+if (on && trace_ring == NULL)
+  {
+  int i, n = cmd_idcount();
+  uschar temp[4];
+  uschar *p;
+
+  trace_ring = store_Xget(trace_ringsize * sizeof(tracerec));
+  trace_filename = (arg_trace_name == NULL)? US"NEtrace" : arg_trace_name;
+
+  trace_namesize = 0;
+  for (i = 0; i < n; i++) trace_namesize += Ustrlen(cmd_idname(i, temp)) + 1;
+  p = trace_names = store_Xget(trace_namesize);
+  for (i = 0; i < n; i++)
+    {
+    Ustrcpy(p, cmd_idname(i, temp));
+    p += Ustrlen(p) + 1;
+    }
+
+  signal(SIGUSR1, trace_sighandler);
+  }
+main_tracing = on;
+}
+
+/* End of etrace.c */
@@ -0,0 +1,1070 @@
+/*************************************************
+*       The E text editor - 3rd incarnation      *
+*************************************************/
+
+/* Copyright (c) University of Cambridge, 1991 - 2026 */
+
+/* Written by Philip Hazel, starting November 1991 */
+/* This file last modified: October 2026 */
+
+
+/* This file contains code for the undo journal that supports the UNDO and
+REDO commands. Each buffer has its own journal, into which the functions that
+change lines record what they do as they do it. A change to the text of a line
+is kept as the bytes that were replaced and the bytes that replaced them, not
+as a copy of the line. Lines that are taken out of the buffer are kept by the
+journal, so that they can be put back, and so that earlier records that refer
+to them remain valid. Records are packed into large blocks of store, and are
+divided into groups, one for each command line or keystroke (a run of data
+keystrokes counts as one). When the journal exceeds its limit, the oldest
+groups are discarded. Each change is also passed on to the autosave log (see
+erecover.c) when the buffer has one. When neither is active, each recording
+point costs only a test of undo_recording. */
+
+
+#include "ehdr.h"
+
+
+/* Store for records is obtained in blocks of this size, or larger when a
+single record needs it. */
+
+#define undo_blocksize  (32*1024)
+
+/* Record lengths are rounded up so that records stay aligned */
+
+#define ALIGNED(n) (((n) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+/* Record types */
+
+enum { ur_group, ur_text, ur_attr, ur_splice, ur_split, ur_join };
+
+/* A record. The use of the fields depends on the type:
+
+ur_group   Starts a group; no other fields are used.
+
+ur_text    The bytes from offset in line were changed; oldlen bytes were
+           replaced by newlen bytes. The old bytes follow the record, and the
+           new bytes follow them.
+
+ur_attr    The key and the eof flag of line were changed; the other values
+           are in key and flags.
+
+ur_splice  Lines from line to other (count in offset) were inserted or
+           removed. The flags value is urf_in when they are in the buffer. The
+           first and last lines of the range keep their pointers to the lines
+           that were (or are) on either side of it.
+
+ur_split   Line was split at offset, the rest becoming other. The flags value
+           is non-zero if the eof flag moved to the second part.
+
+ur_join    Line was joined to the end of the previous line, other, which had
+           offset bytes, with oldlen spaces between them. The text now belongs
+           to line, and other is empty. The key is the other line number.
+*/
+
+typedef struct undorec {
+  struct undorec *prev;
+  struct undorec *next;
+  linestr *line;
+  linestr *other;
+  usint    offset;
+  usint    oldlen;
+  usint    newlen;
+  int      key;
+  uschar   type;
+  uschar   flags;
+} undorec;
+
+#define urf_in  1
+
+/* Block of store for records */
+
+typedef struct undoblock {
+  struct undoblock *prev;
+  struct undoblock *next;
+  size_t size;               /* total size */
+  size_t used;               /* bytes used, including this header */
+} undoblock;
+
+#define undo_blockhead  ALIGNED(sizeof(undoblock))
+
+/* The journal for a buffer */
+
+struct undostr {
+  undoblock *firstblock;
+  undoblock *lastblock;
+  undorec   *first;          /* oldest record */
+  undorec   *last;           /* newest record */
+  undorec   *done;           /* newest record that is in effect, or NULL */
+  size_t     size;           /* store used by blocks and by lines held */
+  usint      groups;         /* groups that can be undone */
+  usint      redogroups;     /* groups that can be redone */
+  BOOL       lost;           /* the last change was too large to keep */
+};
+
+
+
+/*************************************************
+*                  Static data                   *
+*************************************************/
+
+static BOOL newgroup = TRUE;      /* next record starts a group */
+static BOOL lasttyping = FALSE;   /* the current group is for data keys */
+
+/* A text record whose new bytes are still to be copied */
+
+static undorec *pending = NULL;
+static uschar *pendingdata;
+static usint pendingoffset;
+static usint pendinglen;
+
+/* Where the cursor goes after undoing or redoing */
+
+static linestr *where;
+static usint wherebyte;
+
+
+
+/*************************************************
+*            Size of a record or lines           *
+*************************************************/
+
+static size_t
+rec_size(undorec *r)
+{
+return ALIGNED(sizeof(undorec) +
+  ((r->type == ur_text)? r->oldlen + r->newlen : 0));
+}
+
+static size_t
+lines_size(linestr *first, linestr *last)
+{
+size_t size = 0;
+for (;;)
+  {
+  size += sizeof(linestr) + first->len;
+  if (first == last) break;
+  first = first->next;
+  }
+return size;
+}
+
+/* The size of held lines is only approximate, as their text may be shared or
+be altered while they are held, so it is never allowed to go negative. */
+
+static void
+journal_release(undostr *j, size_t size)
+{
+j->size = (j->size > size)? j->size - size : 0;
+}
+
+
+
+/*************************************************
+*         Free the lines held by a record        *
+*************************************************/
+
+static void
+free_lines(undostr *j, undorec *r)
+{
+linestr *line, *last;
+
+if (r->type != ur_splice || (r->flags & urf_in) != 0) return;
+journal_release(j, lines_size(r->line, r->other));
+
+line = r->line;
+last = r->other;
+for (;;)
+  {
+  linestr *next = line->next;
+  store_free(line->text);
+  store_freelbuff(line);
+  if (line == last) break;
+  line = next;
+  }
+}
+
+
+
+/*************************************************
+*          Discard all records in a journal      *
+*************************************************/
+
+static void
+journal_clear(undostr *j)
+{
+undorec *r;
+for (r = j->first; r != NULL; r = r->next) free_lines(j, r);
+while (j->firstblock != NULL)
+  {
+  undoblock *next = j->firstblock->next;
+  store_free(j->firstblock);
+  j->firstblock = next;
+  }
+j->lastblock = NULL;
+j->first = j->last = j->done = NULL;
+j->size = 0;
+j->groups = j->redogroups = 0;
+pending = NULL;
+newgroup = TRUE;
+}
+
+
+
+/*************************************************
+*               Free a journal                   *
+*************************************************/
+
+/* This is called when a buffer is emptied or deleted, and when recording is
+turned off.
+
+Argument:  the journal, or NULL
+Returns:   nothing
+*/
+
+void
+undo_free(undostr *j)
+{
+if (j == NULL) return;
+journal_clear(j);
+store_free(j);
+}
+
+
+
+/*************************************************
+*        Discard records that can be redone      *
+*************************************************/
+
+static BOOL
+in_block(undoblock *b, void *p)
+{
+return (uschar *)p >= (uschar *)b && (uschar *)p < (uschar *)b + b->used;
+}
+
+static void
+discard_redo(undostr *j)
+{
+undorec *r;
+undoblock *b;
+
+if (j->done == NULL)
+  {
+  journal_clear(j);
+  return;
+  }
+
+for (r = j->done->next; r != NULL; r = r->next) free_lines(j, r);
+
+b = j->lastblock;
+while (!in_block(b, j->done))
+  {
+  undoblock *prev = b->prev;
+  journal_release(j, b->size);
+  store_free(b);
+  b = prev;
+  }
+b->next = NULL;
+b->used = (uschar *)(j->done) - (uschar *)b + rec_size(j->done);
+j->lastblock = b;
+j->done->next = NULL;
+j->last = j->done;
+j->redogroups = 0;
+}
+
+
+
+/*************************************************
+*          Keep a journal within its limit       *
+*************************************************/
+
+/* The oldest groups are discarded until the journal fits. If the newest group
+is too large by itself, everything is discarded, and recording stops until the
+next group starts. */
+
+static void
+journal_trim(undostr *j)
+{
+size_t limit = (size_t)main_undolimit * 1024;
+
+while (j->size > limit && j->groups > 1 && j->redogroups == 0)
+  {
+  undorec *r = j->first;
+  do
+    {
+    free_lines(j, r);
+    r = r->next;
+    }
+  while (r->type != ur_group);
+
+  r->prev = NULL;
+  j->first = r;
+  j->groups--;
+
+  while (!in_block(j->firstblock, r))
+    {
+    undoblock *next = j->firstblock->next;
+    journal_release(j, j->firstblock->size);
+    store_free(j->firstblock);
+    j->firstblock = next;
+    next->prev = NULL;
+    }
+  }
+
+if (j->size > limit && j->redogroups == 0)
+  {
+  journal_clear(j);
+  j->lost = TRUE;
+  undo_setstate(FALSE);
+  }
+}
+
+
+
+/*************************************************
+*               Add a new record                 *
+*************************************************/
+
+/* Store for the record is taken from the last block, or from a new one if
+there is not enough room. */
+
+static undorec *
+rec_add(undostr *j, int type, size_t datalen)
+{
+undorec *r;
+size_t size = ALIGNED(sizeof(undorec) + datalen);
+
+if (j->lastblock == NULL || j->lastblock->used + size > j->lastblock->size)
+  {
+  undoblock *b;
+  size_t bsize = undo_blockhead + size;
+  if (bsize < undo_blocksize) bsize = undo_blocksize;
+  b = store_Xgettag(bsize, st_undo);
+  b->size = bsize;
+  b->used = undo_blockhead;
+  b->next = NULL;
+  b->prev = j->lastblock;
+  if (j->lastblock == NULL) j->firstblock = b; else j->lastblock->next = b;
+  j->lastblock = b;
+  j->size += bsize;
+  }
+
+r = (undorec *)((uschar *)(j->lastblock) + j->lastblock->used);
+j->lastblock->used += size;
+
+memset(r, 0, sizeof(undorec));
+r->type = type;
+r->prev = j->last;
+if (j->last == NULL) j->first = r; else j->last->next = r;
+j->last = j->done = r;
+return r;
+}
+
+/* This is called for each new change. Any records that could be redone are
+discarded first, and a group record is added if a new group is pending. The
+journal is created when it is first needed.
+
+Arguments:
+  type       the record type
+  datalen    the number of data bytes that follow it
+
+Returns:     the new record, with the type, prev, and next fields set
+*/
+
+static undorec *
+rec_new(int type, size_t datalen)
+{
+undostr *j = main_journal;
+
+if (j == NULL)
+  {
+  j = main_journal = store_Xgettag(sizeof(undostr), st_undo);
+  memset(j, 0, sizeof(undostr));
+  }
+
+if (j->done != j->last) discard_redo(j);
+
+if (newgroup || j->first == NULL)
+  {
+  newgroup = FALSE;
+  j->lost = FALSE;
+  j->groups++;
+  (void)rec_add(j, ur_group, 0);
+  }
+
+return rec_add(j, type, datalen);
+}
+
+/* Find the newest record if it can be extended, that is, if it is of the
+given type and is in the current group. */
+
+static undorec *
+rec_tail(int type)
+{
+undostr *j = main_journal;
+if (newgroup || j == NULL || j->last == NULL || j->last != j->done ||
+    j->last->type != type) return NULL;
+return j->last;
+}
+
+
+
+/*************************************************
+*               Start a new group                *
+*************************************************/
+
+/* This is called before each command line and each keystroke. A run of data
+keystrokes is kept as one group. Recording is resumed if it was stopped
+because a change was too large.
+
+Argument:  TRUE for a data keystroke
+Returns:   nothing
+*/
+
+void
+undo_group(BOOL typing)
+{
+if (!typing || !lasttyping) newgroup = TRUE;
+lasttyping = typing;
+undo_setstate(main_undo);
+}
+
+
+
+/*************************************************
+*            Record a change of text             *
+*************************************************/
+
+/* This is called before a change is made, so that the old bytes can be saved.
+It must be followed by a call to undo_textdone() after the change, to save the
+new bytes. A change that inserts bytes straight after the ones that the
+previous change inserted, or deletes some of them from the end, extends the
+previous record instead, which covers both typing and the delete/insert pairs
+that a global change makes. A change that starts beyond the end of the line is
+not recorded, and one that replaces bytes beyond the end is cut short, because
+replaying such a record would not match the line.
+
+Arguments:
+  line       the line
+  offset     byte offset of the change
+  oldlen     number of bytes being replaced
+  newlen     number of bytes replacing them
+
+Returns:     nothing
+*/
+
+void
+undo_text(linestr *line, usint offset, usint oldlen, usint newlen)
+{
+undostr *j;
+undorec *r;
+
+if (offset > line->len)
+  {
+  pending = NULL;
+  return;
+  }
+if (oldlen > line->len - offset) oldlen = line->len - offset;
+
+if (main_recovery != NULL) recover_text(line, offset, oldlen, newlen);
+if (!undo_keeping) return;
+
+r = rec_tail(ur_text);
+if (r != NULL && r->line == line && offset >= r->offset)
+  {
+  undoblock *b = main_journal->lastblock;
+  uschar *data = (uschar *)(r + 1);
+  usint end = r->offset + r->newlen;
+
+  if (oldlen == 0 && offset == end && (uschar *)r +
+      ALIGNED(sizeof(undorec) + r->oldlen + r->newlen + newlen) <=
+      (uschar *)b + b->size)
+    {
+    pending = r;
+    pendingdata = data + r->oldlen + r->newlen;
+    pendingoffset = offset;
+    pendinglen = newlen;
+    r->newlen += newlen;
+    b->used = (uschar *)r - (uschar *)b + rec_size(r);
+    return;
+    }
+
+  if (newlen == 0 && offset + oldlen == end)
+    {
+    r->newlen -= oldlen;
+    b->used = (uschar *)r - (uschar *)b + rec_size(r);
+    pending = NULL;
+    return;
+    }
+  }
+
+r = rec_new(ur_text, oldlen + newlen);
+r->line = line;
+r->offset = offset;
+r->oldlen = oldlen;
+r->newlen = newlen;
+if (oldlen > 0) memcpy(r + 1, line->text + offset, oldlen);
+
+pending = r;
+pendingdata = (uschar *)(r + 1) + oldlen;
+pendingoffset = offset;
+pendinglen = newlen;
+
+j = main_journal;
+if (j->size > (size_t)main_undolimit * 1024) journal_trim(j);
+}
+
+/* Save the new bytes after a change of text */
+
+void
+undo_textdone(linestr *line)
+{
+if (main_recovery != NULL) recover_textdone(line);
+if (pending == NULL) return;
+if (pendinglen > 0) memcpy(pendingdata, line->text + pendingoffset, pendinglen);
+pending = NULL;
+}
+
+
+
+/*************************************************
+*      Record a change of key or eof flag        *
+*************************************************/
+
+/* This is called before the change is made. */
+
+void
+undo_attr(linestr *line)
+{
+undorec *r;
+if (!undo_keeping) return;
+r = rec_new(ur_attr, 0);
+r->line = line;
+r->key = line->key;
+r->flags = line->flags & lf_eof;
+}
+
+
+
+/*************************************************
+*        Record the insertion of lines           *
+*************************************************/
+
+/* This is called after the lines have been linked into the buffer. An
+insertion next to the previous one extends it.
+
+Arguments:
+  first      the first line
+  last       the last line
+  count      the number of lines
+
+Returns:     nothing
+*/
+
+void
+undo_insert(linestr *first, linestr *last, usint count)
+{
+undorec *r;
+
+if (main_recovery != NULL) recover_insert(first, last);
+if (!undo_keeping) return;
+
+r = rec_tail(ur_splice);
+if (r != NULL && (r->flags & urf_in) != 0)
+  {
+  if (first->prev == r->other)
+    {
+    r->other = last;
+    r->offset += count;
+    return;
+    }
+  if (last->next == r->line)
+    {
+    r->line = first;
+    r->offset += count;
+    return;
+    }
+  }
+
+r = rec_new(ur_splice, 0);
+r->line = first;
+r->other = last;
+r->offset = count;
+r->flags = urf_in;
+}
+
+
+
+/*************************************************
+*        Record the removal of lines             *
+*************************************************/
+
+/* This is called after the lines have been unlinked from the buffer, while the
+first and last of them still point to their former neighbours. The journal now
+owns the lines, and may free them at once if it is too large, so the caller
+must not use them again. A removal next to the previous one extends it.
+
+Arguments:
+  first      the first line
+  last       the last line
+  count      the number of lines
+
+Returns:     nothing
+*/
+
+void
+undo_delete(linestr *first, linestr *last, usint count)
+{
+undostr *j;
+undorec *r;
+
+if (main_recovery != NULL) recover_delete(first, last);
+if (!undo_keeping) return;
+
+r = rec_tail(ur_splice);
+if (r != NULL && (r->flags & urf_in) == 0 && r->other->next == first)
+  {
+  first->prev = r->other;
+  r->other = last;
+  r->offset += count;
+  }
+
+else if (r != NULL && (r->flags & urf_in) == 0 && r->line->prev == last)
+  {
+  last->next = r->line;
+  r->line = first;
+  r->offset += count;
+  }
+
+else
+  {
+  r = rec_new(ur_splice, 0);
+  r->line = first;
+  r->other = last;
+  r->offset = count;
+  }
+
+j = main_journal;
+j->size += lines_size(first, last);
+if (j->size > (size_t)main_undolimit * 1024) journal_trim(j);
+}
+
+
+
+/*************************************************
+*          Record splitting and joining          *
+*************************************************/
+
+/* A split is recorded after it has happened; it is followed by a record of
+the insertion of the new line. */
+
+void
+undo_split(linestr *line, linestr *splitline)
+{
+undorec *r;
+if (main_recovery != NULL) recover_split(line);
+if (!undo_keeping) return;
+r = rec_new(ur_split, 0);
+r->line = line;
+r->other = splitline;
+r->offset = line->len;
+r->flags = (splitline->flags & lf_eof) != 0;
+}
+
+/* A join is recorded before it happens; it is followed by a record of the
+removal of the previous line, which by then is empty. */
+
+void
+undo_join(linestr *line, linestr *prev, usint padcount)
+{
+undorec *r;
+if (main_recovery != NULL) recover_join(line, prev, padcount);
+if (!undo_keeping) return;
+r = rec_new(ur_join, 0);
+r->line = line;
+r->other = prev;
+r->offset = prev->len;
+r->oldlen = padcount;
+r->key = line->key;
+}
+
+
+
+/*************************************************
+*          Replace part of a line's text         *
+*************************************************/
+
+/* New store is always used, so that it does not matter whether the text is
+shared. */
+
+static void
+text_replace(linestr *line, usint offset, usint remove, uschar *s,
+  usint insert)
+{
+usint rest = line->len - offset - remove;
+usint newlen = line->len - remove + insert;
+uschar *newtext = (newlen == 0)? NULL : store_Xget(newlen);
+
+if (main_recovery != NULL) recover_replace(line, offset, remove, s, insert);
+if (offset > 0) memcpy(newtext, line->text, offset);
+if (insert > 0) memcpy(newtext + offset, s, insert);
+if (rest > 0) memcpy(newtext + offset + insert, line->text + offset + remove,
+  rest);
+
+store_free(line->text);
+line->text = newtext;
+line->len = newlen;
+line->flags |= lf_shn;
+}
+
+
+
+/*************************************************
+*             Undo or redo a record              *
+*************************************************/
+
+/* Each kind of record checks that the buffer is in the state that the record
+expects, and does nothing if it is not.
+
+Arguments:
+  j          the journal
+  r          the record
+  undo       TRUE to undo, FALSE to redo
+
+Returns:     FALSE if the buffer is not as expected
+*/
+
+static BOOL
+rec_apply(undostr *j, undorec *r, BOOL undo)
+{
+linestr *line = r->line;
+linestr *other = r->other;
+uschar *data = (uschar *)(r + 1);
+
+switch (r->type)
+  {
+  case ur_text:
+    {
+    usint remove = undo? r->newlen : r->oldlen;
+    usint insert = undo? r->oldlen : r->newlen;
+    if (r->offset + remove > line->len) return FALSE;
+    text_replace(line, r->offset, remove, undo? data : data + r->oldlen,
+      insert);
+    where = line;
+    wherebyte = r->offset + (undo? 0 : insert);
+    }
+  break;
+
+  case ur_attr:
+    {
+    int key = line->key;
+    uschar flags = line->flags & lf_eof;
+    if (r->flags != 0 && line->next != NULL) return FALSE;
+    line->key = r->key;
+    line->flags = (line->flags & ~lf_eof) | r->flags | lf_shn | lf_clend;
+    r->key = key;
+    r->flags = flags;
+    if ((line->flags & lf_eof) != 0) main_bottom = line;
+    where = line;
+    wherebyte = 0;
+    }
+  break;
+
+  case ur_splice:
+    {
+    linestr *p = line->prev;
+    linestr *n = other->next;
+
+    /* Put the lines back */
+
+    if ((r->flags & urf_in) == 0)
+      {
+      if ((n == NULL)? (p == NULL || p != main_bottom) : (n->prev != p))
+        return FALSE;
+      if ((p == NULL)? (main_top != n) : (p->next != n)) return FALSE;
+      if (p == NULL) main_top = line; else p->next = line;
+      if (n == NULL) main_bottom = other; else n->prev = other;
+      main_linecount += r->offset;
+      if (main_recovery != NULL) recover_insert(line, other);
+      journal_release(j, lines_size(line, other));
+      r->flags |= urf_in;
+      where = line;
+      }
+
+    /* Take them out */
+
+    else
+      {
+      linestr *l;
+      if ((p == NULL)? (main_top != line) : (p->next != line)) return FALSE;
+      if ((n == NULL)? (main_bottom != other) : (n->prev != other))
+        return FALSE;
+      if (p == NULL && n == NULL) return FALSE;
+      if (p == NULL) main_top = n; else p->next = n;
+      if (n == NULL) main_bottom = p; else n->prev = p;
+      where = (n == NULL)? p : n;
+      if (main_recovery != NULL) recover_delete(line, other);
+      for (l = line;; l = l->next)
+        {
+        line_forget(l, where, TRUE);
+        if (l == other) break;
+        }
+      main_linecount -= r->offset;
+      j->size += lines_size(line, other);
+      r->flags &= ~urf_in;
+      }
+
+    wherebyte = 0;
+    }
+  break;
+
+  case ur_split:
+  if (undo)
+    {
+    if (line->len != r->offset) return FALSE;
+    text_replace(line, r->offset, 0, other->text, other->len);
+    store_free(other->text);
+    other->text = NULL;
+    other->len = 0;
+    if (r->flags != 0)
+      {
+      line->flags |= lf_eof;
+      other->flags &= ~lf_eof;
+      }
+    }
+  else
+    {
+    usint n = line->len - r->offset;
+    if (line->len < r->offset || other->len != 0) return FALSE;
+    other->text = (n == 0)? NULL : store_Xget(n);
+    if (n > 0) memcpy(other->text, line->text + r->offset, n);
+    other->len = n;
+    text_replace(line, r->offset, n, NULL, 0);
+    if (r->flags != 0)
+      {
+      line->flags = (line->flags & ~lf_eof) | lf_clend;
+      other->flags |= lf_eof;
+      }
+    }
+  where = line;
+  wherebyte = r->offset;
+  break;
+
+  case ur_join:
+    {
+    int key = line->key;
+    usint prevlen = r->offset;
+    usint pad = r->oldlen;
+
+    if (other->next != line) return FALSE;
+
+    if (undo)
+      {
+      if (other->len != 0 || line->len < prevlen + pad) return FALSE;
+      other->text = (prevlen == 0)? NULL : store_Xget(prevlen);
+      if (prevlen > 0) memcpy(other->text, line->text, prevlen);
+      other->len = prevlen;
+      if (main_recovery != NULL)
+        recover_replace(other, 0, 0, other->text, prevlen);
+      text_replace(line, 0, prevlen + pad, NULL, 0);
+      wherebyte = 0;
+      }
+    else
+      {
+      usint newlen = prevlen + pad + line->len;
+      uschar *newtext = (newlen == 0)? NULL : store_Xget(newlen);
+      if (other->len != prevlen) return FALSE;
+      if (prevlen > 0) memcpy(newtext, other->text, prevlen);
+      if (pad > 0) memset(newtext + prevlen, ' ', pad);
+      if (line->len > 0) memcpy(newtext + prevlen + pad, line->text, line->len);
+      if (main_recovery != NULL)
+        recover_replace(line, 0, 0, newtext, prevlen + pad);
+      store_free(line->text);
+      store_free(other->text);
+      line->text = newtext;
+      line->len = newlen;
+      other->text = NULL;
+      other->len = 0;
+      wherebyte = prevlen;
+      }
+
+    line->key = r->key;
+    r->key = key;
+    line->flags |= lf_shn;
+    where = line;
+    }
+  break;
+  }
+
+return TRUE;
+}
+
+
+
+/*************************************************
+*            Undo or redo a group                *
+*************************************************/
+
+/* This is called for the UNDO and REDO commands. The cursor is left at the
+place of the earliest change for UNDO, and the latest for REDO. If the buffer
+turns out not to match the journal, the journal is discarded.
+
+Argument:  TRUE for UNDO, FALSE for REDO
+Returns:   done_continue or done_error
+*/
+
+int
+undo_apply(BOOL undo)
+{
+undostr *j = main_journal;
+undorec *r;
+BOOL ok = TRUE;
+
+if (undo? (j == NULL || j->done == NULL) : (j == NULL || j->done == j->last))
+  {
+  if (undo && j != NULL && j->lost)
+    error_moan(70, main_undolimit);
+  else
+    error_moan(69, undo? "undo" : "redo", main_undo? "" : " (undo is off)");
+  return done_error;
+  }
+
+undo_recording = FALSE;
+where = NULL;
+wherebyte = 0;
+
+/* Undo works back from the newest record in effect to the start of its
+group. */
+
+if (undo)
+  {
+  for (r = j->done; r->type != ur_group; r = r->prev)
+    if (!(ok = rec_apply(j, r, TRUE))) break;
+  if (ok)
+    {
+    j->done = r->prev;
+    j->groups--;
+    j->redogroups++;
+    }
+  }
+
+/* Redo works forward from the first group that is not in effect. */
+
+else
+  {
+  r = (j->done == NULL)? j->first : j->done->next;
+  j->done = r;
+  for (r = r->next; r != NULL && r->type != ur_group; r = r->next)
+    {
+    if (!(ok = rec_apply(j, r, FALSE))) break;
+    j->done = r;
+    }
+  if (ok)
+    {
+    j->groups++;
+    j->redogroups--;
+    }
+  }
+
+if (!ok)
+  {
+  error_moan(71);
+  journal_clear(j);
+  }
+
+if (where != NULL)
+  {
+  main_current = where;
+  if (wherebyte > where->len) wherebyte = where->len;
+  cursor_col = line_charcount(where->text, wherebyte);
+  cmd_recordchanged(where, cursor_col);
+  }
+
+newgroup = TRUE;
+undo_setstate(main_undo);
+screen_forcecls = TRUE;
+cmd_refresh = TRUE;
+return ok? done_continue : done_error;
+}
+
+
+
+/*************************************************
+*        Turn recording on or off                *
+*************************************************/
+
+/* Turning it off discards the journals for all buffers, except in the library,
+where each buffer is a session with its own setting, so only the current
+buffer's journal goes. */
+
+void
+undo_enable(BOOL on)
+{
+main_undo = on;
+undo_setstate(on);
+if (!on)
+  {
+  bufferstr *b;
+  for (b = main_bufferchain; b != NULL && !main_library; b = b->next)
+    {
+    if (b != currentbuffer) undo_free(b->journal);
+    b->journal = NULL;
+    }
+  undo_free(main_journal);
+  main_journal = NULL;
+  }
+}
+
+/* Change the limit, in kilobytes */
+
+void
+undo_setlimit(usint limit)
+{
+main_undolimit = limit;
+if (main_journal != NULL && main_journal->size > (size_t)limit * 1024)
+  journal_trim(main_journal);
+undo_setstate(main_undo);
+}
+
+
+
+/*************************************************
+*          Set the recording state               *
+*************************************************/
+
+/* Changes are recorded if they are being kept for undo, or if there is an
+autosave log for the current buffer.
+
+Argument:  TRUE if changes are to be kept for undo
+Returns:   nothing
+*/
+
+void
+undo_setstate(BOOL keeping)
+{
+undo_keeping = keeping;
+undo_recording = keeping || main_recovery != NULL;
+}
+
+
+
+/*************************************************
+*              Show the journal                  *
+*************************************************/
+
+/* This is called for SHOW UNDO. */
+
+void
+undo_show(void)
+{
+undostr *j = main_journal;
+error_printf("Undo is %s, with a limit of %dK per buffer\n",
+  main_undo? "on" : "off", (int)main_undolimit);
+if (j == NULL) return;
+error_printf("Buffer %d: %d change%s to undo, %d to redo, using %dK\n",
+  currentbuffer->bufferno, (int)j->groups, (j->groups == 1)? "" : "s",
+  (int)j->redogroups, (int)((j->size + 1023)/1024));
+if (j->lost) error_printf("The last change was too large to keep\n");
+}
+
+/* End of eundo.c */
@@ -0,0 +1,55 @@
+/*************************************************
+*       The E text editor - 3rd incarnation      *
+*************************************************/
+
+/* Copyright (c) University of Cambridge, 1991 - 2021 */
+
+/* Written by Philip Hazel, starting November 1991 */
+/* This file last modified: October 2026 */
+
+/* This header file is for programs that use NE as a library (libne.a). Each
+session is an editing buffer with its own text, search and replacement
+defaults, cut buffer, global mark, undelete list, procedures, and options (such
+as CASEMATCH, WORD, KEY, and the SET values, apart from latency, stats, trace,
+and storerelease, which apply to the whole process). A new session starts with
+the options in force after initialization. Any number of sessions can exist at
+once, and the functions can be called from any thread, but calls are
+serialized, because most of NE's state is global: sessions on different
+threads take turns, and do not run in parallel.
+
+  ne_init()          must be called once, before anything else; it returns
+                       zero on success
+  ne_open()          creates a session containing a copy of the given text,
+                       which is split into lines at newlines; it returns NULL
+                       on failure
+  ne_command()       obeys one or more lines of NE commands, separated by
+                       newlines, in a session, stopping at the first error;
+                       it returns 0 if all went well, or NE's return code
+  ne_messages()      returns the messages and T/TL output from the last
+                       ne_command() on the session, with their length; the
+                       data remains valid until the next call on the session
+  ne_text()          returns the text of the session, with a newline after
+                       each line; the caller must free() it
+  ne_close()         discards a session
+
+Commands that end an NE run, such as W and STOP, just end the command string.
+Disastrous errors, such as running out of memory, still cause the process to
+exit, as they do in NE itself. */
+
+#ifndef LIBNE_H
+#define LIBNE_H
+
+#include <stddef.h>
+
+typedef struct ne_session ne_session;
+
+extern int         ne_init(void);
+extern ne_session *ne_open(const char *, size_t);
+extern int         ne_command(ne_session *, const char *);
+extern const char *ne_messages(ne_session *, size_t *);
+extern char       *ne_text(ne_session *, size_t *);
+extern void        ne_close(ne_session *);
+
+#endif
+
+/* End of libne.h */
@@ -0,0 +1,258 @@
+/*************************************************
+*       The E text editor - 3rd incarnation      *
+*************************************************/
+
+/* Copyright (c) University of Cambridge, 1991 - 2021 */
+
+/* Written by Philip Hazel, starting November 1991 */
+/* This file last modified: October 2026 */
+
+
+/* This is the decoder for the event traces that NE writes when tracing is
+enabled (see etrace.c and tracehdr.h). It is not part of NE itself. It reads a
+trace file and outputs a timeline, one event per line, showing the time since
+the first event in seconds, the time since the previous event in microseconds,
+and the event and its data. The starts and ends of commands, screen updates,
+file reads, and saves are indented to show how they nest, and each end shows
+the time since its start.
+
+  netrace [<file>]
+
+The default file is NEtrace. */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "tracehdr.h"
+
+#define MAX_DEPTH  64
+
+static const char *event_names[] = {
+  "none", "cmd", "cmd end", "display", "display end", "show line",
+  "clear line", "scroll", "read", "read end", "save", "save end",
+  "get", "free", "system block", "match", "dump" };
+
+static char **cmd_names = NULL;
+static unsigned int cmd_count = 0;
+
+
+
+/*************************************************
+*           Set up the command names             *
+*************************************************/
+
+/* The names follow the records, each terminated by a zero byte. */
+
+static void
+setup_names(char *names, unsigned int size)
+{
+unsigned int i, n = 0;
+char *p;
+
+for (i = 0; i < size; i++) if (names[i] == 0) n++;
+cmd_names = malloc(n * sizeof(char *) + 1);
+if (cmd_names == NULL) return;
+for (i = 0, p = names; i < n; i++)
+  {
+  cmd_names[i] = p;
+  p += strlen(p) + 1;
+  }
+cmd_count = n;
+}
+
+
+static const char *
+cmd_name(unsigned int id)
+{
+static char buff[16];
+if (id < cmd_count) return cmd_names[id];
+sprintf(buff, "command %u", id);
+return buff;
+}
+
+
+
+/*************************************************
+*          Output the data for an event          *
+*************************************************/
+
+static void
+show_event(tracerec *r)
+{
+switch (r->event)
+  {
+  case tr_cmd:
+  printf("%s", cmd_name(r->a));
+  break;
+
+  case tr_cmdend:
+  printf("%s, yield %d", cmd_name(r->a), (int)(int64_t)r->b);
+  break;
+
+  case tr_displayline:
+  case tr_clearline:
+  printf("row %u", r->a);
+  break;
+
+  case tr_scroll:
+  printf("top row %u, by %d", r->a, (int)(int64_t)r->b);
+  break;
+
+  case tr_read:
+  case tr_save:
+  printf("buffer %u", r->a);
+  break;
+
+  case tr_readend:
+  printf("%u lines, %llu bytes", r->a, (unsigned long long int)r->b);
+  break;
+
+  case tr_saveend:
+  printf("%u lines%s", r->a, (r->b == 0)? ", binary failure" : "");
+  break;
+
+  case tr_storeget:
+  case tr_storeblock:
+  printf("%u bytes at %#llx", r->a, (unsigned long long int)r->b);
+  break;
+
+  case tr_storefree:
+  if (r->a == 1) printf("at %#llx", (unsigned long long int)r->b);
+    else printf("%u blocks", r->a);
+  break;
+
+  case tr_match:
+  printf("line %u, %s", r->a, ((int64_t)r->b == 0)? "matched" :
+    ((int64_t)r->b > 0)? "failed" : "error");
+  break;
+
+  case tr_dump:
+  if (r->a == 0) printf("requested");
+    else if ((int)r->a < 0) printf("disaster");
+      else printf("signal %u", r->a);
+  break;
+  }
+}
+
+
+
+/*************************************************
+*                 Main program                   *
+*************************************************/
+
+int
+main(int argc, char **argv)
+{
+const char *name = (argc > 1)? argv[1] : "NEtrace";
+traceheader h;
+tracerec *recs;
+char *names;
+uint32_t starts[MAX_DEPTH];
+uint32_t ids[MAX_DEPTH];
+uint64_t times[MAX_DEPTH];
+uint64_t prev;
+unsigned int i;
+int depth = 0;
+FILE *f;
+
+if (argc > 2)
+  {
+  fprintf(stderr, "Usage: netrace [<file>]\n");
+  return 1;
+  }
+
+if ((f = fopen(name, "rb")) == NULL)
+  {
+  fprintf(stderr, "netrace: failed to open %s: %s\n", name, strerror(errno));
+  return 1;
+  }
+
+if (fread(&h, sizeof(h), 1, f) != 1 ||
+    memcmp(h.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0)
+  {
+  fprintf(stderr, "netrace: %s is not an NE trace file\n", name);
+  return 1;
+  }
+
+if (h.version != TRACE_VERSION || h.recsize != sizeof(tracerec))
+  {
+  fprintf(stderr, "netrace: %s has version %u and record size %u; expected "
+    "%u and %u\n", name, h.version, h.recsize, TRACE_VERSION,
+    (unsigned int)sizeof(tracerec));
+  return 1;
+  }
+
+recs = malloc(h.count * sizeof(tracerec) + 1);
+names = malloc(h.namesize + 1);
+if (recs == NULL || names == NULL)
+  {
+  fprintf(stderr, "netrace: out of memory\n");
+  return 1;
+  }
+
+if (fread(recs, sizeof(tracerec), h.count, f) != h.count ||
+    fread(names, 1, h.namesize, f) != h.namesize)
+  {
+  fprintf(stderr, "netrace: %s is truncated\n", name);
+  return 1;
+  }
+fclose(f);
+setup_names(names, h.namesize);
+
+printf("%u events", h.count);
+if (h.lost > 0) printf(" (%llu earlier events were overwritten)",
+  (unsigned long long int)h.lost);
+printf("\n%12s %9s  event\n", "seconds", "+usecs");
+
+prev = (h.count > 0)? recs[0].time : 0;
+for (i = 0; i < h.count; i++)
+  {
+  tracerec *r = recs + i;
+  uint64_t t = r->time - recs[0].time;
+  const char *ename = (r->event < tr_eventcount)? event_names[r->event] : "?";
+  int end = r->event == tr_cmdend || r->event == tr_displayend ||
+    r->event == tr_readend || r->event == tr_saveend;
+  int matched = -1;
+  int j;
+
+  /* An end is matched with the nearest start of the same kind on the stack
+  (each end event immediately follows its start in the list of events), which
+  is popped to that level, because the end of a save is not recorded if it
+  fails. If the start was overwritten, the end is shown at the current
+  depth. */
+
+  if (end)
+    for (j = depth - 1; j >= 0; j--)
+      if (starts[j] == r->event - 1 &&
+          (r->event != tr_cmdend || ids[j] == r->a))
+        { matched = j; break; }
+
+  if (matched >= 0) depth = matched;
+
+  printf("%5llu.%06llu %9llu  %*s%-12s ",
+    (unsigned long long int)(t / 1000000),
+    (unsigned long long int)(t % 1000000),
+    (unsigned long long int)(r->time - prev), depth * 2, "", ename);
+  show_event(r);
+  if (matched >= 0) printf(" (%llu us)",
+    (unsigned long long int)(r->time - times[depth]));
+  printf("\n");
+
+  if ((r->event == tr_cmd || r->event == tr_display || r->event == tr_read ||
+       r->event == tr_save) && depth < MAX_DEPTH)
+    {
+    starts[depth] = r->event;
+    ids[depth] = r->a;
+    times[depth++] = r->time;
+    }
+
+  prev = r->time;
+  }
+
+return 0;
+}
+
+/* End of netrace.c */
@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2016 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: December 2016 */
+/* This file last modified: October 2026 */
 
 /* This file contains all the structure definitions, together with parameters
 that control the size of some of them. */
@@ -31,6 +31,7 @@ typedef struct line {
   uschar      *text;         /* the characters themselves */
   int          key;          /* line number */
   usint        len;          /* number of bytes */
+  usint        id;           /* identity in the recovery log */
   uschar       flags;        /* various flag bits */
 } linestr;
 
@@ -44,6 +45,21 @@ typedef struct line {
 #define lf_tabs   16         /* expanded tabs in this line */
 #define lf_udch   32         /* chars for undelete */
 #define lf_cmd    64         /* was a taskwindow cmd line (RISC OS) */
+#define lf_back  128         /* is on the back list */
+
+
+/* Undo journal; the structure is private to eundo.c */
+
+typedef struct undostr undostr;
+
+/* Autosave logging state; the structure is private to erecover.c */
+
+typedef struct recoverstr recoverstr;
+
+
+/* Follow mode state; the structure is private to efollow.c */
+
+typedef struct followstr followstr;
 
 
 /* Entry in "back" vector */
@@ -58,6 +74,7 @@ typedef struct {
 
 typedef struct buffer {
   struct buffer *next;       /* next buffer block */
+  struct buffer *hashnext;   /* next in index chain */
 
   linestr *bottom;           /* last line in buffer */
   linestr *current;          /* current line in buffer */
@@ -67,6 +84,9 @@ typedef struct buffer {
   linestr *top;              /* first line in buffer */
 
   backstr *backlist;         /* vector of saved positions */
+  undostr *journal;          /* undo journal */
+  recoverstr *recovery;      /* autosave logging state */
+  followstr *follow;         /* follow mode state */
 
   usint backtop;             /* top of list */
   usint backnext;            /* position in list */
@@ -92,9 +112,11 @@ typedef struct buffer {
   CBOOL noprompt;            /* no prompting wanted */
   CBOOL readonly;            /* readonly flag */
   CBOOL saved;               /* saved to "own" file */
+  CBOOL unloaded;            /* not yet selected; file may be unread */
 
   FILE *from_fid;            /* input to this buffer */
   FILE *to_fid;              /* last output from this buffer */
+  uint64_t readsize;         /* size of file when read */
 } bufferstr;
 
 
@@ -255,6 +277,7 @@ typedef struct cmd {
 #define  cmdf_arg1F  4  /* arg1 is ptr to control block */
 #define  cmdf_arg2F  8  /* arg2 is ptr to control block */
 #define  cmdf_group 16  /* this is cmd group */
+#define  cmdf_count 32  /* command obeys its own repeat count */
 
 
 /* Procedure structure */
@@ -264,7 +287,7 @@ typedef struct procstr {
   uschar   flags;
   uschar   *name;
   cmdstr *body;
-  struct procstr *next;
+  struct procstr *next;      /* next in index chain */
 } procstr;
 
 #define pr_active        1
@@ -281,9 +304,60 @@ typedef struct {
 /* Structure for remembering the names of written files */
 
 typedef struct filewritten {
-  struct filewritten *next;
+  struct filewritten *next;  /* next in index chain */
   uschar *name;
 } filewritstr;
 
+/* Counters that are kept while statistics are being recorded (SET STATS);
+times are in microseconds. Sizes of blocks got from store are counted in
+classes whose limits are 16 bytes and successive powers of two, with the last
+class holding all larger blocks. */
+
+#define store_sizeclasses  18
+
+typedef struct {
+  uint64_t lines;            /* lines searched */
+  uint64_t qsmatches;        /* literal strings tried */
+  uint64_t rematches;        /* regular expressions tried */
+  uint64_t changes;          /* line changes recorded */
+  uint64_t linesread;        /* lines read from files */
+  uint64_t bytesread;
+  uint64_t readtime;
+  uint64_t lineswritten;     /* lines written to files */
+  uint64_t byteswritten;
+  uint64_t writetime;
+  uint64_t storegets;        /* blocks got from store */
+  uint64_t storebytes;
+  uint64_t storefrees;
+  uint64_t storeblocks;      /* blocks got from the system */
+  uint64_t storesizes[store_sizeclasses];    /* blocks got, by size */
+  uint64_t storesizebytes[store_sizeclasses];
+  uint64_t storechops;       /* blocks shortened */
+  uint64_t storechopbytes;   /* bytes freed by shortening */
+} statstr;
+
+/* Subsystems that store is got for; the tag of each block is kept with its
+length. The current subsystem is in main_storetag. At most 8 are possible. */
+
+enum { st_other, st_lines, st_filetext, st_edit, st_commands, st_undo,
+  st_recover, st_count };
+
+/* Information about the state of store, filled in by store_info(). */
+
+typedef struct {
+  size_t inuse;              /* bytes in use */
+  size_t peak;               /* most bytes in use */
+  size_t tagged[st_count];   /* bytes in use for each subsystem */
+  usint  sysblocks;          /* blocks held from the system */
+  size_t sysbytes;
+  size_t syspeak;            /* most bytes held from the system */
+  usint  released;           /* blocks given back to the system */
+  size_t releasedbytes;
+  usint  freeblocks;         /* blocks on the free queue */
+  size_t freebytes;
+  size_t largestfree;
+  size_t packfree;           /* unused part of the packing chunk */
+} storeinfostr;
+
 
 /* End of structs.h */
@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2018 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: August 2018 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains screen-handling code for use with termcap
@@ -19,6 +19,9 @@ native, depending on a configuration option. */
 #include "scomhdr.h"
 #include "unixhdr.h"
 
+#include <limits.h>
+#include <sys/uio.h>
+
 #define sh  s_f_shiftbit
 #define ct  s_f_ctrlbit
 #define shc (s_f_shiftbit + s_f_ctrlbit)
@@ -83,12 +86,23 @@ static int sunix_setrendition = s_r_normal;
 
 /* It turns out to be much faster to buffer up characters for
 output, at least under some systems and some libraries. SunOS 4.1.3
-with the GNU compiler is a case in point. */
+with the GNU compiler is a case in point. The buffer holds a complete
+"frame" of output - everything generated between two keystroke reads - and
+grows as necessary so that a full redraw of a large window is delivered by a
+single write. If the terminal understands synchronized output (DEC private
+mode 2026) each frame is bracketed so that it is displayed atomically. */
+
+#define outbuffsize    4096
+#define outbuffmax     (1024*1024)
 
-#define outbuffsize 4096
+static uschar out_static[outbuffsize];
+static uschar *out_buffer = out_static;
+static size_t out_buffsize = outbuffsize;
+static size_t outbuffptr = 0;
 
-static uschar out_buffer[outbuffsize];
-static int outbuffptr = 0;
+static BOOL sync_output = FALSE;
+static uschar *sync_begin = US"\x1b[?2026h";
+static uschar *sync_end = US"\x1b[?2026l";
 
 
 static struct termios oldtermparm;
@@ -136,18 +150,63 @@ static uschar Pkeytable[] = {
 *           Flush buffered output                *
 *************************************************/
 
-/* Make sure all output has been delivered */
+/* Make sure all output has been delivered. The frame, with its
+synchronization brackets if any, is passed to writev(); the loop copes with
+partial writes and interrupted calls. Counts of frames and writes are kept for
+performance checking. */
 
 static void sunix_flush(void)
 {
-if (outbuffptr > 0)
+int n = 0;
+usint count = 0;
+struct iovec iov[3];
+struct iovec *v = iov;
+
+if (outbuffptr == 0) return;
+
+if (sync_output)
   {
-  if (write(ioctl_fd, out_buffer, outbuffptr)){};  /* Fudge avoid warning */
-  outbuffptr = 0;
+  iov[n].iov_base = sync_begin;
+  iov[n++].iov_len = Ustrlen(sync_begin);
   }
+iov[n].iov_base = out_buffer;
+iov[n++].iov_len = outbuffptr;
+if (sync_output)
+  {
+  iov[n].iov_base = sync_end;
+  iov[n++].iov_len = Ustrlen(sync_end);
+  }
+
+while (n > 0)
+  {
+  ssize_t w = writev(ioctl_fd, v, n);
+  if (w < 0)
+    {
+    if (errno == EINTR || errno == EAGAIN) continue;
+    break;                             /* Give up on hard error */
+    }
+  count++;
+  while (n > 0 && (size_t)w >= v->iov_len)
+    {
+    w -= v->iov_len;
+    v++;
+    n--;
+    }
+  if (n > 0)
+    {
+    v->iov_base = (char *)(v->iov_base) + w;
+    v->iov_len -= w;
+    }
+  }
+
+outbuffptr = 0;
+screen_frames++;
+screen_writes += count;
+if (count > screen_maxwrites) screen_maxwrites = count;
 }
 
 
+
 /*************************************************
 *              Accept keystroke                  *
 *************************************************/
@@ -171,6 +230,138 @@ error_longjmpOK = FALSE;
 
 
 
+/*************************************************
+*          Read next byte of keyboard input      *
+*************************************************/
+
+/* Bytes that have been read and then found not to be wanted are kept on a
+stack, which is "read" before anything else. Otherwise, input is read from the
+terminal in bulk into a buffer. Because the terminal is in raw mode with VMIN
+set to 1, read() waits for at least one byte, but then returns everything that
+is available, so a burst of input (a function key sequence or pasted text) is
+obtained with a single system call. This function is also used by
+sys_checkinterrupt(), so that no input is lost between two buffers. */
+
+static uschar kbback[40];
+static int kbbackptr;
+
+static uschar kbinput[256];
+static int kbinptr = 0;
+static int kbinend = 0;
+
+int tc_getchar(void)
+{
+if (kbbackptr > 0) return kbback[--kbbackptr];
+if (kbinptr >= kbinend)
+  {
+  ssize_t n;
+  do n = read(stdin_fd, kbinput, sizeof(kbinput));
+    while (n < 0 && errno == EINTR);
+  if (n <= 0) return EOF;
+  kbinptr = 0;
+  kbinend = n;
+  }
+return kbinput[kbinptr++];
+}
+
+
+/* Put back a character that tc_getchar() returned, so that it is read again
+next time. */
+
+void tc_ungetchar(int c)
+{
+kbback[kbbackptr++] = c;
+}
+
+
+
+/*************************************************
+*      Build trie of key escape sequences        *
+*************************************************/
+
+/* The packed list of key sequences that is set up in sysunix.c is converted
+into a trie so that an incoming sequence can be decoded in a single pass
+instead of being compared in turn with every item in the list. Each node
+records the entry in tc_k_strings for a sequence that ends at it (if any), and
+the position of that entry in the list, because when two sequences overlap the
+one that comes first in the list must win, as it did with a linear scan. The
+lowest such position for the sequences that continue beyond a node is also
+kept, so that the decoder knows when nothing longer can take precedence. */
+
+typedef struct keynode {
+  usint  child;         /* first child; 0 if none */
+  usint  sibling;       /* next sibling; 0 if none */
+  uschar *entry;        /* tc_k_strings entry ending here, or NULL */
+  int    index;         /* position of that entry in the list */
+  int    minindex;      /* lowest position for sequences through here */
+  int    below;         /* lowest position for longer sequences */
+  uschar ch;            /* the byte for this node */
+} keynode;
+
+static keynode *keytrie = NULL;
+
+static void
+tc_buildkeytrie(void)
+{
+int i, count, nodes;
+uschar *sp = tc_k_strings + 1;
+
+count = tc_k_strings[0];
+
+/* The number of nodes cannot exceed the total length of the sequences. */
+
+nodes = 1;
+for (i = 0; i < count; i++)
+  {
+  nodes += Ustrlen(sp + 1);
+  sp += sp[0];
+  }
+
+keytrie = (keynode *)store_Xget(nodes * sizeof(keynode));
+keytrie[0].child = keytrie[0].sibling = 0;
+keytrie[0].entry = NULL;
+keytrie[0].index = keytrie[0].minindex = keytrie[0].below = INT_MAX;
+nodes = 1;
+
+sp = tc_k_strings + 1;
+for (i = 0; i < count; i++, sp += sp[0])
+  {
+  usint n = 0;
+  uschar *p;
+
+  for (p = sp + 1; *p != 0; p++)
+    {
+    usint next = keytrie[n].child;
+    while (next != 0 && keytrie[next].ch != *p) next = keytrie[next].sibling;
+
+    if (next == 0)
+      {
+      keynode *new = keytrie + nodes;
+      new->child = 0;
+      new->sibling = keytrie[n].child;
+      new->entry = NULL;
+      new->index = new->minindex = new->below = INT_MAX;
+      new->ch = *p;
+      keytrie[n].child = next = nodes++;
+      }
+
+    if (n != 0 && i < keytrie[n].below) keytrie[n].below = i;
+    if (i < keytrie[next].minindex) keytrie[next].minindex = i;
+    n = next;
+    }
+
+  /* If the same sequence appears twice, the first one is used. */
+
+  if (keytrie[n].entry == NULL)
+    {
+    keytrie[n].entry = sp;
+    keytrie[n].index = i;
+    }
+  }
+}
+
+
+
 /*************************************************
 *      Get keystroke and convert to standard     *
 *************************************************/
@@ -184,24 +375,36 @@ We should never get EOF from a raw mode terminal input stream, but its possible
 to get NE confused into thinking it is interactive when it isn't. So code for
 this case. */
 
-static uschar kbback[20];
-static int kbbackptr;
-
 static int sunix_nextchar(int *type)
 {
-int scount, kbptr, c, k;
-uschar *sp;
-uschar kbbuff[20];
+int kbptr, c, k, len;
+int limit = INT_MAX;
+usint n;
+uschar *sp = NULL;
+uschar kbbuff[32];
 
 sunix_flush();  /* Deliver buffered output */
+if (main_latency) latency_mark(lat_flushed);
 
 /* Get next key */
 
-if (kbbackptr > 0) c = kbback[--kbbackptr]; else
+/* While waiting, write out autosave records, write a background SAVE or
+WRITE a slice at a time until a keystroke arrives, read the files of buffers
+that have not yet been loaded, and then keep a followed file's buffer up to
+date. */
+
+if (kbbackptr == 0 && kbinptr >= kbinend)
   {
-  c = getchar();
-  if (c == EOF) return -1;
+  int wait;
+  recover_idle();
+  while (save_idle() && !sys_inputready(0)) sunix_flush();
+  while (init_loadidle() && !sys_inputready(0)) sunix_flush();
+  while ((wait = follow_idle()) >= 0 && !sys_inputready(wait)) sunix_flush();
+  sunix_flush();
   }
+c = tc_getchar();
+if (c == EOF) return -1;
+if (main_latency) latency_mark(lat_key);
 
 /* Keys that have values > 127 are always treated as data; if the terminal is
 configured for UTF-8 we have to do UTF-8 decoding. */
@@ -214,8 +417,7 @@ if (c > 127)
     int i;
     uschar buff[8];
     buff[0] = c;
-    for (i = 1; i <= utf8_table4[c & 0x3f]; i++)
-      buff[i] = (kbbackptr > 0)? kbback[--kbbackptr] : getchar();
+    for (i = 1; i <= utf8_table4[c & 0x3f]; i++) buff[i] = tc_getchar();
     (void)utf82ord(buff, &c);
     }
   return c;
@@ -233,112 +435,117 @@ sequences. */
 
 if (k != 254) return (k == 255)? c : k;
 
-/* We are at the start of a possible multi-character sequence. */
+/* We are at the start of a possible multi-character sequence. Walk down the
+trie, remembering the best complete sequence seen so far, until the input
+diverges or nothing further down could take precedence over what has been
+found. Characters read beyond the end of the chosen sequence (or beyond the
+first character, if there is no match) are put back on the stack. */
 
-sp = tc_k_strings + 1;
-scount = tc_k_strings[0];
-kbptr = 0;
-
-/* Loop reading keystrokes and checking strings against those in the list. When
-we find one that matches, if the data is more than one byte long, it is
-interpreted as a UTF-8 data character. */
+len = kbptr = 0;
+kbbuff[0] = c;
+n = keytrie[0].child;
+while (n != 0 && keytrie[n].ch != c) n = keytrie[n].sibling;
 
-for (;;)
+while (n != 0)
   {
-  if (c == sp[1+kbptr])       /* Next byte matches */
+  keynode *node = keytrie + n;
+
+  kbbuff[kbptr++] = c;
+  if (node->index < limit)
     {
-    if (sp[2+kbptr] == 0)     /* Reached end; whole sequence matches */
-      {
-      if (sp[0] > kbptr + 4)                    /* More than one value byte */
-        {
-        (void)utf82ord(sp + 3 + kbptr, &c);
-        *type = ktype_data;
-        }
+    sp = node->entry;
+    len = kbptr;
+    limit = node->index;
+    }
 
-      /* Handle "next key is literal" */
+  if (node->below >= limit || kbptr >= (int)sizeof(kbbuff)) break;
 
-      else if ((c = sp[3+kbptr]) == Pkey_data)  /* Special case for literal */
-        {
-        c = (kbbackptr > 0)? kbback[--kbbackptr] : getchar();
-        if (c < 127) c &= ~0x60;
-        *type = ktype_data;
-        }
+  c = tc_getchar();
+  for (n = node->child; n != 0; n = keytrie[n].sibling)
+    if (keytrie[n].ch == c && keytrie[n].minindex < limit) break;
+  if (n == 0) kbback[kbbackptr++] = c;
+  }
 
-      /* Handle information about a mouse click. There follows three bytes, an
-      event indication and the x,y coordinates, all coded as value+32. The x,y
-      coordinates are based at 1,1 which is why we have to subtract 1 from the
-      column and the row. */
+/* If no sequence matched, yield the first character. */
 
-      else if (c == Pkey_xy)                    /* Mouse click X,Y */
-        {
-        int event = ((kbbackptr > 0)? kbback[--kbbackptr] : getchar()) - 32;
-        mouse_col = ((kbbackptr > 0)? kbback[--kbbackptr] : getchar()) - 32 - 1;
-        mouse_row = ((kbbackptr > 0)? kbback[--kbbackptr] : getchar()) - 32 - 1;
-
-        /* A wheel mouse gives event 0x40 for "scroll up" and 0x41 for "scroll
-        down". Otherwise, pay attention only to button 1 press, which has event
-        value 0. */
-
-        switch (event)
-          {
-          case 0x40:
-          c = Pkey_mscr_up;
-          break;
-
-          case 0x41:
-          c = Pkey_mscr_down;
-          break;
-
-          case 0:
-          c = Pkey_xy;   /* It already has this value, of course. */
-          break;
-
-          default:
-          c = Pkey_null;
-          break;
-          }
-        }
+if (sp == NULL)
+  {
+  while (kbptr > 1) kbback[kbbackptr++] = kbbuff[--kbptr];
+  return kbbuff[0];
+  }
+while (kbptr > len) kbback[kbbackptr++] = kbbuff[--kbptr];
 
-      /* Handle a Unicode code point specified by number. */
+/* We have a complete sequence; if the data is more than one byte long, it is
+interpreted as a UTF-8 data character. */
 
-      else if (c == Pkey_utf8)
-        {
-        int i;
-        c = 0;
-        for (i = 0; i < 5; i++)
-          {
-          k = (kbbackptr > 0)? kbback[--kbbackptr] : getchar();
-          if (!isxdigit(k))
-            {
-            if (k != 0x1b) kbback[kbbackptr++] = k;  /* Use if not ESC */
-            break;
-            }
-          k = toupper(k);
-          c = (c << 4) + (isalpha(k)? k - 'A' + 10 : k - '0');
-          }
-        *type = ktype_data;
-        }
+if (sp[0] > len + 3)                      /* More than one value byte */
+  {
+  (void)utf82ord(sp + 2 + len, &c);
+  *type = ktype_data;
+  }
 
-      /* Always break out of the loop, returning c */
+/* Handle "next key is literal" */
 
-      break;
-      }
+else if ((c = sp[2+len]) == Pkey_data)    /* Special case for literal */
+  {
+  c = tc_getchar();
+  if (c < 127) c &= ~0x60;
+  *type = ktype_data;
+  }
 
-    /* Not reached end, save current character and continue with next. */
+/* Handle information about a mouse click. There follows three bytes, an event
+indication and the x,y coordinates, all coded as value+32. The x,y coordinates
+are based at 1,1 which is why we have to subtract 1 from the column and the
+row. */
 
-    kbbuff[kbptr++] = c;
-    c = (kbbackptr > 0)? kbback[--kbbackptr] : getchar();
-    continue;
+else if (c == Pkey_xy)                    /* Mouse click X,Y */
+  {
+  int event = tc_getchar() - 32;
+  mouse_col = tc_getchar() - 32 - 1;
+  mouse_row = tc_getchar() - 32 - 1;
+
+  /* A wheel mouse gives event 0x40 for "scroll up" and 0x41 for "scroll
+  down". Otherwise, pay attention only to button 1 press, which has event
+  value 0. */
+
+  switch (event)
+    {
+    case 0x40:
+    c = Pkey_mscr_up;
+    break;
+
+    case 0x41:
+    c = Pkey_mscr_down;
+    break;
+
+    case 0:
+    c = Pkey_xy;   /* It already has this value, of course. */
+    break;
+
+    default:
+    c = Pkey_null;
+    break;
     }
+  }
 
-  /* Failed to match current escape sequence. Stack characters
-  read so far and either advance to next sequence, or yield one
-  character. */
+/* Handle a Unicode code point specified by number. */
 
-  kbbuff[kbptr++] = c;
-  while (kbptr > 1) kbback[kbbackptr++] = kbbuff[--kbptr];
-  c = kbbuff[--kbptr];
-  if (--scount > 0) sp += sp[0]; else break;
+else if (c == Pkey_utf8)
+  {
+  int i;
+  c = 0;
+  for (i = 0; i < 5; i++)
+    {
+    k = tc_getchar();
+    if (!isxdigit(k))
+      {
+      if (k != 0x1b) kbback[kbbackptr++] = k;  /* Use if not ESC */
+      break;
+      }
+    k = toupper(k);
+    c = (c << 4) + (isalpha(k)? k - 'A' + 10 : k - '0');
+    }
+  *type = ktype_data;
   }
 
 return c;
@@ -387,10 +594,25 @@ return key;
 
 static int my_putc(MY_PUTC_ARG_TYPE c)
 {
-if (outbuffptr > outbuffsize - 2)
+if (outbuffptr >= out_buffsize)
   {
-  if (write(ioctl_fd, out_buffer, outbuffptr)){};  /* Fudge avoid warning */
-  outbuffptr = 0;
+  uschar *newbuff = NULL;
+
+  /* Double the buffer, up to a maximum. If that is reached, or if no memory
+  is available, fall back to flushing in the middle of the frame. */
+
+  if (out_buffsize < outbuffmax)
+    {
+    newbuff = (out_buffer == out_static)? malloc(2 * out_buffsize) :
+      realloc(out_buffer, 2 * out_buffsize);
+    }
+
+  if (newbuff == NULL) sunix_flush(); else
+    {
+    if (out_buffer == out_static) memcpy(newbuff, out_static, outbuffptr);
+    out_buffer = newbuff;
+    out_buffsize *= 2;
+    }
   }
 out_buffer[outbuffptr++] = c;
 return c;
@@ -625,6 +847,12 @@ if (tc_s_ke != NULL) outTCstring(tc_s_ke, 0);
 if (tc_s_te != NULL) outTCstring(tc_s_te, 0);
 sunix_flush();
 tcsetattr(ioctl_fd, TCSANOW, &oldtermparm);
+if (out_buffer != out_static)
+  {
+  free(out_buffer);
+  out_buffer = out_static;
+  out_buffsize = outbuffsize;
+  }
 }
 
 
@@ -680,6 +908,27 @@ tcgetattr(ioctl_fd, &oldtermparm);
 tc_int_ch = oldtermparm.c_cc[VINTR];
 tc_stop_ch = oldtermparm.c_cc[VSTOP];
 setupterminal();
+tc_buildkeytrie();
+
+/* Decide whether to bracket output frames for synchronized update. This is
+done for xterm-like terminals, using the private mode 2026 (others ignore the
+unknown mode), and for any whose terminfo entry has the "Sync" extended
+capability, whose parameter is 1 to begin an update and 2 to end it. */
+
+sync_output = tt_special == tt_special_xterm;
+#ifndef HAVE_TERMCAP
+  {
+  char *sync = tigetstr("Sync");
+  if (sync != NULL && sync != (char *)(-1))
+    {
+    char *s = tparm(sync, 1);
+    if (s != NULL) sync_begin = store_copystring(US s);
+    s = tparm(sync, 2);
+    if (s != NULL) sync_end = store_copystring(US s);
+    sync_output = TRUE;
+    }
+  }
+#endif
 
 /* If we are in an xterm, see whether it is UTF-8 enabled. The only way I've
 found of doing this is to write two bytes which independently are two 8859
@@ -819,7 +1068,11 @@ if (init_init(fid, fromname, toname))
     else
       {
       if (c == -1) main_done = TRUE;    /* Should never occur, but... */
-        else if (type < 0) sys_keystroke(c); else key_handle_data(c);
+        else
+        {
+        if (type < 0) sys_keystroke(c); else key_handle_data(c);
+        if (main_latency) latency_mark(lat_handled);
+        }
       }
     }
   }
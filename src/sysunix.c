@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2021 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: May 2021 */
+/* This file last modified: October 2026 */
 
 
 /* This file contains the system-specific routines for Unix, with the exception
@@ -17,8 +17,11 @@ of the window-specific code, which lives in its own modules. */
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <poll.h>
+#include <time.h>
 
 #include "ehdr.h"
 #include "unixhdr.h"
@@ -995,6 +998,27 @@ del_curterm(cur_term);
 }
 
 
+/*************************************************
+*          Get time in microseconds              *
+*************************************************/
+
+/* This is used for timing measurements, so a monotonic clock is used if there
+is one. Only differences between values are meaningful. */
+
+uint64_t sys_usecs(void)
+{
+#ifdef CLOCK_MONOTONIC
+struct timespec ts;
+clock_gettime(CLOCK_MONOTONIC, &ts);
+return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+struct timeval tv;
+gettimeofday(&tv, NULL);
+return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+
 /*************************************************
 *                Munge return code               *
 *************************************************/
@@ -1238,6 +1262,106 @@ return Ufopen(name, type);
 }
 
 
+
+/*************************************************
+*          Name of a file's recovery log         *
+*************************************************/
+
+/* The log is kept beside the file, with ".NElog" added to its name.
+
+Argument:  the file name
+Returns:   the log's name, in new store
+*/
+
+uschar *sys_recoveryname(uschar *name)
+{
+uschar buff[256];
+uschar *yield;
+if (name[0] == '~') name = sort_twiddle(name, Ustrlen(name), buff);
+yield = store_Xget(Ustrlen(name) + 7);
+sprintf(CS yield, "%s.NElog", name);
+return yield;
+}
+
+
+
+/*************************************************
+*         Get a file's size and time             *
+*************************************************/
+
+/* This is used to check that a recovery log belongs to the file that it is
+applied to.
+
+Arguments:
+  name         the file name
+  size         where to put the size
+  mtime        where to put the modification time
+
+Returns:       FALSE if the file does not exist
+*/
+
+BOOL sys_filestamp(uschar *name, uint64_t *size, uint64_t *mtime)
+{
+struct stat statbuf;
+uschar buff[256];
+if (name[0] == '~') name = sort_twiddle(name, Ustrlen(name), buff);
+if (Ustat(name, &statbuf) != 0) return FALSE;
+*size = (uint64_t)statbuf.st_size;
+*mtime = (uint64_t)statbuf.st_mtime;
+return TRUE;
+}
+
+
+
+/*************************************************
+*           Get identity of a file               *
+*************************************************/
+
+/* This is used to notice when a file that is being followed has been replaced
+by a different file of the same name, as happens when a log is rotated.
+
+Arguments:
+  name         the file name, or NULL
+  f            the open file to use when name is NULL
+  size         where to put the size
+  ident        where to put a value that identifies the file
+
+Returns:       FALSE if the file does not exist
+*/
+
+BOOL sys_fileident(uschar *name, FILE *f, uint64_t *size, uint64_t *ident)
+{
+struct stat statbuf;
+uschar buff[256];
+if (name == NULL)
+  {
+  if (fstat(fileno(f), &statbuf) != 0) return FALSE;
+  }
+else
+  {
+  if (name[0] == '~') name = sort_twiddle(name, Ustrlen(name), buff);
+  if (Ustat(name, &statbuf) != 0) return FALSE;
+  }
+*size = (uint64_t)statbuf.st_size;
+*ident = (uint64_t)statbuf.st_ino ^ ((uint64_t)statbuf.st_dev << 48);
+return TRUE;
+}
+
+
+
+/*************************************************
+*           Force a file to disc                 *
+*************************************************/
+
+/* Returns FALSE if there is an error */
+
+BOOL sys_syncfile(FILE *f)
+{
+if (fflush(f) == EOF) return FALSE;
+return fsync(fileno(f)) == 0;
+}
+
+
 /*************************************************
 *              Check file name                   *
 *************************************************/
@@ -1279,6 +1403,14 @@ va_end(ap);
 }
 
 
+/* Blocks of text that need no formatting are written here. */
+
+void sys_mwrite(FILE *f, uschar *s, size_t len)
+{
+fwrite(s, 1, len, f);
+}
+
+
 
 /*************************************************
 *            Give reason for key refusal         *
@@ -1311,6 +1443,35 @@ return FALSE;
 
 
 
+/*************************************************
+*        Test for waiting keyboard input         *
+*************************************************/
+
+/* This is used for writing a background SAVE between keystrokes, and for
+polling a file that is being followed. If no input is waiting, it waits for up
+to the given time for some to arrive.
+
+Argument:   the time to wait, in milliseconds
+Returns:    TRUE if there is input waiting
+*/
+
+BOOL sys_inputready(int msec)
+{
+int c = 0;
+ioctl(ioctl_fd, FIONREAD, &c);
+if (c == 0 && msec > 0)
+  {
+  struct pollfd pfd;
+  pfd.fd = ioctl_fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  return poll(&pfd, 1, msec) > 0;
+  }
+return c > 0;
+}
+
+
+
 /*************************************************
 *           System-specific interrupt check      *
 *************************************************/
@@ -1330,9 +1491,13 @@ passes over the kind of processing that is taking place:
   ci_cmd      about to obey a command
   ci_delete   deleting all lines of a buffer
   ci_scan     scanning lines (e.g. for show wordcount)
-  ci_loop     about to obey the body of a loop
+  ci_loop     about to obey the body of a loop, or a command within one
+  ci_search   f, bf, or g searching for a line
 
-These are successive integer values, starting from zero. */
+These are successive integer values, starting from zero. While searching, any
+keystroke other than the interrupt character cancels the search, unless ATTN
+OFF is in force. It is put back to be read in the normal way, and
+main_keypressed is set. */
 
 
 /* This vector of masks is used to mask the counter; if the result is
@@ -1347,7 +1512,8 @@ static int ci_masks[] = {
     15,      /* ci_cmd  - every 16 commands */
     127,     /* ci_delete - every 128 lines */
     1023,    /* ci_scan - every 1024 lines */
-    15       /* ci_loop - every 16 commands */
+    1023,    /* ci_loop - every 1024 commands or loop iterations */
+    1023     /* ci_search - every 1024 lines */
 };
 
 void sys_checkinterrupt(int type)
@@ -1359,7 +1525,14 @@ if (main_screenOK && !main_escape_pressed &&
   ioctl(ioctl_fd, FIONREAD, &c);
   while (c-- > 0)
     {
-    if (getchar() == tc_int_ch) main_escape_pressed = TRUE;
+    int ch = tc_getchar();
+    if (ch == tc_int_ch) main_escape_pressed = TRUE;
+    else if (type == ci_search && main_attn)
+      {
+      tc_ungetchar(ch);
+      main_keypressed = TRUE;
+      break;
+      }
     }
   }
 }
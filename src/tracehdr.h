@@ -0,0 +1,68 @@
+/*************************************************
+*       The E text editor - 3rd incarnation      *
+*************************************************/
+
+/* Copyright (c) University of Cambridge, 1991 - 2021 */
+
+/* Written by Philip Hazel, starting November 1991 */
+/* This file last modified: October 2026 */
+
+
+/* This header defines the format of the files written by the event tracing
+code in etrace.c. It is included by ehdr.h, and also by the netrace decoder,
+which is not part of NE and uses nothing else from NE's headers. A trace file
+contains a header, then the records oldest first, then the names of NE's
+commands, each followed by a zero byte, in order of command identity. Numbers
+are in the byte order of the machine that wrote the file. */
+
+#ifndef TRACEHDR_H
+#define TRACEHDR_H
+
+#include <stdint.h>
+
+#define TRACE_MAGIC    "NETRACE"
+#define TRACE_VERSION  1
+
+/* Events. The values are part of the file format, so new ones must be added
+at the end. The meanings of the a and b fields are given for each. */
+
+enum {
+  tr_none,
+  tr_cmd,           /* a = command id */
+  tr_cmdend,        /* a = command id, b = yield */
+  tr_display,       /* start of scrn_display() */
+  tr_displayend,
+  tr_displayline,   /* a = screen row */
+  tr_clearline,     /* a = screen row */
+  tr_scroll,        /* a = top row, b = amount (signed) */
+  tr_read,          /* a = buffer number */
+  tr_readend,       /* a = lines read, b = bytes read */
+  tr_save,          /* a = buffer number */
+  tr_saveend,       /* a = lines written, b = yield */
+  tr_storeget,      /* a = size, b = address */
+  tr_storefree,     /* a = number of blocks, b = address if only one */
+  tr_storeblock,    /* a = size of system block, b = address */
+  tr_match,         /* a = line number, b = result */
+  tr_dump,          /* a = signal, or zero */
+  tr_eventcount
+};
+
+typedef struct {
+  uint64_t time;    /* microseconds, from sys_usecs() */
+  uint32_t event;
+  uint32_t a;
+  uint64_t b;
+} tracerec;
+
+typedef struct {
+  char     magic[8];
+  uint32_t version;
+  uint32_t recsize;      /* sizeof(tracerec) */
+  uint32_t count;        /* number of records */
+  uint32_t namesize;     /* bytes of command names */
+  uint64_t lost;         /* earlier records that were overwritten */
+} traceheader;
+
+#endif
+
+/* End of tracehdr.h */
@@ -5,7 +5,7 @@
 /* Copyright (c) University of Cambridge, 1991 - 2016 */
 
 /* Written by Philip Hazel, starting November 1991 */
-/* This file last modified: January 2016 */
+/* This file last modified: October 2026 */
 
 /* This file is specific to the support modules for UNIX */
 
@@ -111,6 +111,8 @@ any. */
 *************************************************/
 
 extern void tc_connect(void);
+extern int  tc_getchar(void);
+extern void tc_ungetchar(int);
 
 
 